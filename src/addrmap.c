@@ -0,0 +1,152 @@
+#include "addrmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ADDRMAP_MIN_CAP 16
+
+/*
+*	FNV-1a.
+*/
+static uint32_t hash (const struct client_addr *addr)
+{
+    const unsigned char *const p = (const unsigned char *) addr;
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < sizeof *addr; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+static int same_addr (const struct client_addr *a, const struct client_addr *b)
+{
+    return !memcmp (a, b, sizeof *a);
+}
+
+/**
+*	\brief	Puts addr and entry in the first empty slot from its home on.
+*			There has to be one.
+*/
+static void place (struct addrmap *m, const struct client_addr *addr,
+                   int entry)
+{
+    const unsigned mask = m->cap - 1;
+    unsigned i = hash (addr) & mask;
+
+    while (m->slots[i].entry != -1) {
+        i = (i + 1) & mask;
+    }
+    m->slots[i].addr = *addr;
+    m->slots[i].entry = entry;
+}
+
+/**
+*	\brief	Doubles the number of slots, and rehashes into them.
+*	\return	0 on success, or -1 on failure.
+*/
+static int grow (struct addrmap *m)
+{
+    const unsigned cap = m->cap ? m->cap * 2 : ADDRMAP_MIN_CAP;
+    struct addrmap_slot *const old = m->slots;
+    const unsigned old_cap = m->cap;
+
+    if (!(m->slots = malloc (cap * sizeof *m->slots))) {
+        m->slots = old;
+        return -1;
+    }
+    for (unsigned i = 0; i < cap; i++) {
+        m->slots[i].entry = -1;
+    }
+    m->cap = cap;
+
+    for (unsigned i = 0; i < old_cap; i++) {
+        if (old[i].entry != -1) {
+            place (m, &old[i].addr, old[i].entry);
+        }
+    }
+    free (old);
+    return 0;
+}
+
+int addrmap_insert (struct addrmap *m, const struct client_addr *addr,
+                    int entry)
+{
+    /*
+     * At most half full, so that probe sequences stay short.
+     */
+    if ((m->count + 1) * 2 > m->cap && grow (m) == -1) {
+        return -1;
+    }
+    place (m, addr, entry);
+    m->count++;
+    return 0;
+}
+
+void addrmap_remove (struct addrmap *m, const struct client_addr *addr,
+                     int entry)
+{
+    if (!m->cap) {
+        return;
+    }
+
+    const unsigned mask = m->cap - 1;
+    unsigned i = hash (addr) & mask;
+
+    while (m->slots[i].entry != entry || !same_addr (&m->slots[i].addr, addr)) {
+        if (m->slots[i].entry == -1) {
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+
+    /*
+     * Move back each later slot in the run that may live in the hole, that
+     * is, whose home is not between the hole and itself.
+     */
+    for (unsigned j = i;;) {
+        j = (j + 1) & mask;
+
+        if (m->slots[j].entry == -1) {
+            break;
+        }
+
+        const unsigned home = hash (&m->slots[j].addr) & mask;
+
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            m->slots[i] = m->slots[j];
+            i = j;
+        }
+    }
+    m->slots[i].entry = -1;
+    m->count--;
+}
+
+int addrmap_next (const struct addrmap *m, const struct client_addr *addr,
+                  unsigned *pos)
+{
+    if (!m->cap) {
+        return -1;
+    }
+
+    const unsigned mask = m->cap - 1;
+    const unsigned home = hash (addr) & mask;
+
+    for (;; ++*pos) {
+        const struct addrmap_slot *const slot = &m->slots[(home + *pos) & mask];
+
+        if (slot->entry == -1) {
+            return -1;
+        }
+        if (same_addr (&slot->addr, addr)) {
+            ++*pos;
+            return slot->entry;
+        }
+    }
+}
+
+void addrmap_free (struct addrmap *m)
+{
+    free (m->slots);
+    *m = (struct addrmap) { 0 };
+}
@@ -0,0 +1,58 @@
+#ifndef ADDRMAP_H
+#define ADDRMAP_H
+
+#include <stdint.h>
+
+/*
+*	A peer's IP address in binary, as compared for evictions. IPv4-mapped
+*	IPv6 addresses are stored as IPv4, so a client is the same client
+*	whichever listener it came in on. A family of 0 means unknown.
+*/
+struct client_addr {
+    uint16_t family;
+    uint8_t bytes[16];
+};
+
+struct addrmap_slot {
+    struct client_addr addr;
+    int entry;                  /* -1 if the slot is empty. */
+};
+
+/*
+*	An open-addressing hash from addresses to client table entries, with
+*	linear probing. An address may map to several entries. Removal shifts
+*	the entries after it back rather than leaving tombstones, so lookups
+*	stay short however much the table churns.
+*/
+struct addrmap {
+    struct addrmap_slot *slots;
+    unsigned cap;               /* A power of 2, or 0. */
+    unsigned count;
+};
+
+/**
+*	\brief	Maps addr to entry, as well as to whatever it already maps to.
+*	\return	0 on success, or -1 if the system is out of memory.
+*/
+int addrmap_insert (struct addrmap *m, const struct client_addr *addr,
+                    int entry);
+
+/**
+*	\brief	Removes the mapping from addr to entry, if there is one.
+*/
+void addrmap_remove (struct addrmap *m, const struct client_addr *addr,
+                     int entry);
+
+/**
+*	\brief	Finds the entries addr maps to, one per call.
+*	\param	pos - Where to start looking. Set it to 0 for the first call,
+*			and pass it back unchanged for the next. Any change to m
+*			invalidates it.
+*	\return	An entry, or -1 once there are no more.
+*/
+int addrmap_next (const struct addrmap *m, const struct client_addr *addr,
+                  unsigned *pos);
+
+void addrmap_free (struct addrmap *m);
+
+#endif /* ADDRMAP_H */
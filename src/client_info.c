@@ -1,63 +1,207 @@
 #include "client_info.h"
+#include "compress.h"
+#include "tls.h"
 
-#include <string.h>
-#include <arpa/inet.h>
+#include <stdlib.h>
+#include <errno.h>
 
 #define SENTINEL_VALUE -1
 
-void init_clients (int size, struct client_info slaves[size],
-                              struct client_info *p_slaves[size])
+/*
+*	Records and receive rings are allocated this many at a time.
+*/
+#define RECORDS_PER_CHUNK	64
+#define RINGS_PER_CHUNK		8
+
+int init_clients (struct client_table *table, int size)
 {
-    for (int i = 0; i < size; i++) {
-        slaves[i].id = slaves[i].sock = SENTINEL_VALUE;
-        p_slaves[i] = &slaves[i];
+    /*
+     * Left zeroed, the pages behind these are not touched until entries
+     * near them are used.
+     */
+    *table = (struct client_table) { 0 };
+    table->p_slaves = calloc ((size_t) size, sizeof *table->p_slaves);
+    table->members = calloc ((size_t) size, sizeof *table->members);
+    table->by_fd = calloc ((size_t) size, sizeof *table->by_fd);
+    table->free_entries = calloc ((size_t) size, sizeof *table->free_entries);
+    table->pending = calloc ((size_t) size, sizeof *table->pending);
+    table->rooms = calloc (ROOM_MAX, sizeof *table->rooms);
+
+    if (!table->p_slaves || !table->members || !table->by_fd
+        || !table->free_entries || !table->pending || !table->rooms) {
+        free_clients (table);
+        return -1;
     }
+    slab_init (&table->records, sizeof (struct client_info),
+               RECORDS_PER_CHUNK);
+    slab_init (&table->rings, RECVBUF_LEN, RINGS_PER_CHUNK);
+    table->size = size;
+    table->count = table->hwm = table->congested = table->n_pending = 0;
+    table->n_free = 0;
+    return 0;
 }
 
-
-int find_empty_slot (struct client_info *const *slaves, int size)
+void free_clients (struct client_table *table)
 {
-    for (int i = 0; i < size; i++) {
-        if (slaves[i]->id == SENTINEL_VALUE) {
-            return i;
-        }
+    slab_destroy (&table->records);
+    slab_destroy (&table->rings);
+    addrmap_free (&table->by_addr);
+
+    for (int i = 0; table->rooms && i < ROOM_MAX; i++) {
+        free (table->rooms[i].slots);
     }
-    /* UNREACHED. */
-    return -1;
+    free (table->rooms);
+    table->rooms = 0;
+    free (table->p_slaves);
+    free (table->members);
+    free (table->by_fd);
+    free (table->free_entries);
+    free (table->pending);
+    table->p_slaves = table->members = 0;
+    table->by_fd = table->free_entries = table->pending = 0;
+    table->size = table->count = table->hwm = table->congested = 0;
+    table->n_pending = table->n_free = 0;
 }
 
-void fill_client_entry (int slave_fd, int id, int entry,
-                        struct client_info *const *slaves,
-                        const struct client_info *client_info)
+int find_empty_slot (const struct client_table *table)
 {
-    memcpy (slaves[entry]->address, client_info->address,
-            INET6_ADDRSTRLEN);
-    slaves[entry]->id = id;
-    slaves[entry]->sock = slave_fd;
+    if (table->n_free) {
+        return table->free_entries[table->n_free - 1];
+    }
+    return table->hwm < table->size ? table->hwm : -1;
 }
 
-void clear_client_entry (int entry, struct client_info *const *slaves)
+int fill_client_entry (int slave_fd, int entry, struct client_table *table,
+                       const struct client_info *client_info)
 {
-    memset (slaves[entry]->address, 0x00, INET6_ADDRSTRLEN);
-    slaves[entry]->id = SENTINEL_VALUE;
-    slaves[entry]->sock = SENTINEL_VALUE;
+    struct client_info *slave = table->p_slaves[entry];
+
+    if (slave_fd < 0 || slave_fd >= table->size) {
+        errno = EBADF;
+        return -1;
+    }
+    /*
+     * Addresses we could not find out are never evicted, so they are left
+     * out of the index.
+     */
+    if (client_info->address.family
+        && addrmap_insert (&table->by_addr, &client_info->address,
+                           entry) == -1) {
+        return -1;
+    }
+    /*
+     * A record still listed in pending is reused as it is.
+     */
+    if (!slave) {
+        if (!(slave = slab_alloc (&table->records))) {
+            addrmap_remove (&table->by_addr, &client_info->address, entry);
+            return -1;
+        }
+        slave->flags = 0;
+        table->p_slaves[entry] = slave;
+    }
+    if (entry == table->hwm) {
+        table->hwm++;
+    } else {
+        table->n_free--;
+    }
+    table->by_fd[slave_fd] = entry + 1;
+    slave->member = table->count;
+    table->members[table->count] = slave;
+    slave->address = client_info->address;
+    slave->id = entry;
+    slave->sock = slave_fd;
+    slave->serial = client_info->serial;
+    /*
+     * CLIENT_PENDING belongs to the entry rather than the connection: it
+     * says whether the entry is listed, which outlives a connection closed
+     * mid-tick.
+     */
+    slave->flags &= CLIENT_PENDING;
+    slave->events = client_info->events;
+    slave->room = -1;
+    slave->n_rooms = 0;
+    slave->sendq = (struct sendq) { 0 };
+    slave->rbuf = (struct recvbuf) { 0 };
+    slave->timer = (struct timer) { 0 };
+    slave->tls = 0;
+    slave->since = slave->active = client_info->since;
+    table->count++;
+    return 0;
 }
 
-int comp_client_address (const void *s, const void *t)
+void clear_client_entry (int entry, struct client_table *table)
 {
-    const struct client_info *const *p = s;
-    const struct client_info *const *q = t;
+    struct client_info *const slave = table->p_slaves[entry];
+    struct client_info *const last = table->members[--table->count];
+
+    room_leave_all (table, slave);
+    timer_cancel (&table->timers, &slave->timer);
+    tls_close (slave->tls);
+    slave->tls = 0;
 
-    return memcmp ((*p)->address, (*q)->address, INET6_ADDRSTRLEN);
+    if (slave->flags & CLIENT_DEFLATE) {
+        slave->flags &= ~(unsigned) CLIENT_DEFLATE;
+        compress_detach ();
+    }
+    table->by_fd[slave->sock] = 0;
+    addrmap_remove (&table->by_addr, &slave->address, entry);
+    last->member = slave->member;
+    table->members[slave->member] = last;
+    table->free_entries[table->n_free++] = entry;
+
+    if (slave->flags & CLIENT_PENDING) {
+        slave->address = (struct client_addr) { 0 };
+        slave->id = SENTINEL_VALUE;
+        slave->sock = SENTINEL_VALUE;
+        slave->flags = CLIENT_PENDING;
+        slave->events = 0;
+    } else {
+        slab_free (&table->records, slave);
+        table->p_slaves[entry] = 0;
+    }
 }
 
-int comp_client_sock (const void *s, const void *t)
+struct client_info *unlist_client_entry (int entry,
+                                         struct client_table *table)
 {
-    const struct client_info *const *p = s;
-    const struct client_info *const *q = t;
+    struct client_info *const slave = table->p_slaves[entry];
 
-    return ((*p)->sock > (*q)->sock) - ((*p)->sock < (*q)->sock);
+    slave->flags &= ~(unsigned) CLIENT_PENDING;
+
+    if (slave->sock == SENTINEL_VALUE) {
+        slab_free (&table->records, slave);
+        table->p_slaves[entry] = 0;
+        return 0;
+    }
+    return slave;
 }
 
+struct client_info *find_client_by_fd (const struct client_table *table,
+                                       int slave_fd)
+{
+    if (slave_fd < 0 || slave_fd >= table->size || !table->by_fd[slave_fd]) {
+        return 0;
+    }
+    return table->p_slaves[table->by_fd[slave_fd] - 1];
+}
 
+struct client_info *find_predecessor (const struct client_table *table,
+                                      const struct client_info *slave_info)
+{
+    unsigned pos = 0;
+    int entry;
+
+    if (!slave_info->address.family) {
+        return 0;
+    }
+    while ((entry = addrmap_next (&table->by_addr, &slave_info->address,
+                                  &pos)) != -1) {
+        struct client_info *const slave = table->p_slaves[entry];
 
+        if (slave->serial < slave_info->serial) {
+            return slave;
+        }
+    }
+    return 0;
+}
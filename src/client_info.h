@@ -1,25 +1,124 @@
 #ifndef CLIENT_INFO_H
 #define CLIENT_INFO_H
 
-#include <arpa/inet.h>
+#include "addrmap.h"
+#include "pool.h"
+#include "recvbuf.h"
+#include "room.h"
+#include "sendq.h"
+#include "wheel.h"
+
+/*
+*	Flags for struct client_info.
+*/
+#define CLIENT_PAUSED		0x01	/* Not read from until others catch up. */
+#define CLIENT_CONGESTED	0x02	/* Its sendq is over the limit. */
+#define CLIENT_PENDING		0x04	/* Listed in the table's pending. */
+#define CLIENT_PINGED		0x08	/* Sent a FRAME_PING since it last spoke. */
+#define CLIENT_DEFLATE		0x10	/* Sent compressed messages. */
 
 /*
 *	A struct to keep track of an IP's state.
 */
 struct client_info {
-    char address[INET6_ADDRSTRLEN];
+    struct client_addr address;
     int id;
     int sock;
+    int member;                 /* Where it is in the table's members. */
+    unsigned long long serial;  /* Accept order, across all reactors. */
+    unsigned flags;
+    unsigned events;            /* What the event loop watches it for. */
+    int room;                   /* Where its lines go, or -1. */
+    int n_rooms;
+    struct membership rooms[CLIENT_MAX_ROOMS];  /* In the order joined. */
+    struct sendq sendq;
+    struct recvbuf rbuf;
+    struct timer timer;         /* Its next deadline, if any. */
+    long long since;            /* When it was accepted, in ms. */
+    long long active;           /* When it last sent anything, in ms. */
+    struct ssl_st *tls;         /* Its TLS session, until the kernel has it. */
+};
+
+/*
+*	The connected clients. The table is sized at start-up, once the number
+*	of descriptors we may open is known, but the records themselves come
+*	from a slab as connections arrive: a vacant entry is NULL, or holds a
+*	record that is still listed in pending.
+*
+*	Connections are indexed by descriptor and by peer address, so neither
+*	lookup scans the table, and listed densely in members, so that a
+*	broadcast visits the connected clients and nothing else.
+*/
+struct client_table {
+    struct client_info **p_slaves;
+    struct client_info **members;       /* The count clients, in no order. */
+    struct room_members *rooms;         /* ROOM_MAX of them. */
+    int *by_fd;                 /* Entry + 1 for each descriptor, or 0. */
+    struct addrmap by_addr;
+    struct slab records;        /* struct client_info */
+    struct slab rings;          /* Receive rings, RECVBUF_LEN bytes each. */
+    int size;                   /* Number of entries. */
+    int count;                  /* Entries in use. */
+    int hwm;                    /* One past the highest entry used so far. */
+    int *free_entries;          /* Vacated entries below hwm. */
+    int n_free;
+    int congested;              /* Entries with CLIENT_CONGESTED. */
+    int *pending;               /* Entries with output to flush this tick. */
+    int n_pending;
+    struct wheel timers;        /* The clients' deadlines. */
 };
 
-void init_clients (int size, struct client_info slaves[size],
-                              struct client_info *p_slaves[size]);
-int find_empty_slot (struct client_info *const *slaves, int size);
-void fill_client_entry (int slave_fd, int id, int entry,
-                        struct client_info *const *slaves,
-                        const struct client_info *client_info);
-void clear_client_entry (int entry, struct client_info *const *slaves);
-int comp_client_address (const void *s, const void *t);
-int comp_client_sock (const void *s, const void *t);
+/**
+*	\brief	Allocates size vacant entries.
+*	\return	0 on success, or -1 on failure.
+*/
+int init_clients (struct client_table *table, int size);
+void free_clients (struct client_table *table);
+
+/**
+*	\return	The index of an unused entry, or -1 if the table is full. It
+*			stays the same until an entry is filled or cleared.
+*/
+int find_empty_slot (const struct client_table *table);
+
+/**
+*	\brief	Puts a record for slave_fd in entry, which must be vacant, and
+*			indexes it.
+*	\return	0 on success, or -1 if the system is out of memory or slave_fd
+*			is beyond the table.
+*/
+int fill_client_entry (int slave_fd, int entry, struct client_table *table,
+                       const struct client_info *client_info);
+
+/**
+*	\brief	Vacates entry, taking its client out of every room and
+*			cancelling its timer, and freeing any TLS session. Its record
+*			goes back to the slab, unless it is
+*			listed in pending, in which case unlist_client_entry() returns it.
+*			The last of the members takes its place there, so a caller
+*			walking members while clients are dropped should walk them
+*			backwards.
+*/
+void clear_client_entry (int entry, struct client_table *table);
+
+/**
+*	\brief	Takes entry off the pending list.
+*	\return	Its record, or NULL if the entry has been vacated since it was
+*			listed.
+*/
+struct client_info *unlist_client_entry (int entry,
+                                         struct client_table *table);
+/**
+*	\return	The client on slave_fd, or NULL if there is none.
+*/
+struct client_info *find_client_by_fd (const struct client_table *table,
+                                       int slave_fd);
+
+/**
+*	\return	A client from the same address as slave_info that was accepted
+*			before it, or NULL if there is none.
+*/
+struct client_info *find_predecessor (const struct client_table *table,
+                                      const struct client_info *slave_info);
 
 #endif /* CLIENT_INFO__H */
@@ -0,0 +1,200 @@
+#include "command.h"
+#include "compress.h"
+#include "frame.h"
+#include "network.h"
+#include "recvbuf.h"
+#include "room.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+*	Enough for "* Joined NAME.\n" and the like.
+*/
+#define NOTICE_MAX (ROOM_NAME_MAX + 32)
+
+static int speaks_lines (const struct client_info *slave)
+{
+    return slave->rbuf.mode != RECV_FRAMES;
+}
+
+/**
+*	\brief	Answers a binary client with type, naming room in the payload,
+*			and a line client with verb and the name.
+*/
+static int send_notice (struct event_loop *loop, struct client_info *slave,
+                        enum frame_type type, int room, const char *verb,
+                        struct client_table *table)
+{
+    const char *const name = room_name (room);
+
+    if (!speaks_lines (slave)) {
+        return send_frame (loop, slave, type, room, name, strlen (name),
+                           table);
+    }
+
+    char line[NOTICE_MAX];
+    const int len = snprintf (line, sizeof line, "* %s %s.\n", verb, name);
+
+    return send_frame (loop, slave, FRAME_DATA, room, line, (size_t) len,
+                       table);
+}
+
+int send_error (struct event_loop *loop, struct client_info *slave,
+                int room, const char *why, struct client_table *table)
+{
+    if (!speaks_lines (slave)) {
+        return send_frame (loop, slave, FRAME_ERROR, room, why, strlen (why),
+                           table);
+    }
+
+    char line[NOTICE_MAX];
+    const int len = snprintf (line, sizeof line, "* %s\n", why);
+
+    return send_frame (loop, slave, FRAME_DATA, room, line, (size_t) len,
+                       table);
+}
+
+static const char *join_error (int err)
+{
+    switch (err) {
+        case EINVAL:
+            return "Room names are 1 to 32 printable characters.";
+        case ENOSPC:
+            return "There are too many rooms.";
+        case EMLINK:
+            return "You are in too many rooms.";
+        default:
+            return strerror (err);
+    }
+}
+
+static int join (struct event_loop *loop, struct client_info *slave,
+                 const char *name, size_t len, struct client_table *table)
+{
+    const int room = room_open (name, len);
+    const int slave_fd = slave->sock;
+
+    if (room == -1) {
+        return send_error (loop, slave, 0, join_error (errno), table);
+    }
+    if (room_join (table, slave, room) == -1) {
+        switch (errno) {
+            case EALREADY:
+                /*
+                 * Joining a room again makes it where lines go.
+                 */
+                slave->room = room;
+                return send_notice (loop, slave, FRAME_JOINED, room,
+                                    "Joined", table);
+            case ENOMEM:
+                return -1;
+            default:
+                return send_error (loop, slave, room, join_error (errno),
+                                   table);
+        }
+    }
+    /*
+     * A newcomer is told what it missed, unless the notice alone was too
+     * much for it and it has been dropped.
+     */
+    if (send_notice (loop, slave, FRAME_JOINED, room, "Joined", table) == -1) {
+        return -1;
+    }
+    if (find_client_by_fd (table, slave_fd) != slave) {
+        return 0;
+    }
+    return send_history (loop, slave, room, table);
+}
+
+static int leave (struct event_loop *loop, struct client_info *slave,
+                  const char *name, size_t len, int room,
+                  struct client_table *table)
+{
+    if (len) {
+        room = room_find (name, len);
+    }
+    if (room == -1 || room_leave (table, slave, room) == -1) {
+        return send_error (loop, slave, 0, "You are not in that room.",
+                           table);
+    }
+    return send_notice (loop, slave, FRAME_LEFT, room, "Left", table);
+}
+
+static int list (struct event_loop *loop, struct client_info *slave,
+                 struct client_table *table)
+{
+    const int lines = speaks_lines (slave);
+    const char *const prefix = lines ? "* " : "";
+    char probe[1];
+
+    /*
+     * Rooms may fill up between the two calls; the second one truncates.
+     */
+    const size_t size = room_list (probe, sizeof probe, prefix, !lines) + 1;
+    char *const buf = malloc (size);
+
+    if (!buf) {
+        return -1;
+    }
+
+    size_t len = room_list (buf, size, prefix, !lines);
+
+    if (len >= size) {
+        len = size - 1;
+    }
+
+    const int ret_val = send_frame (loop, slave, lines ? FRAME_DATA
+                                    : FRAME_ROOMS, 0, buf, len, table);
+
+    free (buf);
+    return ret_val;
+}
+
+/**
+*	\brief	Turns compression on for slave if it names COMPRESS_CODEC, or
+*			off otherwise, and tells it which.
+*/
+static int compression (struct event_loop *loop, struct client_info *slave,
+                        const char *codec, size_t len,
+                        struct client_table *table)
+{
+    const int on = len == sizeof COMPRESS_CODEC - 1
+        && !memcmp (codec, COMPRESS_CODEC, len);
+
+    if (on && !(slave->flags & CLIENT_DEFLATE)) {
+        slave->flags |= CLIENT_DEFLATE;
+        compress_attach ();
+    } else if (!on && slave->flags & CLIENT_DEFLATE) {
+        slave->flags &= ~(unsigned) CLIENT_DEFLATE;
+        compress_detach ();
+    }
+    return send_frame (loop, slave, FRAME_COMPRESS, 0, COMPRESS_CODEC,
+                       on ? len : 0, table);
+}
+
+int run_command (struct event_loop *loop, struct client_info *slave,
+                 const struct msgbuf *cmd, struct client_table *table)
+{
+    struct frame f;
+
+    frame_decode ((const unsigned char *) cmd->data, &f);
+
+    const char *const arg = cmd->data + FRAME_HDR_LEN;
+
+    switch (f.type) {
+        case FRAME_JOIN:
+            return join (loop, slave, arg, f.length, table);
+        case FRAME_LEAVE:
+            return leave (loop, slave, arg, f.length,
+                          speaks_lines (slave) ? slave->room : f.room, table);
+        case FRAME_LIST:
+            return list (loop, slave, table);
+        case FRAME_COMPRESS:
+            return compression (loop, slave, arg, f.length, table);
+        default:
+            return send_error (loop, slave, 0, "Unknown command.", table);
+    }
+}
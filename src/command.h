@@ -0,0 +1,25 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include "client_info.h"
+#include "msgbuf.h"
+
+struct event_loop;
+
+/**
+*	\brief	Carries out a FRAME_JOIN, FRAME_LEAVE or FRAME_LIST from slave,
+*			and answers it. Line clients are answered with text.
+*	\return	0 on success, or -1 if the system is out of memory.
+*/
+int run_command (struct event_loop *loop, struct client_info *slave,
+                 const struct msgbuf *cmd, struct client_table *table);
+
+/**
+*	\brief	Tells slave that something it asked for could not be done: with
+*			a FRAME_ERROR, or a line starting with "* ".
+*	\return	0 on success, or -1 if the system is out of memory.
+*/
+int send_error (struct event_loop *loop, struct client_info *slave,
+                int room, const char *why, struct client_table *table);
+
+#endif /* COMMAND_H */
@@ -0,0 +1,90 @@
+#include "compress.h"
+#include "config.h"
+#include "frame.h"
+#include "metrics.h"
+
+#include <stdatomic.h>
+
+#include <zlib.h>
+
+/*
+*	Clients on any reactor that asked for compression.
+*/
+static atomic_int wanted;
+
+/*
+*	Each reactor keeps a compressor, reset for each message, rather than
+*	allocating a quarter of a megabyte of state every time.
+*/
+static _Thread_local z_stream zs;
+static _Thread_local int zs_ready;
+
+void compress_attach (void)
+{
+    atomic_fetch_add_explicit (&wanted, 1, memory_order_relaxed);
+}
+
+void compress_detach (void)
+{
+    atomic_fetch_sub_explicit (&wanted, 1, memory_order_relaxed);
+}
+
+void compress_message (struct msgbuf *msg)
+{
+    const size_t len = msg->len - FRAME_HDR_LEN;
+
+    if (len < cfg.compress_min
+        || !atomic_load_explicit (&wanted, memory_order_relaxed)) {
+        return;
+    }
+    if (!zs_ready) {
+        if (deflateInit (&zs, COMPRESS_LEVEL) != Z_OK) {
+            return;
+        }
+        zs_ready = 1;
+    }
+
+    const long long start = metrics_now ();
+    struct msgbuf *const packed =
+        msgbuf_alloc (FRAME_HDR_LEN + deflateBound (&zs, (uLong) len));
+
+    if (!packed) {
+        return;
+    }
+    zs.next_in = (Bytef *) msg->data + FRAME_HDR_LEN;
+    zs.avail_in = (uInt) len;
+    zs.next_out = (Bytef *) packed->data + FRAME_HDR_LEN;
+    zs.avail_out = (uInt) (packed->cap - FRAME_HDR_LEN);
+
+    const int ret_val = deflate (&zs, Z_FINISH);
+    const size_t packed_len = (size_t) zs.total_out;
+
+    deflateReset (&zs);
+    metric_add (M_COMPRESS_NS, (unsigned long long) (metrics_now () - start));
+
+    /*
+     * Incompressible, as what is already compressed or encrypted is.
+     */
+    if (ret_val != Z_STREAM_END || packed_len >= len) {
+        msgbuf_put (packed);
+        return;
+    }
+
+    struct frame f;
+
+    frame_decode ((const unsigned char *) msg->data, &f);
+    f.length = (uint32_t) packed_len;
+    f.flags = FRAME_F_DEFLATE;
+    frame_encode ((unsigned char *) packed->data, &f);
+    packed->len = FRAME_HDR_LEN + packed_len;
+    msg->packed = packed;
+    metric_add (M_COMPRESSED, 1);
+}
+
+void compress_drain (void)
+{
+    if (zs_ready) {
+        deflateEnd (&zs);
+        zs_ready = 0;
+    }
+}
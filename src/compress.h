@@ -0,0 +1,43 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "msgbuf.h"
+
+/*
+*	Compress once, send many. A binary client asks for what is relayed to
+*	it to come compressed by sending a FRAME_COMPRESS naming
+*	COMPRESS_CODEC. From then on, a message of at least cfg.compress_min
+*	bytes of payload is compressed once, by the reactor its sender is on,
+*	and the compressed copy is kept with it, in its packed, for every
+*	reactor to send to every such client by reference, as the original is
+*	sent to the rest. Nothing is compressed while no client has asked, and
+*	a message that would not shrink is sent as it is.
+*
+*	A compressed message is a FRAME_DATA frame with FRAME_F_DEFLATE set,
+*	whose payload is the original's in the zlib format (RFC 1950), on its
+*	own: each can be inflated without the others.
+*/
+#define COMPRESS_CODEC	"deflate"
+#define COMPRESS_LEVEL	6
+
+/**
+*	\brief	Counts a client that asked for compression, or one that no
+*			longer wants it.
+*/
+void compress_attach (void);
+void compress_detach (void);
+
+/**
+*	\brief	Sets msg->packed to a compressed copy of msg, a framed message
+*			that is still only the caller's, if anyone wants one and it is
+*			worth making. If it cannot be made, msg is sent as it is.
+*/
+void compress_message (struct msgbuf *msg);
+
+/**
+*	\brief	Frees the calling thread's compressor. Called by each reactor
+*			on its way out.
+*/
+void compress_drain (void);
+
+#endif /* COMPRESS_H */
@@ -0,0 +1,481 @@
+#ifdef _POSIX_C_SOURCE
+#undef _POSIX_C_SOURCE
+#endif
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+#include "event.h"
+#include "frame.h"
+#include "internal.h"
+#include "journal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+
+struct config cfg = {
+    .threads = 1,
+    .queue_limit = 1024 * 1024,
+    .slow_policy = SLOW_DROP,
+    .event_log_size = 16 * 1024 * 1024,
+    .connect_rate = { 20, 40 },
+    .message_rate = { 500, 1000 },
+    .byte_rate = { 1024 * 1024, 4 * 1024 * 1024 },
+    .evict_same_address = 1,
+    .overload_ms = 250,
+    .history_messages = 50,
+    .history_size = 64 * 1024,
+    .journal_segment_size = 64 * 1024 * 1024,
+    .journal_interval = 2,
+    .journal_group = 1024 * 1024,
+    .tls_sessions = 20480,
+    .compress_min = 512,
+};
+
+static const char *const slow_policies[] = {
+    [SLOW_DROP] = "drop",
+    [SLOW_DISCONNECT] = "disconnect",
+    [SLOW_PAUSE] = "pause",
+};
+
+static const char *const same_address_policies[] = { "allow", "evict" };
+
+static void usage (FILE *stream)
+{
+    fprintf (stream, "Usage: %s [OPTION]...\n"
+             "  -b, --backend=NAME  Event loop backend:", PROGRAM_NAME);
+
+    for (const char *const *p = event_backends (); *p; p++) {
+        fprintf (stream, " %s", *p);
+    }
+    fputs (" (default: the first).\n"
+           "  -t, --threads=N     Run N event loops, each on its own thread\n"
+           "                      and listening socket (default: 1).\n"
+           "  -q, --queue-limit=BYTES\n"
+           "                      Outbound bytes queued per client; k, M and G\n"
+           "                      suffixes are understood (default: 1M).\n"
+           "  -s, --slow-consumer=POLICY\n"
+           "                      What to do when a client's queue is full:\n"
+           "                      drop (its oldest messages), disconnect (it),\n"
+           "                      or pause (reading from the sender until it\n"
+           "                      catches up; messages from other threads are\n"
+           "                      dropped instead) (default: drop).\n"
+           "  -d, --batch-delay=MS\n"
+           "                      Let output wait up to MS milliseconds to be\n"
+           "                      sent together with what follows it (default:\n"
+           "                      0, until the ready descriptors are handled).\n"
+           "  -e, --event-log=DIR Log events in binary, to segment files in DIR,\n"
+           "                      rather than as text to " LOG_FILE "; read them\n"
+           "                      with ssdecode.\n"
+           "  -E, --event-log-size=BYTES\n"
+           "                      Size of each event log segment (default: 16M).\n"
+           "  -a, --admin-socket=PATH\n"
+           "                      Serve metrics, in the Prometheus text format,\n"
+           "                      on a Unix-domain socket at PATH.\n"
+           "  -c, --connect-rate=N[/BURST]\n"
+           "                      Connections accepted per second from one\n"
+           "                      address, by each event loop; BURST defaults\n"
+           "                      to twice N, and 0 means no limit (default: 20).\n"
+           "  -m, --message-rate=N[/BURST]\n"
+           "                      Messages relayed per second from one address,\n"
+           "                      by each event loop (default: 500).\n"
+           "  -B, --byte-rate=BYTES[/BURST]\n"
+           "                      Bytes of them (default: 1M/4M).\n"
+           "  -A, --same-address=POLICY\n"
+           "                      What to do with a client's older connections\n"
+           "                      from the same address: evict, or allow them,\n"
+           "                      as for clients behind NAT (default: evict).\n"
+           "  -o, --overload-ms=MS\n"
+           "                      Turn new connections away while an event loop\n"
+           "                      takes longer than MS milliseconds on average to\n"
+           "                      handle a batch of events, or never if 0\n"
+           "                      (default: 250).\n", stream);
+    fputs ("  -H, --history=N     Messages kept per room and sent to clients\n"
+           "                      that join it, or 0 for none (default: 50).\n"
+           "  -Z, --history-size=BYTES\n"
+           "                      Most bytes of them kept per room (default: 64k).\n"
+           "  -D, --history-dir=DIR\n"
+           "                      Keep them in files in DIR, to outlive the\n"
+           "                      server, rather than in memory.\n"
+           "  -j, --journal=DIR   Keep every message relayed in segment files\n"
+           "                      in DIR, committed to disk by a thread of its\n"
+           "                      own.\n"
+           "  -J, --journal-segment=BYTES\n"
+           "                      Size of each journal segment (default: 64M).\n"
+           "  -i, --journal-interval=MS\n"
+           "                      Let a message wait up to MS milliseconds to be\n"
+           "                      committed together with those after it\n"
+           "                      (default: 2).\n"
+           "  -g, --journal-group=BYTES\n"
+           "                      Most bytes committed at once (default: 1M).\n"
+           "  -I, --idle-timeout=S\n"
+           "                      Disconnect a client that sends nothing for S\n"
+           "                      seconds (default: 0, never).\n"
+           "  -K, --handshake-timeout=S\n"
+           "                      Disconnect a client that has not started\n"
+           "                      talking, in either protocol, within S seconds\n"
+           "                      of connecting (default: 0, never).\n"
+           "  -P, --ping-interval=S\n"
+           "                      Ping a binary client that has been quiet for S\n"
+           "                      seconds, and disconnect it if it stays quiet S\n"
+           "                      more (default: 0, never).\n"
+           "  -C, --tls-cert=FILE Speak TLS, with the PEM certificate chain in\n"
+           "                      FILE. Needs kernel TLS (the tls module).\n"
+           "  -k, --tls-key=FILE  The PEM private key (default: in the\n"
+           "                      certificate's file).\n"
+           "  -S, --tls-sessions=N\n"
+           "                      TLS sessions cached for resumption, with\n"
+           "                      tickets issued too unless N is 0\n"
+           "                      (default: 20480).\n"
+           "  -x, --compress-min=BYTES\n"
+           "                      Smallest message compressed for the binary\n"
+           "                      clients that ask for it (default: 512).\n"
+           "  -h, --help          Show this help and exit.\n", stream);
+}
+
+/**
+*	\brief	Parses a decimal integer in [min, max].
+*	\return	0 on success, or -1 on failure.
+*/
+static int parse_int (const char *s, long min, long max, int *out)
+{
+    char *end;
+
+    errno = 0;
+    const long val = strtol (s, &end, 10);
+
+    if (errno || end == s || *end || val < min || val > max) {
+        return -1;
+    }
+    *out = (int) val;
+    return 0;
+}
+
+/**
+*	\brief	Parses a byte count, with an optional k, M or G suffix.
+*	\return	0 on success, or -1 on failure.
+*/
+static int parse_size (const char *s, size_t *out)
+{
+    char *end;
+
+    errno = 0;
+    const unsigned long long val = strtoull (s, &end, 10);
+    unsigned shift = 0;
+
+    switch (*end) {
+        case 'k':
+        case 'K':
+            shift = 10;
+            end++;
+            break;
+        case 'm':
+        case 'M':
+            shift = 20;
+            end++;
+            break;
+        case 'g':
+        case 'G':
+            shift = 30;
+            end++;
+            break;
+    }
+    if (errno || end == s || *end || *s == '-' || !val
+        || val > (SIZE_MAX >> shift)) {
+        return -1;
+    }
+    *out = (size_t) (val << shift);
+    return 0;
+}
+
+/**
+*	\brief	Parses a non-negative amount: a byte count if bytes is set, or
+*			else any number.
+*	\return	0 on success, or -1 on failure.
+*/
+static int parse_amount (const char *s, int bytes, double *out)
+{
+    if (!strcmp (s, "0")) {
+        *out = 0;
+        return 0;
+    }
+    if (bytes) {
+        size_t val;
+
+        if (parse_size (s, &val) == -1) {
+            return -1;
+        }
+        *out = (double) val;
+        return 0;
+    }
+
+    char *end;
+
+    errno = 0;
+    const double val = strtod (s, &end);
+
+    if (errno || end == s || *end || !(val >= 0)) {
+        return -1;
+    }
+    *out = val;
+    return 0;
+}
+
+/**
+*	\brief	Parses a rate limit, RATE[/BURST]. BURST defaults to twice RATE.
+*	\return	0 on success, or -1 on failure.
+*/
+static int parse_rate (const char *s, int bytes, struct rate_limit *out)
+{
+    const char *const slash = strchr (s, '/');
+    char rate[64];
+    const size_t len = slash ? (size_t) (slash - s) : strlen (s);
+
+    if (len >= sizeof rate) {
+        return -1;
+    }
+    memcpy (rate, s, len);
+    rate[len] = '\0';
+
+    if (parse_amount (rate, bytes, &out->rate) == -1
+        || (slash && parse_amount (slash + 1, bytes, &out->burst) == -1)) {
+        return -1;
+    }
+    if (!slash) {
+        out->burst = 2 * out->rate;
+    }
+    return out->rate > 0 && out->burst < 1 ? -1 : 0;
+}
+
+/**
+*	\brief	Looks s up in names.
+*	\return	Its index, or -1 if it is not there.
+*/
+static int parse_name (const char *s, const char *const names[], size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (!strcmp (s, names[i])) {
+            return (int) i;
+        }
+    }
+    return -1;
+}
+
+int parse_config (int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "backend", required_argument, 0, 'b' },
+        { "threads", required_argument, 0, 't' },
+        { "queue-limit", required_argument, 0, 'q' },
+        { "slow-consumer", required_argument, 0, 's' },
+        { "batch-delay", required_argument, 0, 'd' },
+        { "event-log", required_argument, 0, 'e' },
+        { "event-log-size", required_argument, 0, 'E' },
+        { "admin-socket", required_argument, 0, 'a' },
+        { "connect-rate", required_argument, 0, 'c' },
+        { "message-rate", required_argument, 0, 'm' },
+        { "byte-rate", required_argument, 0, 'B' },
+        { "same-address", required_argument, 0, 'A' },
+        { "overload-ms", required_argument, 0, 'o' },
+        { "history", required_argument, 0, 'H' },
+        { "history-size", required_argument, 0, 'Z' },
+        { "history-dir", required_argument, 0, 'D' },
+        { "journal", required_argument, 0, 'j' },
+        { "journal-segment", required_argument, 0, 'J' },
+        { "journal-interval", required_argument, 0, 'i' },
+        { "journal-group", required_argument, 0, 'g' },
+        { "idle-timeout", required_argument, 0, 'I' },
+        { "handshake-timeout", required_argument, 0, 'K' },
+        { "ping-interval", required_argument, 0, 'P' },
+        { "tls-cert", required_argument, 0, 'C' },
+        { "tls-key", required_argument, 0, 'k' },
+        { "tls-sessions", required_argument, 0, 'S' },
+        { "compress-min", required_argument, 0, 'x' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 },
+    };
+    int opt;
+
+    while ((opt = getopt_long (argc, argv, "b:t:q:s:d:e:E:a:c:m:B:A:o:H:Z:D:j:J:i:g:I:K:P:C:k:S:x:h",
+                               long_options, 0)) != -1) {
+        switch (opt) {
+            case 'b':
+                cfg.backend = optarg;
+                break;
+            case 't':
+                if (parse_int (optarg, 1, MAX_THREADS, &cfg.threads) == -1) {
+                    fprintf (stderr, "%s: invalid thread count: %s\n",
+                             PROGRAM_NAME, optarg);
+                    return -1;
+                }
+                break;
+            case 'q':
+                if (parse_size (optarg, &cfg.queue_limit) == -1) {
+                    fprintf (stderr, "%s: invalid queue limit: %s\n",
+                             PROGRAM_NAME, optarg);
+                    return -1;
+                }
+                break;
+            case 's':{
+                    const int policy = parse_name (optarg, slow_policies,
+                                                   ARRAY_CARDINALITY
+                                                   (slow_policies));
+
+                    if (policy == -1) {
+                        fprintf (stderr, "%s: invalid policy: %s\n",
+                                 PROGRAM_NAME, optarg);
+                        return -1;
+                    }
+                    cfg.slow_policy = (enum slow_policy) policy;
+                    break;
+                }
+            case 'd':
+                if (parse_int (optarg, 0, MAX_BATCH_DELAY,
+                               &cfg.batch_delay) == -1) {
+                    fprintf (stderr, "%s: invalid batch delay: %s\n",
+                             PROGRAM_NAME, optarg);
+                    return -1;
+                }
+                break;
+            case 'e':
+                cfg.event_log = optarg;
+                break;
+            case 'E':
+                if (parse_size (optarg, &cfg.event_log_size) == -1) {
+                    fprintf (stderr, "%s: invalid segment size: %s\n",
+                             PROGRAM_NAME, optarg);
+                    return -1;
+                }
+                break;
+            case 'a':
+                cfg.admin_socket = optarg;
+                break;
+            case 'c':
+            case 'm':
+            case 'B':{
+                    struct rate_limit *const limit = opt == 'c'
+                        ? &cfg.connect_rate : opt == 'm' ? &cfg.message_rate
+                        : &cfg.byte_rate;
+
+                    if (parse_rate (optarg, opt == 'B', limit) == -1) {
+                        fprintf (stderr, "%s: invalid rate: %s\n",
+                                 PROGRAM_NAME, optarg);
+                        return -1;
+                    }
+                    break;
+                }
+            case 'A':{
+                    const int policy = parse_name (optarg,
+                                                   same_address_policies,
+                                                   ARRAY_CARDINALITY
+                                                   (same_address_policies));
+
+                    if (policy == -1) {
+                        fprintf (stderr, "%s: invalid policy: %s\n",
+                                 PROGRAM_NAME, optarg);
+                        return -1;
+                    }
+                    cfg.evict_same_address = policy;
+                    break;
+                }
+            case 'o':
+                if (parse_int (optarg, 0, 60000, &cfg.overload_ms) == -1) {
+                    fprintf (stderr, "%s: invalid overload threshold: %s\n",
+                             PROGRAM_NAME, optarg);
+                    return -1;
+                }
+                break;
+            case 'H':
+                if (parse_int (optarg, 0, MAX_HISTORY,
+                               &cfg.history_messages) == -1) {
+                    fprintf (stderr, "%s: invalid history length: %s\n",
+                             PROGRAM_NAME, optarg);
+                    return -1;
+                }
+                break;
+            case 'Z':
+                if (parse_size (optarg, &cfg.history_size) == -1
+                    || cfg.history_size < FRAME_HDR_LEN) {
+                    fprintf (stderr, "%s: invalid history size: %s\n",
+                             PROGRAM_NAME, optarg);
+                    return -1;
+                }
+                break;
+            case 'D':
+                cfg.history_dir = optarg;
+                break;
+            case 'j':
+                cfg.journal_dir = optarg;
+                break;
+            case 'J':
+                if (parse_size (optarg, &cfg.journal_segment_size) == -1
+                    || cfg.journal_segment_size < JOURNAL_MIN_SEGMENT) {
+                    fprintf (stderr, "%s: invalid segment size: %s\n",
+                             PROGRAM_NAME, optarg);
+                    return -1;
+                }
+                break;
+            case 'i':
+                if (parse_int (optarg, 0, MAX_BATCH_DELAY,
+                               &cfg.journal_interval) == -1) {
+                    fprintf (stderr, "%s: invalid commit interval: %s\n",
+                             PROGRAM_NAME, optarg);
+                    return -1;
+                }
+                break;
+            case 'g':
+                if (parse_size (optarg, &cfg.journal_group) == -1) {
+                    fprintf (stderr, "%s: invalid group size: %s\n",
+                             PROGRAM_NAME, optarg);
+                    return -1;
+                }
+                break;
+            case 'I':
+            case 'K':
+            case 'P':{
+                    int *const timeout = opt == 'I' ? &cfg.idle_timeout
+                        : opt == 'K' ? &cfg.handshake_timeout
+                        : &cfg.ping_interval;
+
+                    if (parse_int (optarg, 0, MAX_TIMEOUT, timeout) == -1) {
+                        fprintf (stderr, "%s: invalid timeout: %s\n",
+                                 PROGRAM_NAME, optarg);
+                        return -1;
+                    }
+                    break;
+                }
+            case 'C':
+                cfg.tls_cert = optarg;
+                break;
+            case 'k':
+                cfg.tls_key = optarg;
+                break;
+            case 'S':
+                if (parse_int (optarg, 0, MAX_TLS_SESSIONS,
+                               &cfg.tls_sessions) == -1) {
+                    fprintf (stderr, "%s: invalid session count: %s\n",
+                             PROGRAM_NAME, optarg);
+                    return -1;
+                }
+                break;
+            case 'x':
+                if (parse_size (optarg, &cfg.compress_min) == -1) {
+                    fprintf (stderr, "%s: invalid size: %s\n",
+                             PROGRAM_NAME, optarg);
+                    return -1;
+                }
+                break;
+            case 'h':
+                usage (stdout);
+                return 1;
+            default:
+                usage (stderr);
+                return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/*
+*	Run-time settings, filled in from the command line.
+*/
+#include <stddef.h>
+
+#define MAX_THREADS 256
+#define MAX_BATCH_DELAY 1000
+#define MAX_HISTORY 65535
+#define MAX_TIMEOUT 86400
+#define MAX_TLS_SESSIONS 1048576
+
+/*
+*	What to do when a client's outbound queue would grow past its limit.
+*/
+enum slow_policy {
+    SLOW_DROP,                  /* Drop its oldest queued messages. */
+    SLOW_DISCONNECT,            /* Close the connection. */
+    SLOW_PAUSE                  /* Stop reading from the sender until it drains. */
+};
+
+/*
+*	A token bucket's settings.
+*/
+struct rate_limit {
+    double rate;                /* Per second, or 0 for no limit. */
+    double burst;               /* Most that may be spent at once. */
+};
+
+struct config {
+    const char *backend;        /* Event loop backend, or NULL for the default. */
+    int threads;                /* Number of reactors. */
+    size_t queue_limit;         /* Outbound bytes queued per client. */
+    enum slow_policy slow_policy;
+    int batch_delay;            /* Milliseconds output may wait to be batched. */
+    const char *event_log;      /* Directory for the binary event log, or NULL. */
+    size_t event_log_size;      /* Bytes per event log segment. */
+    const char *admin_socket;   /* Where to serve metrics, or NULL. */
+    struct rate_limit connect_rate;     /* Per peer address and event loop. */
+    struct rate_limit message_rate;
+    struct rate_limit byte_rate;
+    int evict_same_address;     /* Close older connections from an address. */
+    int overload_ms;            /* Loop lag that sheds connections, or 0. */
+    int history_messages;       /* Kept per room for late joiners, or 0. */
+    size_t history_size;        /* Bytes of them kept per room. */
+    const char *history_dir;    /* Where they are kept, or NULL for memory. */
+    const char *journal_dir;    /* Where messages are journalled, or NULL. */
+    size_t journal_segment_size;        /* Bytes per journal segment. */
+    int journal_interval;       /* Milliseconds a commit may wait for more. */
+    size_t journal_group;       /* Most bytes committed at once. */
+    int idle_timeout;           /* Seconds a client may be silent, or 0. */
+    int handshake_timeout;      /* Seconds before it must first speak, or 0. */
+    int ping_interval;          /* Seconds before a binary one is pinged, or 0. */
+    const char *tls_cert;       /* PEM certificate chain, or NULL for plaintext. */
+    const char *tls_key;        /* PEM private key, or NULL if in tls_cert. */
+    int tls_sessions;           /* TLS sessions cached for resumption, or 0. */
+    size_t compress_min;        /* Smallest payload worth compressing. */
+};
+
+extern struct config cfg;
+
+/**
+*	\brief	Parses the command line into cfg.
+*	\return	0 on success, 1 if the usage message was requested, or -1 on an
+*			invalid option.
+*/
+int parse_config (int argc, char *argv[]);
+
+#endif /* CONFIG_H */
@@ -0,0 +1,34 @@
+#ifndef EV_BACKEND_H
+#define EV_BACKEND_H
+
+#include "event.h"
+
+/*
+*	The operations an event loop backend has to provide. Every function
+*	receives the opaque state returned by init().
+*/
+struct ev_backend {
+    const char *name;
+    int max_fds;                /* Highest descriptor + 1 it can watch, or 0. */
+    void *(*init) (int size);
+    void (*destroy) (void *state);
+    int (*add) (void *state, int fd, unsigned events);
+    int (*mod) (void *state, int fd, unsigned events);
+    int (*del) (void *state, int fd);
+    int (*wait) (void *state, struct event *events, int max_events,
+                 int timeout);
+    /* Optional. */
+    int (*sendv) (void *state, int fd, const struct iovec *iov, int iovcnt,
+                  void *cookie);
+    int (*flush) (void *state, event_sent_fn *sent, void *arg);
+    int (*quiesce) (void *state);
+};
+
+extern const struct ev_backend ev_select_backend;
+
+#ifdef __linux__
+extern const struct ev_backend ev_epoll_backend;
+extern const struct ev_backend ev_uring_backend;
+#endif
+
+#endif /* EV_BACKEND_H */
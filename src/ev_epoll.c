@@ -0,0 +1,128 @@
+#include "ev_backend.h"
+
+#ifdef __linux__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+/*
+*	Edge-triggered epoll. Only ready descriptors are visited, and the number
+*	of descriptors is limited by RLIMIT_NOFILE rather than FD_SETSIZE.
+*/
+struct epoll_state {
+    int epfd;
+    int n_ready;                /* Capacity of ready. */
+    struct epoll_event *ready;
+};
+
+static uint32_t to_epoll (unsigned events)
+{
+    uint32_t ev = EPOLLET;
+
+    if (events & (EV_READ | EV_ACCEPT | EV_RECV)) {
+        ev |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (events & EV_WRITE) {
+        ev |= EPOLLOUT;
+    }
+    return ev;
+}
+
+static unsigned from_epoll (uint32_t ev)
+{
+    return (ev & (EPOLLIN | EPOLLRDHUP) ? EV_READ : 0u)
+        | (ev & EPOLLOUT ? EV_WRITE : 0u)
+        | (ev & (EPOLLHUP | EPOLLERR) ? EV_HUP : 0u);
+}
+
+static void *epoll_init (int size)
+{
+    struct epoll_state *const st = malloc (sizeof *st);
+
+    if (!st) {
+        return 0;
+    }
+    /*
+     * Events beyond this stay queued in the kernel for the next call.
+     */
+    st->n_ready = size < 1024 ? (size > 0 ? size : 1) : 1024;
+
+    if (!(st->ready = malloc ((size_t) st->n_ready * sizeof *st->ready))) {
+        goto free_state;
+    }
+    if ((st->epfd = epoll_create1 (EPOLL_CLOEXEC)) == -1) {
+        goto free_ready;
+    }
+    return st;
+
+  free_ready:
+    free (st->ready);
+  free_state:
+    free (st);
+    return 0;
+}
+
+static void epoll_destroy (void *state)
+{
+    struct epoll_state *const st = state;
+
+    close (st->epfd);
+    free (st->ready);
+    free (st);
+}
+
+static int epoll_ctl_fd (struct epoll_state *st, int op, int fd,
+                         unsigned events)
+{
+    struct epoll_event ev = {.events = to_epoll (events),.data.fd = fd };
+
+    return epoll_ctl (st->epfd, op, fd, &ev);
+}
+
+static int epoll_add (void *state, int fd, unsigned events)
+{
+    return epoll_ctl_fd (state, EPOLL_CTL_ADD, fd, events);
+}
+
+static int epoll_mod (void *state, int fd, unsigned events)
+{
+    return epoll_ctl_fd (state, EPOLL_CTL_MOD, fd, events);
+}
+
+static int epoll_del (void *state, int fd)
+{
+    return epoll_ctl_fd (state, EPOLL_CTL_DEL, fd, 0);
+}
+
+static int epoll_wait_events (void *state, struct event *events,
+                              int max_events, int timeout)
+{
+    struct epoll_state *const st = state;
+
+    if (max_events > st->n_ready) {
+        max_events = st->n_ready;
+    }
+
+    const int n = epoll_wait (st->epfd, st->ready, max_events, timeout);
+
+    for (int i = 0; i < n; i++) {
+        events[i].fd = st->ready[i].data.fd;
+        events[i].events = from_epoll (st->ready[i].events);
+    }
+    return n;
+}
+
+const struct ev_backend ev_epoll_backend = {
+    .name = "epoll",
+    .max_fds = 0,
+    .init = epoll_init,
+    .destroy = epoll_destroy,
+    .add = epoll_add,
+    .mod = epoll_mod,
+    .del = epoll_del,
+    .wait = epoll_wait_events,
+};
+
+#endif /* __linux__ */
@@ -0,0 +1,114 @@
+#include "ev_backend.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/select.h>
+
+/*
+*	The portable fallback. Level-triggered, capped at FD_SETSIZE, and every
+*	wakeup scans descriptors 0 through fd_max.
+*/
+struct select_state {
+    fd_set read_set;
+    fd_set write_set;
+    int fd_max;
+};
+
+static void *select_init (int size)
+{
+    (void) size;
+    struct select_state *const st = malloc (sizeof *st);
+
+    if (st) {
+        FD_ZERO (&st->read_set);
+        FD_ZERO (&st->write_set);
+        st->fd_max = -1;
+    }
+    return st;
+}
+
+static void select_destroy (void *state)
+{
+    free (state);
+}
+
+static int select_mod (void *state, int fd, unsigned events)
+{
+    struct select_state *const st = state;
+
+    if (fd < 0 || fd >= FD_SETSIZE) {
+        errno = EBADF;
+        return -1;
+    }
+    FD_CLR (fd, &st->read_set);
+    FD_CLR (fd, &st->write_set);
+
+    if (events & (EV_READ | EV_ACCEPT | EV_RECV)) {
+        FD_SET (fd, &st->read_set);
+    }
+    if (events & EV_WRITE) {
+        FD_SET (fd, &st->write_set);
+    }
+    st->fd_max = max (fd, st->fd_max);
+    return 0;
+}
+
+static int select_del (void *state, int fd)
+{
+    struct select_state *const st = state;
+
+    if (select_mod (state, fd, 0) == -1) {
+        return -1;
+    }
+    while (st->fd_max >= 0 && !FD_ISSET (st->fd_max, &st->read_set)
+           && !FD_ISSET (st->fd_max, &st->write_set)) {
+        st->fd_max--;
+    }
+    return 0;
+}
+
+static int select_wait (void *state, struct event *events, int max_events,
+                        int timeout)
+{
+    struct select_state *const st = state;
+    fd_set read_fds = st->read_set;
+    fd_set write_fds = st->write_set;
+    struct timeval tv = {.tv_sec = timeout / 1000,
+        .tv_usec = (timeout % 1000) * 1000
+    };
+    int n_ready = select (st->fd_max + 1, &read_fds, &write_fds, 0,
+                          timeout < 0 ? 0 : &tv);
+
+    if (n_ready <= 0) {
+        return n_ready;
+    }
+
+    int n = 0;
+
+    /*
+     * Anything left over when events fills up is still ready next time,
+     * since select() is level-triggered.
+     */
+    for (int i = 0; i <= st->fd_max && n < max_events; i++) {
+        const unsigned ev = (FD_ISSET (i, &read_fds) ? EV_READ : 0u)
+            | (FD_ISSET (i, &write_fds) ? EV_WRITE : 0u);
+
+        if (ev) {
+            events[n].fd = i;
+            events[n++].events = ev;
+        }
+    }
+    return n;
+}
+
+const struct ev_backend ev_select_backend = {
+    .name = "select",
+    .max_fds = FD_SETSIZE,
+    .init = select_init,
+    .destroy = select_destroy,
+    .add = select_mod,
+    .mod = select_mod,
+    .del = select_del,
+    .wait = select_wait,
+};
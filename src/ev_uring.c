@@ -0,0 +1,925 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "ev_backend.h"
+#include "internal.h"
+
+#ifdef __linux__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+*	io_uring, driven through the raw system calls so that liburing is not a
+*	build dependency.
+*
+*	Listeners use multishot accept, and sockets use multishot recv into a
+*	ring of buffers we provide to the kernel, so neither needs a system call
+*	per connection or per message once armed. Everything else is watched
+*	with multishot poll, and write interest with a one-shot poll that is
+*	re-armed for as long as the interest lasts. Sends are queued by
+*	event_sendv() and go out in one io_uring_enter() per event_flush().
+*/
+
+#define SQ_ENTRIES		1024u
+#define CQ_ENTRIES		(SQ_ENTRIES * 8)
+#define N_BUFS			512u        /* Must be a power of 2. */
+#define BUF_LEN			BUFSIZE
+#define BUF_GROUP		0
+#define MAX_READY		1024
+
+/*
+*	user_data layout: the operation in the top 8 bits, the descriptor's
+*	generation in the next 24, and the descriptor (or send slot) in the
+*	low 32. A generation that no longer matches marks a completion for
+*	a descriptor that has since been removed, and perhaps reused.
+*/
+enum uring_op {
+    OP_ACCEPT = 1,
+    OP_RECV,
+    OP_POLL,
+    OP_POLL_WRITE,
+    OP_SEND,
+    OP_CANCEL
+};
+
+#define UD(op, gen, n)	((uint64_t) (op) << 56 | (uint64_t) ((gen) & 0xFFFFFF) << 32 \
+                         | (uint32_t) (n))
+#define UD_OP(ud)		((enum uring_op) ((ud) >> 56))
+#define UD_GEN(ud)		((unsigned) ((ud) >> 32) & 0xFFFFFF)
+#define UD_N(ud)		((int) (uint32_t) (ud))
+
+struct pending_send {
+    int fd;
+    int iov_off;                /* Into iovs, which may move until the flush. */
+    int iovcnt;
+    void *cookie;
+    struct msghdr msg;
+};
+
+struct uring_state {
+    int ring_fd;
+    unsigned features;
+
+    /* Submission queue. */
+    void *sq_ptr;
+    size_t sq_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned to_submit;
+
+    /* Completion queue. */
+    void *cq_ptr;
+    size_t cq_len;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* Provided receive buffers. */
+    struct io_uring_buf_ring *br;
+    size_t br_len;
+    char *bufs;
+    unsigned short br_tail;
+    unsigned short recycle[N_BUFS];
+    int n_recycle;
+
+    /* Per-descriptor state, indexed by fd. */
+    int size;
+    unsigned *gen;
+    unsigned *interest;
+    unsigned char *write_armed;
+
+    /* Write polls that fired, to be re-armed at the next wait. */
+    int rearm[MAX_READY];
+    int n_rearm;
+
+    /* Completions set aside by event_flush() for the next wait. */
+    struct io_uring_cqe *backlog;
+    int n_backlog;
+    int backlog_cap;
+
+    /* Sends queued by event_sendv(). */
+    struct pending_send *sends;
+    int n_sends;
+    int sends_cap;
+    struct iovec *iovs;
+    int n_iovs;
+    int iovs_cap;
+};
+
+static int sys_io_uring_setup (unsigned entries, struct io_uring_params *p)
+{
+    return (int) syscall (__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter (int fd, unsigned to_submit,
+                               unsigned min_complete, unsigned flags,
+                               const void *arg, size_t argsz)
+{
+    return (int) syscall (__NR_io_uring_enter, fd, to_submit, min_complete,
+                          flags, arg, argsz);
+}
+
+static int sys_io_uring_register (int fd, unsigned opcode, void *arg,
+                                  unsigned nr_args)
+{
+    return (int) syscall (__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+*	\brief	Hands the queued submissions to the kernel, optionally waiting
+*			for min_complete completions or until timeout milliseconds pass.
+*	\return	0 on success, or -1 on failure.
+*/
+static int uring_enter (struct uring_state *st, unsigned min_complete,
+                        int timeout)
+{
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts = {.tv_sec = timeout / 1000,
+        .tv_nsec = (timeout % 1000) * 1000000LL
+    };
+    struct io_uring_getevents_arg arg = {.ts = (uint64_t) (uintptr_t) & ts };
+    const void *argp = 0;
+    size_t argsz = 0;
+
+    if (min_complete && timeout >= 0) {
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof arg;
+    }
+
+    const int ret = sys_io_uring_enter (st->ring_fd, st->to_submit,
+                                        min_complete, flags, argp, argsz);
+
+    if (ret == -1) {
+        /*
+         * ETIME is how an expired timeout is reported.
+         */
+        return errno == ETIME ? 0 : -1;
+    }
+    st->to_submit -= (unsigned) ret < st->to_submit ? (unsigned) ret
+        : st->to_submit;
+    return 0;
+}
+
+static struct io_uring_sqe *get_sqe (struct uring_state *st)
+{
+    unsigned tail = *st->sq_tail;
+
+    if (tail - __atomic_load_n (st->sq_head, __ATOMIC_ACQUIRE) > st->sq_mask) {
+        /*
+         * The queue is full; make room.
+         */
+        if (uring_enter (st, 0, 0) == -1) {
+            return 0;
+        }
+        if (tail - __atomic_load_n (st->sq_head, __ATOMIC_ACQUIRE) > st->sq_mask) {
+            errno = EBUSY;
+            return 0;
+        }
+    }
+
+    const unsigned idx = tail & st->sq_mask;
+    struct io_uring_sqe *const sqe = &st->sqes[idx];
+
+    memset (sqe, 0, sizeof *sqe);
+    st->sq_array[idx] = idx;
+    __atomic_store_n (st->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    st->to_submit++;
+    return sqe;
+}
+
+static void provide_buffer (struct uring_state *st, unsigned short bid)
+{
+    struct io_uring_buf *const buf = &st->br->bufs[st->br_tail & (N_BUFS - 1)];
+
+    buf->addr = (uint64_t) (uintptr_t) (st->bufs + (size_t) bid * BUF_LEN);
+    buf->len = BUF_LEN;
+    buf->bid = bid;
+    st->br_tail++;
+}
+
+static void publish_buffers (struct uring_state *st)
+{
+    __atomic_store_n (&st->br->tail, st->br_tail, __ATOMIC_RELEASE);
+}
+
+/**
+*	\brief	Queues the multishot request that matches fd's read interest.
+*/
+static int arm (struct uring_state *st, int fd)
+{
+    const unsigned interest = st->interest[fd];
+
+    if (!(interest & (EV_ACCEPT | EV_RECV | EV_READ))) {
+        return 0;
+    }
+
+    struct io_uring_sqe *const sqe = get_sqe (st);
+
+    if (!sqe) {
+        return -1;
+    }
+    sqe->fd = fd;
+
+    if (interest & EV_ACCEPT) {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        sqe->user_data = UD (OP_ACCEPT, st->gen[fd], fd);
+    } else if (interest & EV_RECV) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUF_GROUP;
+        sqe->user_data = UD (OP_RECV, st->gen[fd], fd);
+    } else {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = UD (OP_POLL, st->gen[fd], fd);
+    }
+    return 0;
+}
+
+/**
+*	\brief	Queues a one-shot poll for writability, unless one is pending.
+*/
+static int arm_write (struct uring_state *st, int fd)
+{
+    if (st->write_armed[fd]) {
+        return 0;
+    }
+
+    struct io_uring_sqe *const sqe = get_sqe (st);
+
+    if (!sqe) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = UD (OP_POLL_WRITE, st->gen[fd], fd);
+    st->write_armed[fd] = 1;
+    return 0;
+}
+
+static int cancel (struct uring_state *st, int fd)
+{
+    struct io_uring_sqe *const sqe = get_sqe (st);
+
+    if (!sqe) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = UD (OP_CANCEL, 0, fd);
+    return 0;
+}
+
+/**
+*	\brief	Stops fd's multishot receive, leaving everything else armed.
+*/
+static int cancel_recv (struct uring_state *st, int fd)
+{
+    struct io_uring_sqe *const sqe = get_sqe (st);
+
+    if (!sqe) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = UD (OP_RECV, st->gen[fd], fd);
+    sqe->user_data = UD (OP_CANCEL, 0, fd);
+    return 0;
+}
+
+static void uring_destroy (void *state)
+{
+    struct uring_state *const st = state;
+
+    if (st->ring_fd != -1) {
+        close (st->ring_fd);
+    }
+    if (st->sqes && st->sqes != MAP_FAILED) {
+        munmap (st->sqes, st->sqes_len);
+    }
+    if (st->cq_ptr && st->cq_ptr != MAP_FAILED && st->cq_ptr != st->sq_ptr) {
+        munmap (st->cq_ptr, st->cq_len);
+    }
+    if (st->sq_ptr && st->sq_ptr != MAP_FAILED) {
+        munmap (st->sq_ptr, st->sq_len);
+    }
+    if (st->br && st->br != MAP_FAILED) {
+        munmap (st->br, st->br_len);
+    }
+    free (st->bufs);
+    free (st->gen);
+    free (st->interest);
+    free (st->write_armed);
+    free (st->backlog);
+    free (st->sends);
+    free (st->iovs);
+    free (st);
+}
+
+static int map_rings (struct uring_state *st, const struct io_uring_params *p)
+{
+    st->sq_len = p->sq_off.array + p->sq_entries * sizeof (unsigned);
+    st->cq_len = p->cq_off.cqes + p->cq_entries * sizeof (struct io_uring_cqe);
+
+    if (st->features & IORING_FEAT_SINGLE_MMAP) {
+        st->sq_len = st->cq_len = st->sq_len > st->cq_len ? st->sq_len
+            : st->cq_len;
+    }
+    st->sq_ptr = mmap (0, st->sq_len, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, st->ring_fd,
+                       IORING_OFF_SQ_RING);
+    if (st->sq_ptr == MAP_FAILED) {
+        return -1;
+    }
+    st->cq_ptr = st->features & IORING_FEAT_SINGLE_MMAP ? st->sq_ptr
+        : mmap (0, st->cq_len, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, st->ring_fd, IORING_OFF_CQ_RING);
+    if (st->cq_ptr == MAP_FAILED) {
+        return -1;
+    }
+    st->sqes_len = p->sq_entries * sizeof (struct io_uring_sqe);
+    st->sqes = mmap (0, st->sqes_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, st->ring_fd,
+                     IORING_OFF_SQES);
+    if (st->sqes == MAP_FAILED) {
+        return -1;
+    }
+
+    char *const sq = st->sq_ptr;
+    char *const cq = st->cq_ptr;
+
+    st->sq_head = (unsigned *) (void *) (sq + p->sq_off.head);
+    st->sq_tail = (unsigned *) (void *) (sq + p->sq_off.tail);
+    st->sq_mask = *(unsigned *) (void *) (sq + p->sq_off.ring_mask);
+    st->sq_array = (unsigned *) (void *) (sq + p->sq_off.array);
+    st->cq_head = (unsigned *) (void *) (cq + p->cq_off.head);
+    st->cq_tail = (unsigned *) (void *) (cq + p->cq_off.tail);
+    st->cq_mask = *(unsigned *) (void *) (cq + p->cq_off.ring_mask);
+    st->cqes = (struct io_uring_cqe *) (void *) (cq + p->cq_off.cqes);
+    return 0;
+}
+
+static int register_buffers (struct uring_state *st)
+{
+    st->br_len = N_BUFS * sizeof (struct io_uring_buf);
+    st->br = mmap (0, st->br_len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (st->br == MAP_FAILED) {
+        return -1;
+    }
+    if (!(st->bufs = malloc ((size_t) N_BUFS * BUF_LEN))) {
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uint64_t) (uintptr_t) st->br,
+        .ring_entries = N_BUFS,
+        .bgid = BUF_GROUP,
+    };
+
+    if (sys_io_uring_register (st->ring_fd, IORING_REGISTER_PBUF_RING,
+                               &reg, 1) == -1) {
+        return -1;
+    }
+    for (unsigned i = 0; i < N_BUFS; i++) {
+        provide_buffer (st, (unsigned short) i);
+    }
+    publish_buffers (st);
+    return 0;
+}
+
+static void *uring_init (int size)
+{
+    struct uring_state *const st = calloc (1, sizeof *st);
+
+    if (!st) {
+        return 0;
+    }
+    st->ring_fd = -1;
+    st->size = size;
+
+    struct io_uring_params p = {.flags = IORING_SETUP_CQSIZE,
+        .cq_entries = CQ_ENTRIES
+    };
+
+    if ((st->ring_fd = sys_io_uring_setup (SQ_ENTRIES, &p)) == -1) {
+        goto fail;
+    }
+    st->features = p.features;
+
+    if (!(st->features & IORING_FEAT_EXT_ARG)) {
+        errno = ENOSYS;
+        goto fail;
+    }
+    if (map_rings (st, &p) == -1 || register_buffers (st) == -1) {
+        goto fail;
+    }
+    st->gen = calloc ((size_t) size, sizeof *st->gen);
+    st->interest = calloc ((size_t) size, sizeof *st->interest);
+    st->write_armed = calloc ((size_t) size, sizeof *st->write_armed);
+
+    if (!st->gen || !st->interest || !st->write_armed) {
+        goto fail;
+    }
+    return st;
+
+  fail:
+    {
+        const int saved_errno = errno;
+
+        uring_destroy (st);
+        errno = saved_errno;
+    }
+    return 0;
+}
+
+static int uring_add (void *state, int fd, unsigned events)
+{
+    struct uring_state *const st = state;
+
+    if (fd < 0 || fd >= st->size) {
+        errno = EBADF;
+        return -1;
+    }
+    st->interest[fd] = events;
+
+    if (arm (st, fd) == -1) {
+        return -1;
+    }
+    return events & EV_WRITE ? arm_write (st, fd) : 0;
+}
+
+static int uring_del (void *state, int fd)
+{
+    struct uring_state *const st = state;
+
+    if (fd < 0 || fd >= st->size) {
+        errno = EBADF;
+        return -1;
+    }
+    /*
+     * A pending request holds a reference to the socket, so closing the
+     * descriptor alone would not close the connection. Cancel it now, and
+     * let the generation bump discard whatever it still delivers.
+     */
+    st->interest[fd] = 0;
+    st->write_armed[fd] = 0;
+    st->gen[fd]++;
+
+    if (cancel (st, fd) == -1) {
+        return -1;
+    }
+    return uring_enter (st, 0, 0);
+}
+
+static int uring_mod (void *state, int fd, unsigned events)
+{
+    struct uring_state *const st = state;
+
+    if (fd < 0 || fd >= st->size) {
+        errno = EBADF;
+        return -1;
+    }
+    const unsigned changed = st->interest[fd] ^ events;
+
+    /*
+     * Write interest comes and goes with a client's queue, and receive
+     * interest with flow control, so neither bumps the generation: what
+     * was received before a pause is still delivered. A write poll that is
+     * no longer wanted is left to fire, and is then ignored.
+     */
+    if (!(changed & ~(unsigned) (EV_WRITE | EV_RECV))) {
+        st->interest[fd] = events;
+
+        if (changed & EV_RECV
+            && (events & EV_RECV ? arm (st, fd) : cancel_recv (st, fd)) == -1) {
+            return -1;
+        }
+        return events & EV_WRITE ? arm_write (st, fd) : 0;
+    }
+    if (uring_del (state, fd) == -1) {
+        return -1;
+    }
+    return uring_add (state, fd, events);
+}
+
+static int push_backlog (struct uring_state *st, const struct io_uring_cqe *cqe)
+{
+    if (st->n_backlog == st->backlog_cap) {
+        const int cap = st->backlog_cap ? st->backlog_cap * 2 : 64;
+        struct io_uring_cqe *const new =
+            realloc (st->backlog, (size_t) cap * sizeof *new);
+
+        if (!new) {
+            return -1;
+        }
+        st->backlog = new;
+        st->backlog_cap = cap;
+    }
+    st->backlog[st->n_backlog++] = *cqe;
+    return 0;
+}
+
+/**
+*	\brief	Turns a completion into an event for the caller.
+*	\return	1 if ev was filled in, or 0 if there was nothing to report.
+*/
+static int complete (struct uring_state *st, const struct io_uring_cqe *cqe,
+                     struct event *ev)
+{
+    const enum uring_op op = UD_OP (cqe->user_data);
+    const int fd = UD_N (cqe->user_data);
+    const int more = !!(cqe->flags & IORING_CQE_F_MORE);
+    const int has_buf = !!(cqe->flags & IORING_CQE_F_BUFFER);
+    const unsigned short bid =
+        (unsigned short) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+    if (op == OP_SEND || op == OP_CANCEL) {
+        return 0;
+    }
+    if (op == OP_POLL_WRITE && fd >= 0 && fd < st->size
+        && UD_GEN (cqe->user_data) == st->gen[fd]) {
+        st->write_armed[fd] = 0;
+    }
+    if (fd < 0 || fd >= st->size || UD_GEN (cqe->user_data) != st->gen[fd]) {
+        /*
+         * Stale: the descriptor was removed after this was posted.
+         */
+        if (has_buf) {
+            st->recycle[st->n_recycle++] = bid;
+        }
+        return 0;
+    }
+    if (!more && op != OP_POLL_WRITE
+        && (op == OP_ACCEPT ? cqe->res != -ECANCELED
+                  : op == OP_RECV ? cqe->res > 0 || cqe->res == -ENOBUFS
+                  : cqe->res >= 0)) {
+        /*
+         * The kernel stopped the multishot request without it having
+         * failed for good (a full CQ, no buffers left, EMFILE on accept),
+         * so arm it again.
+         */
+        arm (st, fd);
+    }
+    ev->fd = fd;
+    ev->res = 0;
+    ev->data = 0;
+    ev->len = 0;
+
+    switch (op) {
+        case OP_ACCEPT:
+            if (cqe->res < 0) {
+                return 0;
+            }
+            ev->events = EV_ACCEPT;
+            ev->res = cqe->res;
+            return 1;
+        case OP_RECV:
+            if (cqe->res == -ENOBUFS || cqe->res == -ECANCELED) {
+                if (has_buf) {
+                    st->recycle[st->n_recycle++] = bid;
+                }
+                return 0;
+            }
+            if (cqe->res <= 0) {
+                if (has_buf) {
+                    st->recycle[st->n_recycle++] = bid;
+                }
+                ev->events = EV_HUP;
+                ev->res = cqe->res;
+                return 1;
+            }
+            /*
+             * The buffer is lent to the caller until the next wait.
+             */
+            st->recycle[st->n_recycle++] = bid;
+            ev->events = EV_DATA;
+            ev->data = st->bufs + (size_t) bid * BUF_LEN;
+            ev->len = (size_t) cqe->res;
+            return 1;
+        case OP_POLL:
+            if (cqe->res < 0) {
+                ev->events = EV_HUP;
+                return 1;
+            }
+            ev->events = (cqe->res & POLLIN ? EV_READ : 0u)
+                | (cqe->res & POLLOUT ? EV_WRITE : 0u)
+                | (cqe->res & (POLLHUP | POLLERR) ? EV_HUP : 0u);
+            return !!ev->events;
+        case OP_POLL_WRITE:
+            if (cqe->res < 0 || !(st->interest[fd] & EV_WRITE)) {
+                return 0;
+            }
+            /*
+             * Keep watching until the caller drops the interest, which it
+             * does once its queue is empty.
+             */
+            st->rearm[st->n_rearm++] = fd;
+            ev->events = EV_WRITE | (cqe->res & (POLLHUP | POLLERR) ? EV_HUP
+                                     : 0u);
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int uring_wait (void *state, struct event *events, int max_events,
+                       int timeout)
+{
+    struct uring_state *const st = state;
+    int n = 0;
+
+    if (max_events > MAX_READY) {
+        max_events = MAX_READY;
+    }
+
+    /*
+     * Whatever was lent out last time is free again.
+     */
+    for (int i = 0; i < st->n_recycle; i++) {
+        provide_buffer (st, st->recycle[i]);
+    }
+    if (st->n_recycle) {
+        publish_buffers (st);
+        st->n_recycle = 0;
+    }
+    for (int i = 0; i < st->n_rearm; i++) {
+        if (st->interest[st->rearm[i]] & EV_WRITE) {
+            arm_write (st, st->rearm[i]);
+        }
+    }
+    st->n_rearm = 0;
+
+    int used = 0;
+
+    while (used < st->n_backlog && n < max_events) {
+        n += complete (st, &st->backlog[used++], &events[n]);
+    }
+    if (used) {
+        memmove (st->backlog, st->backlog + used,
+                 (size_t) (st->n_backlog - used) * sizeof *st->backlog);
+        st->n_backlog -= used;
+    }
+
+    unsigned head = *st->cq_head;
+
+    if (!n && head == __atomic_load_n (st->cq_tail, __ATOMIC_ACQUIRE)) {
+        if (uring_enter (st, timeout ? 1 : 0, timeout) == -1) {
+            return -1;
+        }
+    } else if (st->to_submit && uring_enter (st, 0, 0) == -1) {
+        return -1;
+    }
+
+    while (n < max_events
+           && head != __atomic_load_n (st->cq_tail, __ATOMIC_ACQUIRE)) {
+        n += complete (st, &st->cqes[head & st->cq_mask], &events[n]);
+        head++;
+    }
+    __atomic_store_n (st->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+/**
+*	\brief	Cancels every multishot accept and receive, and waits until
+*			each has posted its last completion. Whatever they, or anything
+*			else, completed meanwhile is kept for the next wait.
+*/
+static int uring_quiesce (void *state)
+{
+    struct uring_state *const st = state;
+    unsigned char *const waiting = calloc ((size_t) st->size, 1);
+    int n_cancels = 0;
+    int n_waiting = 0;
+    int status = 0;
+
+    if (!waiting) {
+        return -1;
+    }
+    for (int fd = 0; fd < st->size; fd++) {
+        const unsigned interest = st->interest[fd];
+        const enum uring_op op = interest & EV_ACCEPT ? OP_ACCEPT : OP_RECV;
+
+        if (!(interest & (EV_ACCEPT | EV_RECV))) {
+            continue;
+        }
+
+        struct io_uring_sqe *const sqe = get_sqe (st);
+
+        if (!sqe) {
+            status = -1;
+            break;
+        }
+        /*
+         * Generation 1 tells these apart from the cancellations made by
+         * uring_del().
+         */
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = UD (op, st->gen[fd], fd);
+        sqe->user_data = UD (OP_CANCEL, 1, fd);
+        st->interest[fd] &= ~(unsigned) (EV_ACCEPT | EV_RECV);
+        waiting[fd] = 1;
+        n_cancels++;
+        n_waiting++;
+    }
+
+    while (n_cancels || n_waiting) {
+        if (uring_enter (st, 1, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            status = -1;
+            break;
+        }
+
+        unsigned head = *st->cq_head;
+
+        while (head != __atomic_load_n (st->cq_tail, __ATOMIC_ACQUIRE)) {
+            const struct io_uring_cqe *const cqe = &st->cqes[head & st->cq_mask];
+            const enum uring_op op = UD_OP (cqe->user_data);
+            const int fd = UD_N (cqe->user_data);
+
+            head++;
+
+            if (op == OP_CANCEL && UD_GEN (cqe->user_data) == 1) {
+                /*
+                 * ENOENT: the request had already posted its last
+                 * completion, if it was armed at all.
+                 */
+                n_cancels--;
+
+                if (cqe->res == -ENOENT && waiting[fd]) {
+                    waiting[fd] = 0;
+                    n_waiting--;
+                }
+                continue;
+            }
+            if ((op == OP_ACCEPT || op == OP_RECV) && fd >= 0
+                && fd < st->size && UD_GEN (cqe->user_data) == st->gen[fd]
+                && !(cqe->flags & IORING_CQE_F_MORE) && waiting[fd]) {
+                waiting[fd] = 0;
+                n_waiting--;
+            }
+            if (push_backlog (st, cqe) == -1) {
+                status = -1;
+            }
+        }
+        __atomic_store_n (st->cq_head, head, __ATOMIC_RELEASE);
+    }
+    free (waiting);
+    return status == -1 ? -1 : !!st->n_backlog;
+}
+
+/**
+*	\brief	Doubles *cap until it holds need elements of size bytes, moving *p.
+*	\return	0 on success, or -1 on failure.
+*/
+static int reserve (void **p, int *cap, int need, size_t size)
+{
+    if (need <= *cap) {
+        return 0;
+    }
+
+    int new_cap = *cap ? *cap : 64;
+
+    while (new_cap < need) {
+        new_cap *= 2;
+    }
+
+    void *const new = realloc (*p, (size_t) new_cap * size);
+
+    if (!new) {
+        return -1;
+    }
+    *p = new;
+    *cap = new_cap;
+    return 0;
+}
+
+static int uring_sendv (void *state, int fd, const struct iovec *iov,
+                        int iovcnt, void *cookie)
+{
+    struct uring_state *const st = state;
+
+    if (reserve ((void **) &st->sends, &st->sends_cap, st->n_sends + 1,
+                 sizeof *st->sends) == -1
+        || reserve ((void **) &st->iovs, &st->iovs_cap, st->n_iovs + iovcnt,
+                    sizeof *st->iovs) == -1) {
+        return -1;
+    }
+    memcpy (st->iovs + st->n_iovs, iov, (size_t) iovcnt * sizeof *iov);
+    st->sends[st->n_sends++] = (struct pending_send) {
+        .fd = fd,.iov_off = st->n_iovs,.iovcnt = iovcnt,.cookie = cookie
+    };
+    st->n_iovs += iovcnt;
+    return 0;
+}
+
+static int queue_send (struct uring_state *st, int slot)
+{
+    struct pending_send *const ps = &st->sends[slot];
+    struct io_uring_sqe *const sqe = get_sqe (st);
+
+    if (!sqe) {
+        return -1;
+    }
+    ps->msg = (struct msghdr) {
+        .msg_iov = st->iovs + ps->iov_off,
+        .msg_iovlen = (size_t) ps->iovcnt,
+    };
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = ps->fd;
+    sqe->addr = (uint64_t) (uintptr_t) & ps->msg;
+    sqe->len = 1;
+    /*
+     * Fail with EAGAIN on a full socket rather than have the kernel park
+     * the request, the same as sendmsg() on a non-blocking socket. And
+     * disable SIGPIPE, which would kill the server process.
+     */
+    sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+    sqe->user_data = UD (OP_SEND, 0, slot);
+    return 0;
+}
+
+static int uring_flush (void *state, event_sent_fn *sent, void *arg)
+{
+    struct uring_state *const st = state;
+    int in_flight = 0;
+    int status = 0;
+
+    for (int i = 0; i < st->n_sends; i++) {
+        if (queue_send (st, i) == -1) {
+            sent (st->sends[i].cookie, -errno, arg);
+            continue;
+        }
+        in_flight++;
+    }
+
+    while (in_flight) {
+        if (uring_enter (st, 1, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            status = -1;
+            break;
+        }
+
+        unsigned head = *st->cq_head;
+
+        while (head != __atomic_load_n (st->cq_tail, __ATOMIC_ACQUIRE)) {
+            const struct io_uring_cqe *const cqe = &st->cqes[head & st->cq_mask];
+
+            head++;
+
+            if (UD_OP (cqe->user_data) != OP_SEND) {
+                if (push_backlog (st, cqe) == -1) {
+                    status = -1;
+                }
+                continue;
+            }
+            in_flight--;
+            sent (st->sends[UD_N (cqe->user_data)].cookie, cqe->res, arg);
+        }
+        __atomic_store_n (st->cq_head, head, __ATOMIC_RELEASE);
+    }
+    st->n_sends = st->n_iovs = 0;
+    return status;
+}
+
+const struct ev_backend ev_uring_backend = {
+    .name = "uring",
+    .max_fds = 0,
+    .init = uring_init,
+    .destroy = uring_destroy,
+    .add = uring_add,
+    .mod = uring_mod,
+    .del = uring_del,
+    .wait = uring_wait,
+    .sendv = uring_sendv,
+    .flush = uring_flush,
+    .quiesce = uring_quiesce,
+};
+
+#endif /* __linux__ */
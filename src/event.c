@@ -0,0 +1,122 @@
+#include "event.h"
+#include "ev_backend.h"
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+struct event_loop {
+    const struct ev_backend *ops;
+    void *state;
+    int capacity;
+};
+
+/*
+*	Ordered by preference. select() is the portable fallback.
+*/
+static const struct ev_backend *const backends[] = {
+#ifdef __linux__
+    &ev_epoll_backend,
+    &ev_uring_backend,
+#endif
+    &ev_select_backend,
+};
+
+static const char *names[ARRAY_CARDINALITY (backends) + 1];
+
+const char *const *event_backends (void)
+{
+    for (size_t i = 0; i < ARRAY_CARDINALITY (backends); i++) {
+        names[i] = backends[i]->name;
+    }
+    return names;
+}
+
+struct event_loop *event_loop_new (const char *backend, int size)
+{
+    const struct ev_backend *ops = backend ? 0 : backends[0];
+
+    for (size_t i = 0; !ops && i < ARRAY_CARDINALITY (backends); i++) {
+        if (!strcmp (backends[i]->name, backend)) {
+            ops = backends[i];
+        }
+    }
+    if (!ops) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    struct event_loop *const loop = malloc (sizeof *loop);
+
+    if (!loop) {
+        return 0;
+    }
+    loop->ops = ops;
+    loop->capacity = ops->max_fds && size > ops->max_fds ? ops->max_fds : size;
+
+    if (!(loop->state = ops->init (loop->capacity))) {
+        free (loop);
+        return 0;
+    }
+    return loop;
+}
+
+void event_loop_free (struct event_loop *loop)
+{
+    if (loop) {
+        loop->ops->destroy (loop->state);
+        free (loop);
+    }
+}
+
+const char *event_loop_backend (const struct event_loop *loop)
+{
+    return loop->ops->name;
+}
+
+int event_loop_capacity (const struct event_loop *loop)
+{
+    return loop->capacity;
+}
+
+int event_add (struct event_loop *loop, int fd, unsigned events)
+{
+    return loop->ops->add (loop->state, fd, events);
+}
+
+int event_mod (struct event_loop *loop, int fd, unsigned events)
+{
+    return loop->ops->mod (loop->state, fd, events);
+}
+
+int event_del (struct event_loop *loop, int fd)
+{
+    return loop->ops->del (loop->state, fd);
+}
+
+int event_wait (struct event_loop *loop, struct event *events,
+                int max_events, int timeout)
+{
+    return loop->ops->wait (loop->state, events, max_events, timeout);
+}
+
+int event_sendv (struct event_loop *loop, int fd, const struct iovec *iov,
+                 int iovcnt, void *cookie)
+{
+    if (!loop->ops->sendv) {
+        errno = ENOSYS;
+        return -1;
+    }
+    return loop->ops->sendv (loop->state, fd, iov, iovcnt, cookie);
+}
+
+int event_flush (struct event_loop *loop, event_sent_fn *sent, void *arg)
+{
+    return loop->ops->flush ? loop->ops->flush (loop->state, sent, arg) : 0;
+}
+
+int event_quiesce (struct event_loop *loop)
+{
+    return loop->ops->quiesce ? loop->ops->quiesce (loop->state) : 0;
+}
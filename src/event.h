@@ -0,0 +1,124 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stddef.h>
+
+struct iovec;
+
+/*
+*	Interest and readiness flags for event_add(), event_mod() and struct event.
+*
+*	EV_ACCEPT and EV_RECV are interests for listeners and connected sockets.
+*	Readiness backends watch them as EV_READ and report EV_READ, leaving the
+*	caller to accept() or recv(). Completion backends do the work themselves
+*	and report EV_ACCEPT with the new descriptor in res, or EV_DATA with the
+*	bytes received.
+*/
+#define EV_READ		0x01
+#define EV_WRITE	0x02
+#define EV_HUP		0x04
+#define EV_ACCEPT	0x08
+#define EV_RECV		0x10
+#define EV_DATA		0x20
+
+/*
+*	A ready descriptor, or a completed operation, as reported by event_wait().
+*/
+struct event {
+    int fd;
+    unsigned events;
+    int res;                    /* EV_ACCEPT: the accepted socket. */
+    char *data;                 /* EV_DATA: valid until the next event_wait(). */
+    size_t len;
+};
+
+struct event_loop;
+
+/**
+*	\brief	Creates an event loop using the named backend.
+*	\param	backend - "epoll", "uring" or "select", or NULL for the best one available.
+*	\param	size 	- The number of descriptors the caller expects to watch.
+*	\return	A new event loop, or NULL on failure.
+*/
+struct event_loop *event_loop_new (const char *backend, int size);
+
+void event_loop_free (struct event_loop *loop);
+
+/**
+*	\brief	Returns the name of the backend driving the loop.
+*/
+const char *event_loop_backend (const struct event_loop *loop);
+
+/**
+*	\brief	Returns the number of descriptors the loop can watch. This is the
+*			size passed to event_loop_new(), clamped to the backend's ceiling
+*			(FD_SETSIZE for select()).
+*/
+int event_loop_capacity (const struct event_loop *loop);
+
+/**
+*	\brief	Starts, changes, or stops watching a descriptor.
+*	\param	fd 	   - The file descriptor.
+*	\param	events - EV_READ and/or EV_WRITE.
+*	\return	0 on success, or -1 on failure.
+*
+*	\warning Backends may be edge-triggered. Callers must drain a descriptor
+*			 (read or accept until EAGAIN) before waiting on it again.
+*/
+int event_add (struct event_loop *loop, int fd, unsigned events);
+int event_mod (struct event_loop *loop, int fd, unsigned events);
+int event_del (struct event_loop *loop, int fd);
+
+/**
+*	\brief	Waits for descriptors to become ready.
+*	\param	events  	- To store the ready descriptors.
+*	\param	max_events 	- The capacity of events.
+*	\param	timeout 	- Milliseconds to wait, or -1 to wait indefinitely.
+*	\return	The number of ready descriptors, or -1 on failure.
+*/
+int event_wait (struct event_loop *loop, struct event *events,
+                int max_events, int timeout);
+
+/*
+*	Called by event_flush() for each send, with the cookie given to
+*	event_sendv() and the number of bytes sent, or a negated errno value.
+*/
+typedef void event_sent_fn (void *cookie, long res, void *arg);
+
+/**
+*	\brief	Queues the iovcnt buffers of iov to be sent on fd, in one go, by the
+*			next event_flush(). iov itself is copied, but the buffers have
+*			to stay valid until then. The socket is not waited on: a full
+*			socket fails with EAGAIN, like a non-blocking sendmsg().
+*	\return	0 on success, or -1 on failure. errno is ENOSYS if the backend
+*			does not batch sends, in which case the caller sends itself.
+*/
+int event_sendv (struct event_loop *loop, int fd, const struct iovec *iov,
+                 int iovcnt, void *cookie);
+
+/**
+*	\brief	Submits every queued send at once, waits for them to complete, and
+*			reports each to sent().
+*	\return	0 on success, or -1 on failure.
+*/
+int event_flush (struct event_loop *loop, event_sent_fn *sent, void *arg);
+
+/**
+*	\brief	Stops the kernel from receiving and accepting on the loop's
+*			behalf, for backends that have it do so (io_uring), and waits
+*			until it has. What it had received or accepted by then is still
+*			reported by event_wait(), but nothing more is for a descriptor
+*			until its interest is set again with event_mod().
+*	\return	1 if there is something left for event_wait() to report, in
+*			which case the caller handles it and calls this again, 0 once
+*			there is not, or -1 on failure.
+*/
+int event_quiesce (struct event_loop *loop);
+
+/**
+*	\brief	Returns a NULL-terminated list of the backends compiled in, the
+*			default first.
+*/
+const char *const *event_backends (void);
+
+#endif /* EVENT_H */
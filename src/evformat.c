@@ -0,0 +1,332 @@
+#ifdef _POSIX_C_SOURCE
+#undef _POSIX_C_SOURCE
+#endif
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "evlog.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/*
+*	An 'a' argument: a family and a port, both uint16_t, and 16 bytes of
+*	address.
+*/
+#define ADDR_LEN	(2 * sizeof (uint16_t) + 16)
+
+/**
+*	\return	The bytes the arguments in a take at the least, their strings
+*			being empty.
+*/
+static size_t fixed_len (const char *a)
+{
+    size_t n = 0;
+
+    for (; *a; a++) {
+        switch (*a) {
+            case 'd':
+                n += sizeof (int32_t);
+                break;
+            case 'z':
+            case 'u':
+                n += sizeof (uint64_t);
+                break;
+            case 's':
+                n += sizeof (uint16_t);
+                break;
+            case 'a':
+                n += ADDR_LEN;
+                break;
+        }
+    }
+    return n;
+}
+
+/**
+*	\brief	Stores a peer's address as an 'a' argument, with IPv4-mapped IPv6
+*			addresses unmapped.
+*/
+static void put_addr (char *p, const struct sockaddr *sa)
+{
+    static const uint8_t v4_mapped[12] = {[10] = 0xFF,[11] = 0xFF };
+    uint16_t family = 0;
+    uint16_t port = 0;
+    uint8_t bytes[16] = { 0 };
+
+    if (sa && sa->sa_family == AF_INET) {
+        const struct sockaddr_in *const sin = (const void *) sa;
+
+        family = AF_INET;
+        port = ntohs (sin->sin_port);
+        memcpy (bytes, &sin->sin_addr, sizeof sin->sin_addr);
+    } else if (sa && sa->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *const sin6 = (const void *) sa;
+        const uint8_t *const a = sin6->sin6_addr.s6_addr;
+
+        port = ntohs (sin6->sin6_port);
+
+        if (!memcmp (a, v4_mapped, sizeof v4_mapped)) {
+            family = AF_INET;
+            memcpy (bytes, a + sizeof v4_mapped, 4);
+        } else {
+            family = AF_INET6;
+            memcpy (bytes, a, 16);
+        }
+    }
+    memcpy (p, &family, sizeof family);
+    memcpy (p + sizeof family, &port, sizeof port);
+    memcpy (p + 2 * sizeof (uint16_t), bytes, sizeof bytes);
+}
+
+size_t evlog_encode (char *rec, size_t size, enum log_codes code, va_list ap)
+{
+    char *p = rec + sizeof (struct evlog_record);
+    const char *const end = rec + (size & ~(size_t) (EVLOG_ALIGN - 1));
+
+    for (const char *a = log_args[code]; *a; a++) {
+        switch (*a) {
+            case 'p':
+                (void) va_arg (ap, const char *);
+                break;
+            case 'd':{
+                    const int32_t v = va_arg (ap, int);
+
+                    memcpy (p, &v, sizeof v);
+                    p += sizeof v;
+                    break;
+                }
+            case 'z':{
+                    const uint64_t v = va_arg (ap, size_t);
+
+                    memcpy (p, &v, sizeof v);
+                    p += sizeof v;
+                    break;
+                }
+            case 'u':{
+                    const uint64_t v = va_arg (ap, unsigned long long);
+
+                    memcpy (p, &v, sizeof v);
+                    p += sizeof v;
+                    break;
+                }
+            case 's':{
+                    /*
+                     * Truncated to leave room for the arguments after it.
+                     */
+                    const char *const s = va_arg (ap, const char *);
+                    const size_t room = (size_t) (end - p) - sizeof (uint16_t)
+                        - fixed_len (a + 1);
+                    const size_t n = strnlen (s, room < EVLOG_STR_MAX ? room
+                                              : EVLOG_STR_MAX);
+                    const uint16_t len = (uint16_t) n;
+
+                    memcpy (p, &len, sizeof len);
+                    memcpy (p + sizeof len, s, n);
+                    p += sizeof len + n;
+                    break;
+                }
+            case 'a':
+                put_addr (p, va_arg (ap, const struct sockaddr *));
+                p += ADDR_LEN;
+                break;
+        }
+    }
+
+    const size_t len = ((size_t) (p - rec) + EVLOG_ALIGN - 1)
+        & ~(size_t) (EVLOG_ALIGN - 1);
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    struct evlog_record hdr = {
+        .code = (uint16_t) code,
+        .mono_ns = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec,
+    };
+
+    memset (p, 0, len - (size_t) (p - rec));
+    memcpy (rec, &hdr, sizeof hdr);
+
+    /*
+     * The length goes in last, so that a segment cut short by a crash
+     * ends at the last whole record.
+     */
+    const uint32_t rec_len = (uint32_t) len;
+
+    memcpy (rec, &rec_len, sizeof rec_len);
+    return len;
+}
+
+/**
+*	\brief	Formats an 'a' argument as "HOST:PORT", or "[HOST]:PORT" for IPv6.
+*/
+static void format_addr (char *buf, size_t size, const char *p)
+{
+    uint16_t family;
+    uint16_t port;
+    char host[INET6_ADDRSTRLEN];
+
+    memcpy (&family, p, sizeof family);
+    memcpy (&port, p + sizeof family, sizeof port);
+
+    if ((family != AF_INET && family != AF_INET6)
+        || !inet_ntop (family, p + 2 * sizeof (uint16_t), host, sizeof host)) {
+        snprintf (buf, size, "an unknown address");
+    } else if (family == AF_INET6) {
+        snprintf (buf, size, "[%s]:%u", host, port);
+    } else {
+        snprintf (buf, size, "%s:%u", host, port);
+    }
+}
+
+int evlog_decode (const char *rec, struct evlog_arg args[], int max)
+{
+    struct evlog_record hdr;
+
+    memcpy (&hdr, rec, sizeof hdr);
+
+    const char *p = rec + sizeof hdr;
+    const char *const end = rec + hdr.len;
+    int n = 0;
+
+    for (const char *a = log_args[hdr.code]; *a && n < max; a++, n++) {
+        args[n].type = *a;
+
+        switch (*a) {
+            case 'p':
+                args[n].s = PROGRAM_NAME;
+                args[n].len = (uint16_t) strlen (PROGRAM_NAME);
+                break;
+            case 'd':{
+                    int32_t v;
+
+                    if (end - p < (ptrdiff_t) sizeof v) {
+                        return -1;
+                    }
+                    memcpy (&v, p, sizeof v);
+                    p += sizeof v;
+                    args[n].i = v;
+                    break;
+                }
+            case 'z':
+            case 'u':{
+                    uint64_t v;
+
+                    if (end - p < (ptrdiff_t) sizeof v) {
+                        return -1;
+                    }
+                    memcpy (&v, p, sizeof v);
+                    p += sizeof v;
+                    args[n].u = v;
+                    break;
+                }
+            case 's':{
+                    uint16_t len;
+
+                    if (end - p < (ptrdiff_t) sizeof len) {
+                        return -1;
+                    }
+                    memcpy (&len, p, sizeof len);
+                    p += sizeof len;
+
+                    if (end - p < len) {
+                        return -1;
+                    }
+                    args[n].s = p;
+                    args[n].len = len;
+                    p += len;
+                    break;
+                }
+            case 'a':
+                if (end - p < (ptrdiff_t) ADDR_LEN) {
+                    return -1;
+                }
+                format_addr (args[n].addr, sizeof args[n].addr, p);
+                args[n].s = args[n].addr;
+                args[n].len = (uint16_t) strlen (args[n].addr);
+                p += ADDR_LEN;
+                break;
+            default:
+                return -1;
+        }
+    }
+    return n;
+}
+
+void evlog_render (char *buf, size_t size, enum log_codes code,
+                   const struct evlog_arg args[], int n_args)
+{
+    const char *t = logs[code];
+    size_t len = 0;
+    int next = 0;
+
+    while (*t && len + 1 < size) {
+        if (*t != '%') {
+            buf[len++] = *t++;
+            continue;
+        }
+        if (t[1] == '%') {
+            buf[len++] = '%';
+            t += 2;
+            continue;
+        }
+
+        /*
+         * Copy the conversion out, to format the one argument with.
+         */
+        char spec[16];
+        size_t k = 0;
+
+        while (t[k] && k < sizeof spec - 1 && !strchr ("diuxXsc", t[k])) {
+            k++;
+        }
+        if (!t[k] || k >= sizeof spec - 2) {
+            break;
+        }
+        memcpy (spec, t, k + 1);
+        spec[k + 1] = '\0';
+        t += k + 1;
+
+        if (next == n_args) {
+            break;
+        }
+
+        const struct evlog_arg *const a = &args[next++];
+        int w;
+
+        switch (a->type) {
+            case 'p':
+            case 's':
+            case 'a':
+                w = snprintf (buf + len, size - len, "%.*s", (int) a->len,
+                              a->s);
+                break;
+            case 'd':
+                w = snprintf (buf + len, size - len, spec, (int) a->i);
+                break;
+            case 'z':
+                w = snprintf (buf + len, size - len, spec, (size_t) a->u);
+                break;
+            default:
+                w = snprintf (buf + len, size - len, spec, a->u);
+                break;
+        }
+        len += w > 0 ? (size_t) w : 0;
+
+        if (len >= size) {
+            len = size - 1;
+        }
+    }
+
+    /*
+     * The templates end in a newline or not, as it happens.
+     */
+    while (len && (buf[len - 1] == '\n' || buf[len - 1] == ' ')) {
+        len--;
+    }
+    buf[len] = '\0';
+}
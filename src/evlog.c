@@ -0,0 +1,180 @@
+#ifdef _POSIX_C_SOURCE
+#undef _POSIX_C_SOURCE
+#endif
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "evlog.h"
+#include "err.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+*	The largest record: a header, and every argument a maximal string.
+*/
+#define EVLOG_RECORD_MAX	(sizeof (struct evlog_record) \
+							 + 8 * (sizeof (uint16_t) + EVLOG_STR_MAX))
+
+static const char *evlog_dir;
+static size_t evlog_size;
+static atomic_uint threads;
+
+/*
+*	The calling thread's segment.
+*/
+static _Thread_local struct {
+    int fd;                     /* -1 if there is none. */
+    char *map;
+    size_t used;
+    uint32_t thread;
+    uint32_t seq;
+    int started;
+    int failed;                 /* Fall back to text from now on. */
+} seg;
+
+static int64_t now_ns (clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime (clock, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+*	\brief	Unmaps the current segment, and trims its file to what was used.
+*/
+static void close_segment (void)
+{
+    if (seg.map) {
+        munmap (seg.map, evlog_size);
+        seg.map = 0;
+    }
+    if (seg.fd != -1) {
+        if (ftruncate (seg.fd, (off_t) seg.used) == -1) {
+            perror ("ftruncate()");
+        }
+        close (seg.fd);
+        seg.fd = -1;
+    }
+}
+
+/**
+*	\brief	Starts the calling thread's next segment.
+*	\return	0 on success, or -1 on failure.
+*/
+static int open_segment (void)
+{
+    char path[4096];
+
+    if (!seg.started) {
+        seg.started = 1;
+        seg.fd = -1;
+        seg.thread = atomic_fetch_add (&threads, 1);
+    }
+    close_segment ();
+    snprintf (path, sizeof path, "%s/events.%ld.%u.%u", evlog_dir,
+              (long) getpid (), seg.thread, seg.seq++);
+
+    if ((seg.fd = open (path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                        0644)) == -1) {
+        perror ("open()");
+        return -1;
+    }
+    if (ftruncate (seg.fd, (off_t) evlog_size) == -1) {
+        perror ("ftruncate()");
+        close_segment ();
+        return -1;
+    }
+
+    void *const map = mmap (0, evlog_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, seg.fd, 0);
+
+    if (map == MAP_FAILED) {
+        perror ("mmap()");
+        close_segment ();
+        return -1;
+    }
+    seg.map = map;
+
+    struct evlog_segment hdr = {
+        .magic = EVLOG_MAGIC,
+        .version = EVLOG_VERSION,
+        .order = 0x0102,
+        .thread = seg.thread,
+        .seq = seg.seq - 1,
+        .wall_ns = now_ns (CLOCK_REALTIME),
+        .mono_ns = now_ns (CLOCK_MONOTONIC),
+    };
+
+    memcpy (seg.map, &hdr, sizeof hdr);
+    seg.used = sizeof hdr;
+    return 0;
+}
+
+int evlog_open (const char *dir, size_t size)
+{
+    if (mkdir (dir, 0755) == -1 && errno != EEXIST) {
+        perror ("mkdir()");
+        return -1;
+    }
+    evlog_dir = dir;
+    evlog_size = size < EVLOG_MIN_SEGMENT ? EVLOG_MIN_SEGMENT : size;
+    return 0;
+}
+
+/**
+*	\brief	Appends a record for code to the calling thread's segment,
+*			starting a new one if it would not fit.
+*	\return	0 on success, or -1 if there is no segment to append to.
+*/
+static int append (enum log_codes code, va_list ap)
+{
+    if (seg.failed) {
+        return -1;
+    }
+    if ((!seg.map || seg.used + EVLOG_RECORD_MAX > evlog_size)
+        && open_segment () == -1) {
+        seg.failed = 1;
+        return -1;
+    }
+
+    seg.used += evlog_encode (seg.map + seg.used, EVLOG_RECORD_MAX, code, ap);
+    return 0;
+}
+
+void log_event (enum log_codes code, ...)
+{
+    va_list ap;
+
+    va_start (ap, code);
+
+    if (evlog_dir && append (code, ap) == 0) {
+        va_end (ap);
+        return;
+    }
+    va_end (ap);
+
+    char rec[LOG_RECORD_MAX];
+
+    va_start (ap, code);
+    evlog_encode (rec, sizeof rec, code, ap);
+    va_end (ap);
+    log_post_record (log_fp, rec, LOG_FULLTIME);
+}
+
+void evlog_detach (void)
+{
+    if (seg.started) {
+        close_segment ();
+        seg.started = 0;
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef EVLOG_H
+#define EVLOG_H
+
+#include "internal.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+*	The binary event log: an alternative to server.log for the events in
+*	enum log_codes, written with --event-log and read back with ssdecode.
+*
+*	Each thread appends to its own segment files, named
+*	DIR/events.PID.THREAD.SEQ, which are mapped into memory, filled, and
+*	replaced by the next in sequence. A segment is an evlog_segment header
+*	followed by records, in the byte order of the machine that wrote them.
+*	A record is an evlog_record header followed by its arguments, which are
+*	laid out as log_args[] says:
+*
+*	    'p' - PROGRAM_NAME; not stored.
+*	    'd' - An int, as int32_t.
+*	    'z' - A size_t, as uint64_t.
+*	    'u' - An unsigned long long, as uint64_t.
+*	    's' - A string, as a uint16_t length and that many bytes.
+*	    'a' - A peer's address, a const struct sockaddr *, as a uint16_t
+*	          family, a uint16_t port and 16 bytes of address; it is
+*	          formatted only when the record is read.
+*
+*	and padded to a multiple of 8 bytes. A length of 0 marks the end of a
+*	segment that was not closed cleanly.
+*/
+#define EVLOG_MAGIC			"SSEV"
+#define EVLOG_VERSION		2
+#define EVLOG_ALIGN			8
+#define EVLOG_STR_MAX		1024	/* Longer strings are truncated. */
+#define EVLOG_MIN_SEGMENT	(64 * 1024)
+
+struct evlog_segment {
+    char magic[4];
+    uint16_t version;
+    uint16_t order;             /* 0x0102, to tell the byte order by. */
+    uint32_t thread;
+    uint32_t seq;
+    int64_t wall_ns;            /* CLOCK_REALTIME when it was opened, */
+    int64_t mono_ns;            /* and CLOCK_MONOTONIC at the same moment. */
+};
+
+struct evlog_record {
+    uint32_t len;               /* In bytes, header and padding included. */
+    uint16_t code;              /* An enum log_codes. */
+    uint16_t reserved;
+    int64_t mono_ns;            /* CLOCK_MONOTONIC when it was logged. */
+};
+
+/*
+*	An argument, decoded. 'p', 's' and 'a' arguments are in s and len.
+*/
+struct evlog_arg {
+    char type;
+    union {
+        long long i;
+        unsigned long long u;
+        struct {
+            const char *s;
+            uint16_t len;
+        };
+    };
+    char addr[64];              /* An 'a' argument, formatted. */
+};
+
+/*
+*	What arguments each event has, and its name, by enum log_codes.
+*/
+extern const char *const log_args[];
+extern const char *const log_names[];
+
+/**
+*	\brief	Sends the events of every thread to segment files of size bytes
+*			in dir, which is created if need be, rather than to log_fp.
+*	\return	0 on success, or -1 on failure.
+*/
+int evlog_open (const char *dir, size_t size);
+
+/**
+*	\brief	Logs an event with the arguments log_args[code] lists: in binary,
+*			if evlog_open() was called, or as text otherwise. The text is
+*			formatted by the log's writer thread, not the caller.
+*/
+void log_event (enum log_codes code, ...);
+
+/**
+*	\brief	Encodes a record of code, with the arguments in ap, into rec,
+*			truncating strings so that it fits in size bytes. size must
+*			leave room for every argument besides.
+*	\return	The length of the record.
+*/
+size_t evlog_encode (char *rec, size_t size, enum log_codes code, va_list ap);
+
+/**
+*	\brief	Decodes up to max of a record's arguments, which must have a
+*			valid code.
+*	\return	How many there are, or -1 if they overrun the record.
+*/
+int evlog_decode (const char *rec, struct evlog_arg args[], int max);
+
+/**
+*	\brief	Formats code's template with args, as text.
+*/
+void evlog_render (char *buf, size_t size, enum log_codes code,
+                   const struct evlog_arg args[], int n_args);
+
+/**
+*	\brief	Closes the calling thread's segment, trimmed to what was used.
+*/
+void evlog_detach (void);
+
+#endif /* EVLOG_H */
@@ -0,0 +1,90 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+
+/*
+*	The binary protocol, next to the line protocol every client starts in.
+*
+*	A client asks for it by sending FRAME_MAGIC as its very first bytes.
+*	The server answers with a FRAME_HELLO, and from then on both sides
+*	send frames: an 8-byte header in network byte order, followed by
+*	length bytes of payload that are never looked at.
+*
+*	    0        4      5       6      8
+*	    | length | type | flags | room | payload ...
+*
+*	Line clients are sent the payload of each FRAME_DATA frame as is, and
+*	what line clients send reaches binary clients as FRAME_DATA frames.
+*	Messages sent before the server saw the magic may arrive unframed.
+*
+*	room numbers the room a FRAME_DATA frame is sent to, or came from (see
+*	room.h). Clients learn the numbers from FRAME_JOINED and FRAME_ROOMS.
+*	Line clients speak into the room they joined last, and send commands
+*	as lines starting with a slash: "/join NAME", "/leave [NAME]" and "/list"
+*	become FRAME_JOIN, FRAME_LEAVE and FRAME_LIST, and are answered with
+*	text lines starting with "* ".
+*
+*	A binary client may ask for what is relayed to it to come compressed
+*	(see compress.h): FRAME_DATA frames with FRAME_F_DEFLATE set carry
+*	their payload in the zlib format.
+*/
+#define FRAME_MAGIC		"\0SSB"
+#define FRAME_MAGIC_LEN	4
+#define FRAME_HDR_LEN	8
+
+enum frame_type {
+    FRAME_DATA = 1,             /* Chat payload, relayed to the room. */
+    FRAME_HELLO,                /* Server: frames are on. */
+    FRAME_PING,                 /* Either side: answered with a FRAME_PONG. */
+    FRAME_PONG,
+    FRAME_JOIN,                 /* Client: join the room the payload names. */
+    FRAME_LEAVE,                /* Client: leave the room the payload names,
+                                   or if there is none, room. */
+    FRAME_LIST,                 /* Client: answered with a FRAME_ROOMS. */
+    FRAME_JOINED,               /* Server: room joined, payload its name. */
+    FRAME_LEFT,                 /* Server: room left, payload its name. */
+    FRAME_ROOMS,                /* Server: "NUMBER NAME MEMBERS\n" per room. */
+    FRAME_ERROR,                /* Server: a command failed; payload says why. */
+    FRAME_COMPRESS              /* Client: compress what is relayed to me
+                                   with the codec the payload names, or none
+                                   if it is empty. Server: the codec it will
+                                   use, or none. */
+};
+
+/*
+*	Flags.
+*/
+#define FRAME_F_DEFLATE	0x01    /* FRAME_DATA: the payload is compressed. */
+
+struct frame {
+    uint32_t length;            /* Bytes of payload. */
+    uint8_t type;
+    uint8_t flags;              /* FRAME_F_*, from the server; sent as 0. */
+    uint16_t room;
+};
+
+static inline void frame_encode (unsigned char hdr[FRAME_HDR_LEN],
+                                 const struct frame *f)
+{
+    hdr[0] = (unsigned char) (f->length >> 24);
+    hdr[1] = (unsigned char) (f->length >> 16);
+    hdr[2] = (unsigned char) (f->length >> 8);
+    hdr[3] = (unsigned char) f->length;
+    hdr[4] = f->type;
+    hdr[5] = f->flags;
+    hdr[6] = (unsigned char) (f->room >> 8);
+    hdr[7] = (unsigned char) f->room;
+}
+
+static inline void frame_decode (const unsigned char hdr[FRAME_HDR_LEN],
+                                 struct frame *f)
+{
+    f->length = (uint32_t) hdr[0] << 24 | (uint32_t) hdr[1] << 16
+        | (uint32_t) hdr[2] << 8 | hdr[3];
+    f->type = hdr[4];
+    f->flags = hdr[5];
+    f->room = (uint16_t) (hdr[6] << 8 | hdr[7]);
+}
+
+#endif /* FRAME_H */
@@ -0,0 +1,338 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "history.h"
+#include "config.h"
+#include "frame.h"
+#include "room.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+*	A room's ring. Reactors append to it as their clients speak, and copy
+*	it out as clients join, under its lock: both are a memcpy() or two.
+*/
+struct history {
+    pthread_mutex_t lock;
+    struct history_file *hdr;   /* At the start of the mapping, */
+    char *ring;                 /* and hdr->size bytes just past it. */
+    size_t map_len;
+};
+
+static const char *history_dir;
+
+/*
+*	Rings are set up once per room, under open_lock, and never moved until
+*	history_close().
+*/
+static pthread_mutex_t open_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic (struct history *) histories[ROOM_MAX];
+
+static int enabled (void)
+{
+    return cfg.history_messages > 0;
+}
+
+/**
+*	\brief	Copies n bytes from the ring, starting off bytes into it.
+*/
+static void ring_read (const struct history *h, uint64_t off, void *dst,
+                       size_t n)
+{
+    const size_t first = n < h->hdr->size - off
+        ? n : (size_t) (h->hdr->size - off);
+
+    memcpy (dst, h->ring + off, first);
+    memcpy ((char *) dst + first, h->ring, n - first);
+}
+
+static void ring_write (struct history *h, uint64_t off, const void *src,
+                        size_t n)
+{
+    const size_t first = n < h->hdr->size - off
+        ? n : (size_t) (h->hdr->size - off);
+
+    memcpy (h->ring + off, src, first);
+    memcpy (h->ring, (const char *) src + first, n - first);
+}
+
+/**
+*	\return	The header of the message at off, and its length in ring_len.
+*/
+static struct frame frame_at (const struct history *h, uint64_t off,
+                              uint64_t *ring_len)
+{
+    unsigned char hdr[FRAME_HDR_LEN];
+    struct frame f;
+
+    ring_read (h, off, hdr, sizeof hdr);
+    frame_decode (hdr, &f);
+    *ring_len = FRAME_HDR_LEN + (uint64_t) f.length;
+    return f;
+}
+
+/**
+*	\return	Whether h's header describes a ring of the configured size
+*			that holds whole frames, as one left by an earlier run should.
+*/
+static int ring_valid (const struct history *h)
+{
+    const struct history_file *const f = h->hdr;
+
+    if (memcmp (f->magic, HISTORY_MAGIC, sizeof f->magic)
+        || f->size != cfg.history_size || f->head >= f->size
+        || f->used > f->size) {
+        return 0;
+    }
+
+    uint64_t off = f->head;
+    uint64_t left = f->used;
+
+    for (uint64_t i = 0; i < f->count; i++) {
+        uint64_t len;
+
+        if (left < FRAME_HDR_LEN
+            || frame_at (h, off, &len).type != FRAME_DATA || len > left) {
+            return 0;
+        }
+        left -= len;
+        off = (off + len) % f->size;
+    }
+    return !left;
+}
+
+/**
+*	\brief	Maps room's file, creating it if need be.
+*	\return	The mapping, or MAP_FAILED on failure.
+*/
+static void *map_file (int room, size_t map_len)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *const name = room_name (room);
+    char path[4096];
+    int len = snprintf (path, sizeof path, "%s/", history_dir);
+
+    for (const char *p = name; *p && len + 2 < (int) sizeof path; p++) {
+        path[len++] = hex[(unsigned char) *p >> 4];
+        path[len++] = hex[(unsigned char) *p & 0xF];
+    }
+    snprintf (path + len, sizeof path - (size_t) len, ".hist");
+
+    const int fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+
+    if (fd == -1) {
+        perror ("open()");
+        return MAP_FAILED;
+    }
+    if (fstat (fd, &st) == -1
+        || ((size_t) st.st_size != map_len
+            && ftruncate (fd, (off_t) map_len) == -1)) {
+        perror ("ftruncate()");
+        close (fd);
+        return MAP_FAILED;
+    }
+
+    void *const map = mmap (0, map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                            fd, 0);
+
+    if (map == MAP_FAILED) {
+        perror ("mmap()");
+    }
+    close (fd);
+    return map;
+}
+
+/**
+*	\brief	Sets up room's ring, from its file if there is one. If the file
+*			cannot be used, the ring is kept in memory instead.
+*	\return	The ring, or NULL if the system is out of memory.
+*/
+static struct history *open_ring (int room)
+{
+    struct history *const h = malloc (sizeof *h);
+    const size_t map_len = sizeof *h->hdr + cfg.history_size;
+    void *map = MAP_FAILED;
+
+    if (!h) {
+        perror ("malloc()");
+        return 0;
+    }
+    if (history_dir) {
+        map = map_file (room, map_len);
+    }
+    if (map == MAP_FAILED
+        && (map = mmap (0, map_len, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+        perror ("mmap()");
+        free (h);
+        return 0;
+    }
+    pthread_mutex_init (&h->lock, 0);
+    h->hdr = map;
+    h->ring = (char *) map + sizeof *h->hdr;
+    h->map_len = map_len;
+
+    if (!ring_valid (h)) {
+        *h->hdr = (struct history_file) {.size = cfg.history_size };
+        memcpy (h->hdr->magic, HISTORY_MAGIC, sizeof h->hdr->magic);
+    }
+    return h;
+}
+
+/**
+*	\return	room's ring, set up if it has not been, or NULL if it cannot be.
+*/
+static struct history *get_ring (int room)
+{
+    struct history *h = atomic_load_explicit (&histories[room],
+                                              memory_order_acquire);
+
+    if (h) {
+        return h;
+    }
+    pthread_mutex_lock (&open_lock);
+
+    if (!(h = atomic_load_explicit (&histories[room],
+                                    memory_order_relaxed))
+        && (h = open_ring (room))) {
+        atomic_store_explicit (&histories[room], h, memory_order_release);
+    }
+    pthread_mutex_unlock (&open_lock);
+    return h;
+}
+
+int history_open (const char *dir)
+{
+    if (dir && mkdir (dir, 0755) == -1 && errno != EEXIST) {
+        perror ("mkdir()");
+        return -1;
+    }
+    history_dir = dir;
+    return 0;
+}
+
+void history_close (void)
+{
+    for (int i = 0; i < ROOM_MAX; i++) {
+        struct history *const h = atomic_exchange (&histories[i], 0);
+
+        if (h) {
+            munmap (h->hdr, h->map_len);
+            pthread_mutex_destroy (&h->lock);
+            free (h);
+        }
+    }
+}
+
+/**
+*	\brief	Forgets the oldest message. The caller holds the lock.
+*/
+static void drop_oldest (struct history *h)
+{
+    struct history_file *const f = h->hdr;
+    uint64_t len;
+
+    frame_at (h, f->head, &len);
+    f->head = (f->head + len) % f->size;
+    f->used -= len;
+    f->count--;
+}
+
+void history_add (int room, const struct msgbuf *msg)
+{
+    struct history *h;
+
+    if (!enabled () || msg->len > cfg.history_size
+        || !(h = get_ring (room))) {
+        return;
+    }
+    pthread_mutex_lock (&h->lock);
+
+    struct history_file *const f = h->hdr;
+
+    while (f->count && (f->count >= (uint64_t) cfg.history_messages
+                        || f->used + msg->len > f->size)) {
+        drop_oldest (h);
+    }
+    /*
+     * The message goes in before the header says it is there, so that a
+     * file left by a crash is at worst one message short, or fails
+     * ring_valid() and is started afresh.
+     */
+    ring_write (h, (f->head + f->used) % f->size, msg->data, msg->len);
+    f->used += msg->len;
+    f->count++;
+
+    pthread_mutex_unlock (&h->lock);
+}
+
+int history_replay (int room, int framed, struct msgbuf **out)
+{
+    struct history *h;
+
+    *out = 0;
+
+    if (!enabled () || !(h = get_ring (room))) {
+        return 0;
+    }
+    pthread_mutex_lock (&h->lock);
+
+    const struct history_file *const f = h->hdr;
+    struct msgbuf *const m = f->count ? msgbuf_alloc (FRAME_HDR_LEN + f->used)
+        : 0;
+
+    if (!m) {
+        pthread_mutex_unlock (&h->lock);
+        return f->count ? -1 : 0;
+    }
+
+    /*
+     * A file from a run with a larger limit may hold more than we keep.
+     */
+    const uint64_t skip = f->count > (uint64_t) cfg.history_messages
+        ? f->count - (uint64_t) cfg.history_messages : 0;
+    uint64_t off = f->head;
+    size_t len = framed ? 0 : FRAME_HDR_LEN;
+
+    for (uint64_t i = 0; i < f->count; i++) {
+        uint64_t ring_len;
+        struct frame fr = frame_at (h, off, &ring_len);
+
+        if (i >= skip) {
+            /*
+             * The room may have had another number when it was said.
+             */
+            if (framed) {
+                fr.room = (uint16_t) room;
+                frame_encode ((unsigned char *) m->data + len, &fr);
+                len += FRAME_HDR_LEN;
+            }
+            ring_read (h, (off + FRAME_HDR_LEN) % f->size, m->data + len,
+                       fr.length);
+            len += fr.length;
+        }
+        off = (off + ring_len) % f->size;
+    }
+    pthread_mutex_unlock (&h->lock);
+
+    if (!framed) {
+        frame_encode ((unsigned char *) m->data, &(struct frame) {
+                      .length = (uint32_t) (len - FRAME_HDR_LEN),
+                      .type = FRAME_DATA,.room = (uint16_t) room}
+        );
+    }
+    m->len = len;
+    *out = m;
+    return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "msgbuf.h"
+
+#include <stdint.h>
+
+/*
+*	What was said last in each room, for clients that join it later.
+*
+*	Each room has a ring of fixed size, shared by every reactor, holding
+*	the last cfg.history_messages messages relayed to it, or as many as fit
+*	in cfg.history_size bytes, framed as they were relayed. A ring is set
+*	up the first time its room is spoken in or joined. With a directory,
+*	it is a file there, mapped into memory, so that it outlives the
+*	process and is simply mapped again on the next start; without one, it
+*	is anonymous memory.
+*
+*	A file is a history_file header followed by the ring. It is named
+*	after the room, in hex, and is started afresh if its header does not
+*	describe a ring of the configured size that holds whole frames.
+*/
+#define HISTORY_MAGIC	"SSHIST1"
+
+struct history_file {
+    char magic[8];
+    uint64_t size;              /* Bytes in the ring. */
+    uint64_t head;              /* Where the oldest message starts. */
+    uint64_t used;              /* Bytes of messages from there on. */
+    uint64_t count;             /* Messages. */
+};
+
+/**
+*	\brief	Keeps the histories in files in dir, or in memory if it is NULL.
+*	\return	0 on success, or -1 if dir cannot be made.
+*/
+int history_open (const char *dir);
+
+/**
+*	\brief	Unmaps every ring. The reactors must have stopped.
+*/
+void history_close (void);
+
+/**
+*	\brief	Remembers msg, a framed message, as the latest said in room,
+*			forgetting the oldest to make room. A message larger than the
+*			ring is not kept.
+*/
+void history_add (int room, const struct msgbuf *msg);
+
+/**
+*	\brief	Copies what room remembers into one message: the frames as they
+*			are if framed is set, or else one frame holding just their
+*			payloads, for a line client.
+*	\param	out - To store the message, or NULL if there is nothing to send.
+*	\return	0 on success, or -1 if the system is out of memory.
+*/
+int history_replay (int room, int framed, struct msgbuf **out);
+
+#endif /* HISTORY_H */
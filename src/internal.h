@@ -25,8 +25,7 @@
 #define NI_MAXSERV 32
 #endif
 
-#define LOG_MSG(stream, msg, flags) log_msg (stream, msg, flags); \
-											log_msg (0, msg, flags)
+#define LOG_MSG(stream, msg, flags) log_post (stream, msg, flags)
 
 extern FILE *log_fp;
 extern int pfds[2];
@@ -41,7 +40,22 @@ enum log_codes {
     SS_OVERLOAD,
     SS_SOCKET_ERROR,
     SS_FCLOSE_ERROR,
-    SS_INITIATE
+    SS_INITIATE,
+    SS_SLOW_CONSUMER,
+    SS_LINE_TOO_LONG,
+    SS_BAD_FRAME,
+    SS_POOL_STATS,
+    SS_LOG_DROPPED,
+    SS_SHEDDING,
+    SS_RECOVERED,
+    SS_IDLE_TIMEOUT,
+    SS_HANDSHAKE_TIMEOUT,
+    SS_TLS_FAILED,
+    SS_UPGRADE_STARTED,
+    SS_UPGRADE_FAILED,
+    SS_HANDED_OVER,
+    SS_TOOK_OVER,
+    SS_N_CODES
 };
 
 #endif /* INTERNAL_H */
@@ -0,0 +1,504 @@
+#ifdef _POSIX_C_SOURCE
+#undef _POSIX_C_SOURCE
+#endif
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "journal.h"
+#include "config.h"
+#include "metrics.h"
+#include "room.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define JOURNAL_RING_LEN 16384  /* Messages; a power of 2. */
+
+/*
+*	A message waiting for the writer. seq works as in the log's ring:
+*	the position a producer may claim the slot at, and one past that once
+*	it is filled in.
+*/
+struct journal_entry {
+    atomic_size_t seq;
+    struct msgbuf *msg;
+    int room;
+    struct client_addr from;
+    long long when;             /* CLOCK_MONOTONIC, in ns. */
+};
+
+static struct {
+    struct journal_entry entries[JOURNAL_RING_LEN];
+    atomic_size_t enqueue;      /* Next position to claim. */
+    size_t dequeue;             /* Next position to stage; the writer's. */
+    atomic_bool running;
+    atomic_bool stopping;
+    atomic_bool sleeping;       /* The writer is, or is about to be. */
+    pthread_mutex_t lock;       /* Only for sleeping and waking. */
+    pthread_cond_t wake;
+    pthread_t thread;
+
+    /*
+     * The rest is the writer's.
+     */
+    const char *dir;
+    int fd;                     /* The current segment, or -1. */
+    uint32_t seq;               /* Of the next segment. */
+    size_t used;                /* Bytes committed to the current segment. */
+    char *stage;                /* Records gathered for the next commit. */
+    size_t staged;
+    size_t stage_cap;
+    long long *times;           /* When each of them was relayed. */
+    size_t n_times;
+    size_t times_cap;
+    int64_t wall0;              /* CLOCK_REALTIME at mono0, */
+    long long mono0;            /* to tell the time of a message by. */
+} jr = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int64_t wall_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_REALTIME, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+*	\brief	Writes len bytes at off, in spite of short writes.
+*	\return	0 on success, or -1 on failure.
+*/
+static int write_at (int fd, const char *buf, size_t len, size_t off)
+{
+    while (len) {
+        const ssize_t n = pwrite (fd, buf, len, (off_t) off);
+
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t) n;
+        off += (size_t) n;
+    }
+    return 0;
+}
+
+/**
+*	\brief	Trims the current segment to what was used, and closes it.
+*/
+static void close_segment (void)
+{
+    if (jr.fd == -1) {
+        return;
+    }
+    if (ftruncate (jr.fd, (off_t) jr.used) == -1) {
+        perror ("ftruncate()");
+    } else if (fdatasync (jr.fd) == -1) {
+        perror ("fdatasync()");
+    }
+    close (jr.fd);
+    jr.fd = -1;
+}
+
+/**
+*	\brief	Starts the next segment, with its space allocated up front so
+*			that a commit does not also have to grow the file.
+*	\return	0 on success, or -1 on failure.
+*/
+static int open_segment (void)
+{
+    char path[4096];
+
+    close_segment ();
+    snprintf (path, sizeof path, "%s/journal.%ld.%u", jr.dir,
+              (long) getpid (), jr.seq++);
+
+    if ((jr.fd = open (path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                       0644)) == -1) {
+        perror ("open()");
+        return -1;
+    }
+
+    const int err = posix_fallocate (jr.fd, 0,
+                                     (off_t) cfg.journal_segment_size);
+
+    if (err && ((err != EOPNOTSUPP && err != EINVAL)
+                || ftruncate (jr.fd, (off_t) cfg.journal_segment_size)
+                == -1)) {
+        errno = err;
+        perror ("posix_fallocate()");
+        close (jr.fd);
+        jr.fd = -1;
+        return -1;
+    }
+
+    struct journal_segment hdr = {
+        .magic = JOURNAL_MAGIC,
+        .version = JOURNAL_VERSION,
+        .order = 0x0102,
+        .seq = jr.seq - 1,
+        .wall_ns = wall_now (),
+    };
+
+    if (write_at (jr.fd, (const char *) &hdr, sizeof hdr, 0) == -1) {
+        perror ("pwrite()");
+        close (jr.fd);
+        jr.fd = -1;
+        return -1;
+    }
+    jr.used = sizeof hdr;
+
+    /*
+     * The new file's name has to be on disk too.
+     */
+    const int dir_fd = open (jr.dir, O_RDONLY | O_CLOEXEC);
+
+    if (dir_fd == -1 || fsync (dir_fd) == -1) {
+        perror ("fsync()");
+    }
+    if (dir_fd != -1) {
+        close (dir_fd);
+    }
+    return 0;
+}
+
+/**
+*	\brief	Writes what has been staged, and waits for it to reach the disk.
+*/
+static void commit (void)
+{
+    if (!jr.staged) {
+        return;
+    }
+    if (jr.fd == -1) {
+        open_segment ();
+    }
+    if (jr.fd == -1) {
+        metric_add (M_JOURNAL_FAILED, jr.n_times);
+    } else if (write_at (jr.fd, jr.stage, jr.staged, jr.used) == -1) {
+        perror ("pwrite()");
+        metric_add (M_JOURNAL_FAILED, jr.n_times);
+    } else if (fdatasync (jr.fd) == -1) {
+        perror ("fdatasync()");
+        metric_add (M_JOURNAL_FAILED, jr.n_times);
+    } else {
+        const long long now = metrics_now ();
+
+        jr.used += jr.staged;
+        metric_add (M_JOURNAL_BYTES, jr.staged);
+        metric_add (M_JOURNAL_COMMITS, 1);
+
+        for (size_t i = 0; i < jr.n_times; i++) {
+            metric_observe (H_JOURNAL_LAG, now - jr.times[i]);
+        }
+    }
+    jr.staged = 0;
+    jr.n_times = 0;
+}
+
+/*
+*	FNV-1a.
+*/
+static uint32_t check (const char *p, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char) p[i]) * 16777619u;
+    }
+    return h;
+}
+
+/**
+*	\brief	Adds e's message to what is to be committed next, committing
+*			what is already there first if the segment would overflow.
+*	\return	0 on success, or -1 if the system is out of memory.
+*/
+static int stage (const struct journal_entry *e)
+{
+    const char *const name = room_name (e->room);
+    const size_t name_len = strlen (name);
+    const size_t raw = sizeof (struct journal_record) + name_len
+        + e->msg->len;
+    const size_t len = (raw + JOURNAL_ALIGN - 1) & ~(size_t) (JOURNAL_ALIGN
+                                                               - 1);
+
+    if (jr.used + jr.staged + len > cfg.journal_segment_size
+        && jr.used + jr.staged > sizeof (struct journal_segment)) {
+        commit ();
+        open_segment ();
+    }
+    if (jr.staged + len > jr.stage_cap) {
+        const size_t cap = jr.staged + len > 2 * jr.stage_cap
+            ? jr.staged + len : 2 * jr.stage_cap;
+        char *const p = realloc (jr.stage, cap);
+
+        if (!p) {
+            return -1;
+        }
+        jr.stage = p;
+        jr.stage_cap = cap;
+    }
+    if (jr.n_times == jr.times_cap) {
+        const size_t cap = jr.times_cap ? 2 * jr.times_cap : 1024;
+        long long *const p = realloc (jr.times, cap * sizeof *p);
+
+        if (!p) {
+            return -1;
+        }
+        jr.times = p;
+        jr.times_cap = cap;
+    }
+
+    char *const rec = jr.stage + jr.staged;
+    struct journal_record hdr = {
+        .len = (uint32_t) len,
+        .wall_ns = jr.wall0 + (e->when - jr.mono0),
+        .from = e->from,
+        .name_len = (uint8_t) name_len,
+        .msg_len = (uint32_t) e->msg->len,
+    };
+
+    memcpy (rec + sizeof hdr, name, name_len);
+    memcpy (rec + sizeof hdr + name_len, e->msg->data, e->msg->len);
+    memset (rec + raw, 0, len - raw);
+
+    /*
+     * hdr is copied in twice, as the check covers most of it.
+     */
+    memcpy (rec, &hdr, sizeof hdr);
+    hdr.check = check (rec + offsetof (struct journal_record, wall_ns),
+                       len - offsetof (struct journal_record, wall_ns));
+    memcpy (rec, &hdr, sizeof hdr);
+
+    jr.staged += len;
+    jr.times[jr.n_times++] = e->when;
+    return 0;
+}
+
+static int ready (void)
+{
+    const struct journal_entry *const e =
+        &jr.entries[jr.dequeue & (JOURNAL_RING_LEN - 1)];
+
+    return atomic_load (&e->seq) == jr.dequeue + 1;
+}
+
+/**
+*	\brief	Stages what the reactors have queued, up to a group's worth.
+*/
+static void gather (void)
+{
+    while (jr.staged < cfg.journal_group && ready ()) {
+        struct journal_entry *const e =
+            &jr.entries[jr.dequeue & (JOURNAL_RING_LEN - 1)];
+
+        if (stage (e) == -1) {
+            perror ("realloc()");
+            metric_add (M_JOURNAL_FAILED, 1);
+        }
+        msgbuf_put (e->msg);
+
+        /*
+         * Hand the slot back to producers, a lap ahead.
+         */
+        atomic_store_explicit (&e->seq, jr.dequeue + JOURNAL_RING_LEN,
+                               memory_order_release);
+        jr.dequeue++;
+    }
+}
+
+/**
+*	\brief	Sleeps until a reactor queues something or, while a group is
+*			open, until deadline, a CLOCK_MONOTONIC time in nanoseconds.
+*/
+static void wait_for_work (long long deadline)
+{
+    pthread_mutex_lock (&jr.lock);
+
+    /*
+     * Producers only take the lock to wake us if they see sleeping set,
+     * which is why the ring is checked once more after setting it. While
+     * a group is open, it is not set: the reactors do not wake us for
+     * every message then, only if they find the ring full.
+     */
+    if (!deadline) {
+        atomic_store (&jr.sleeping, 1);
+    }
+    if ((deadline || !ready ()) && !atomic_load (&jr.stopping)) {
+        if (deadline) {
+            const struct timespec ts = {
+                .tv_sec = (time_t) (deadline / 1000000000),
+                .tv_nsec = (long) (deadline % 1000000000),
+            };
+
+            pthread_cond_timedwait (&jr.wake, &jr.lock, &ts);
+        } else {
+            pthread_cond_wait (&jr.wake, &jr.lock);
+        }
+    }
+    atomic_store (&jr.sleeping, 0);
+    pthread_mutex_unlock (&jr.lock);
+}
+
+static void *writer_main (void *arg)
+{
+    (void) arg;
+
+    for (;;) {
+        gather ();
+
+        /*
+         * A group is due once its oldest message has waited long enough.
+         */
+        const long long deadline = jr.staged
+            ? jr.times[0] + (long long) cfg.journal_interval * 1000000 : 0;
+
+        if (jr.staged && (jr.staged >= cfg.journal_group
+                          || metrics_now () >= deadline
+                          || atomic_load (&jr.stopping))) {
+            commit ();
+            continue;
+        }
+        if (!jr.staged && !ready () && atomic_load (&jr.stopping)) {
+            break;
+        }
+        wait_for_work (deadline);
+    }
+    close_segment ();
+    msgbuf_drain ();
+    return 0;
+}
+
+int journal_open (const char *dir)
+{
+    if (mkdir (dir, 0755) == -1 && errno != EEXIST) {
+        perror ("mkdir()");
+        return -1;
+    }
+    for (size_t i = 0; i < JOURNAL_RING_LEN; i++) {
+        atomic_init (&jr.entries[i].seq, i);
+    }
+    jr.dir = dir;
+    jr.fd = -1;
+    jr.wall0 = wall_now ();
+    jr.mono0 = metrics_now ();
+
+    pthread_condattr_t attr;
+
+    pthread_condattr_init (&attr);
+    pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+    pthread_cond_init (&jr.wake, &attr);
+    pthread_condattr_destroy (&attr);
+
+    if (open_segment () == -1) {
+        return -1;
+    }
+
+    const int err = pthread_create (&jr.thread, 0, writer_main, 0);
+
+    if (err) {
+        errno = err;
+        perror ("pthread_create()");
+        close_segment ();
+        return -1;
+    }
+    atomic_store (&jr.running, 1);
+    return 0;
+}
+
+void journal_close (void)
+{
+    if (!atomic_exchange (&jr.running, 0)) {
+        return;
+    }
+    pthread_mutex_lock (&jr.lock);
+    atomic_store (&jr.stopping, 1);
+    pthread_cond_signal (&jr.wake);
+    pthread_mutex_unlock (&jr.lock);
+    pthread_join (jr.thread, 0);
+    free (jr.stage);
+    free (jr.times);
+}
+
+static void wake_writer (void)
+{
+    pthread_mutex_lock (&jr.lock);
+    pthread_cond_signal (&jr.wake);
+    pthread_mutex_unlock (&jr.lock);
+}
+
+/**
+*	\brief	Claims the next slot of the ring, waiting for the writer if it
+*			is a whole ring behind: the journal must not lose messages.
+*	\return	The slot, to be filled and then published at pos + 1.
+*/
+static struct journal_entry *claim (size_t *pos)
+{
+    size_t p = atomic_load_explicit (&jr.enqueue, memory_order_relaxed);
+    int stalled = 0;
+
+    for (;;) {
+        struct journal_entry *const e =
+            &jr.entries[p & (JOURNAL_RING_LEN - 1)];
+        const size_t seq = atomic_load_explicit (&e->seq,
+                                                 memory_order_acquire);
+        const intptr_t dif = (intptr_t) seq - (intptr_t) p;
+
+        if (!dif) {
+            if (atomic_compare_exchange_weak_explicit (&jr.enqueue, &p,
+                                                       p + 1,
+                                                       memory_order_relaxed,
+                                                       memory_order_relaxed))
+            {
+                *pos = p;
+                return e;
+            }
+        } else if (dif < 0) {
+            if (!stalled) {
+                stalled = 1;
+                metric_add (M_JOURNAL_STALLS, 1);
+                wake_writer ();
+            }
+            sched_yield ();
+            p = atomic_load_explicit (&jr.enqueue, memory_order_relaxed);
+        } else {
+            p = atomic_load_explicit (&jr.enqueue, memory_order_relaxed);
+        }
+    }
+}
+
+void journal_append (int room, struct msgbuf *msg,
+                     const struct client_addr *from, long long now)
+{
+    if (!atomic_load_explicit (&jr.running, memory_order_relaxed)) {
+        return;
+    }
+
+    size_t pos;
+    struct journal_entry *const e = claim (&pos);
+
+    e->msg = msgbuf_get (msg);
+    e->room = room;
+    e->from = *from;
+    e->when = now;
+    atomic_store (&e->seq, pos + 1);
+
+    if (atomic_load (&jr.sleeping) && atomic_exchange (&jr.sleeping, 0)) {
+        wake_writer ();
+    }
+}
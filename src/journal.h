@@ -0,0 +1,74 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "addrmap.h"
+#include "msgbuf.h"
+
+#include <stdint.h>
+
+/*
+*	The message journal: every message relayed, kept on disk, written
+*	with --journal.
+*
+*	Reactors hand messages to a thread of its own by reference, through
+*	a bounded ring, and never wait on the disk unless the ring is full.
+*	The writer gathers whatever has arrived into one write and one
+*	fdatasync() per group: a message waits at most cfg.journal_interval
+*	milliseconds for others to share its commit, and a group is at most
+*	cfg.journal_group bytes.
+*
+*	Segments are named DIR/journal.PID.SEQ, preallocated at
+*	cfg.journal_segment_size bytes, and trimmed to what was used when the
+*	next is started. A segment is a journal_segment header followed by
+*	records, in the byte order of the machine that wrote them. A record is
+*	a journal_record header, the name of the room, and the message as
+*	relayed, frame header and all, padded to a multiple of 8 bytes. A
+*	length of 0 marks the end of a segment that was not closed cleanly,
+*	and a record whose check does not match was not committed.
+*/
+#define JOURNAL_MAGIC		"SSJL"
+#define JOURNAL_VERSION		1
+#define JOURNAL_ALIGN		8
+#define JOURNAL_MIN_SEGMENT	(64 * 1024)
+
+struct journal_segment {
+    char magic[4];
+    uint16_t version;
+    uint16_t order;             /* 0x0102, to tell the byte order by. */
+    uint32_t seq;
+    uint32_t reserved;
+    int64_t wall_ns;            /* CLOCK_REALTIME when it was opened. */
+};
+
+struct journal_record {
+    uint32_t len;               /* In bytes, header and padding included. */
+    uint32_t check;             /* FNV-1a of the bytes after it. */
+    int64_t wall_ns;            /* CLOCK_REALTIME when it was relayed. */
+    struct client_addr from;    /* The sender's address. */
+    uint8_t name_len;           /* Bytes of room name. */
+    uint8_t reserved;
+    uint32_t msg_len;           /* Bytes of message. */
+};
+
+/**
+*	\brief	Starts journalling to segments in dir, which is made if need be.
+*	\return	0 on success, or -1 on failure.
+*/
+int journal_open (const char *dir);
+
+/**
+*	\brief	Commits whatever is still queued, and stops the writer.
+*/
+void journal_close (void);
+
+/**
+*	\brief	Queues msg, a framed message relayed to room, for the journal,
+*			taking a reference to it. Does nothing if there is no journal.
+*			Waits, and counts a stall, only if the writer is a whole ring
+*			behind.
+*	\param	now - When it was relayed: CLOCK_MONOTONIC, in nanoseconds.
+*/
+void journal_append (int room, struct msgbuf *msg,
+                     const struct client_addr *from, long long now);
+
+#endif /* JOURNAL_H */
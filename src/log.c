@@ -2,20 +2,136 @@
 *	@file	log.c
 *
 *	@brief	The implementation of the logging function.
-*	
+*
 *	@author	Haris Salam
-*	
+*
 *	@date	Tuesday, 2 February, 2023
-*	
+*
 *	@bug	No known bugs.
 */
 
+#ifdef _POSIX_C_SOURCE
+#undef _POSIX_C_SOURCE
+#endif
+
+#define _POSIX_C_SOURCE 200809L
+
 #include "log.h"
+#include "evlog.h"
+#include "internal.h"
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <time.h>
+#include <unistd.h>
 
 #define TS_BUF_LENGTH 50
+#define LOG_RING_LEN 4096       /* Records; a power of 2. */
+#define LOG_ENTRY_MAX LOG_RECORD_MAX    /* Longer messages are truncated. */
+#define LOG_BATCH_BYTES 65536   /* Written to stderr at a time. */
+
+/*
+*	One record waiting for the writer. seq says whose turn the slot is:
+*	it equals the position a producer may claim it at, and one past that
+*	once the record is ready to be written.
+*/
+struct log_entry {
+    atomic_size_t seq;
+    FILE *stream;
+    time_t when;
+    unsigned flags;
+    int record;                 /* msg is an event record, not text. */
+    alignas (8) char msg[LOG_ENTRY_MAX];
+};
+
+/*
+*	The date and time of one second, formatted once for every record
+*	logged in it.
+*/
+struct stamp {
+    time_t sec;
+    int valid;
+    char date[TS_BUF_LENGTH];
+    char time[TS_BUF_LENGTH];
+};
+
+/*
+*	A bounded ring that any thread may push to without a lock, and only
+*	the writer pops from. A full ring drops the record rather than wait.
+*/
+static struct {
+    struct log_entry entries[LOG_RING_LEN];
+    atomic_size_t enqueue;      /* Next position to claim. */
+    size_t dequeue;             /* Next position to write; the writer's. */
+    atomic_ullong dropped;
+    unsigned long long reported;        /* Drops logged so far. */
+    atomic_bool running;
+    atomic_bool stopping;
+    atomic_bool sleeping;       /* The writer is, or is about to be. */
+    pthread_mutex_t lock;       /* Only for sleeping and waking. */
+    pthread_cond_t wake;
+    pthread_t thread;
+} ring = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+static atomic_ullong log_count = 0;
+
+static void stamp_set (struct stamp *stamp, time_t when)
+{
+    struct tm tm_buf;
+
+    if (stamp->valid && stamp->sec == when) {
+        return;
+    }
+    stamp->sec = when;
+    stamp->valid = localtime_r (&when, &tm_buf)
+        && strftime (stamp->date, sizeof stamp->date, "%Y-%m-%dT", &tm_buf)
+        && strftime (stamp->time, sizeof stamp->time, "%H:%M:%S", &tm_buf);
+
+    if (!stamp->valid) {
+        perror ("localtime_r()");
+    }
+}
+
+/**
+*	\brief	Formats a record as log_msg() documents, newline included.
+*	\return	The length of the record, which may be more than size, in which
+*			case it was truncated.
+*/
+static size_t format_record (char *buf, size_t size, const char *msg,
+                             unsigned flags, const struct stamp *stamp)
+{
+    size_t n = 0;
+    int len = 0;
+
+#define APPEND(...) \
+    (len = snprintf (buf + (n < size ? n : size), n < size ? size - n : 0, \
+                     __VA_ARGS__), n += len > 0 ? (size_t) len : 0)
+
+    if (flags & LOG_COUNT) {
+        APPEND ("%llu, ", ++log_count);
+    }
+    if (flags & LOG_DATE && stamp->valid) {
+        APPEND ("%s", stamp->date);
+    }
+    if (flags & LOG_TIME && stamp->valid) {
+        APPEND ("%s, ", stamp->time);
+    }
+    if (msg) {
+        APPEND ("\"%s\"", msg);
+    }
+    APPEND ("\n");
+
+#undef APPEND
+    return n;
+}
 
 extern int log_msg (FILE *stream, const char *msg, unsigned flags)
 {
@@ -25,40 +141,339 @@ extern int log_msg (FILE *stream, const char *msg, unsigned flags)
         fp = stream;
     }
 
-    static unsigned long long log_count = 0;
-    char time_stamp[TS_BUF_LENGTH] = { 0 };
-    char date_stamp[TS_BUF_LENGTH] = { 0 };
-    const time_t time_val = flags & LOG_FULLTIME ? time (0) : 0;
+    struct stamp stamp = { 0 };
 
-    if (time_val == -1) {
-        perror ("time()");
+    if (flags & LOG_FULLTIME) {
+        const time_t time_val = time (0);
+
+        if (time_val == -1) {
+            perror ("time()");
+        } else {
+            stamp_set (&stamp, time_val);
+        }
     }
 
-    const struct tm *const tm_info =
-        flags & LOG_FULLTIME ? localtime (&time_val) : 0;
+    char log[BUFSIZ];
+    size_t len = format_record (log, sizeof log, msg, flags, &stamp);
 
-    if (!tm_info && flags & LOG_FULLTIME) {
-        perror ("time()");
+    if (len >= sizeof log) {
+        len = sizeof log - 1;
+        log[len - 1] = '\n';
     }
 
-    log_count++;
-    int n = 0;
-    char log[BUFSIZ];
+    const int n = (int) fwrite (log, 1, len, fp);
 
-    if (flags & LOG_COUNT) {
-        n += snprintf (log, sizeof log, "%lld, ", log_count);
+    return ferror (fp) ? -1 : n;
+}
+
+/**
+*	\brief	Writes len bytes to stderr, in spite of short writes.
+*/
+static void write_stderr (const char *buf, size_t len)
+{
+    while (len) {
+        const ssize_t n = write (STDERR_FILENO, buf, len);
+
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        buf += n;
+        len -= (size_t) n;
     }
-	if (flags & LOG_DATE && tm_info
-        && strftime (date_stamp, TS_BUF_LENGTH, "%Y-%m-%dT", tm_info)) {
-        n += snprintf (log + n, sizeof date_stamp, "%s", date_stamp);
+}
+
+/**
+*	\brief	Renders an event record as text.
+*/
+static void render_record (char *buf, size_t size, const char *rec)
+{
+    struct evlog_record hdr;
+    struct evlog_arg args[8];
+
+    memcpy (&hdr, rec, sizeof hdr);
+
+    const int n = evlog_decode (rec, args, 8);
+
+    evlog_render (buf, size, (enum log_codes) hdr.code, args, n < 0 ? 0 : n);
+}
+
+/**
+*	\brief	Writes whatever has been pushed so far: each record to its
+*			stream and to stderr, the latter gathered into one write() per
+*			LOG_BATCH_BYTES.
+*	\return	How many records were written.
+*/
+static size_t write_batch (struct stamp *stamp, char *out)
+{
+    size_t written = 0;
+    size_t len = 0;
+    FILE *last = 0;
+
+    for (;;) {
+        struct log_entry *const e =
+            &ring.entries[ring.dequeue & (LOG_RING_LEN - 1)];
+
+        if (atomic_load (&e->seq) != ring.dequeue + 1) {
+            break;
+        }
+        if (e->flags & LOG_FULLTIME) {
+            stamp_set (stamp, e->when);
+        }
+
+        char text[BUFSIZE];
+        char line[BUFSIZE + 2 * TS_BUF_LENGTH + 32];
+
+        if (e->record) {
+            render_record (text, sizeof text, e->msg);
+        }
+
+        size_t n = format_record (line, sizeof line,
+                                  e->record ? text : e->msg, e->flags, stamp);
+
+        if (n >= sizeof line) {
+            n = sizeof line - 1;
+            line[n - 1] = '\n';
+        }
+        if (e->stream && e->stream != stderr) {
+            fwrite (line, 1, n, e->stream);
+            last = e->stream;
+        }
+        if (len + n > LOG_BATCH_BYTES) {
+            write_stderr (out, len);
+            len = 0;
+        }
+        memcpy (out + len, line, n);
+        len += n;
+
+        /*
+         * Hand the slot back to producers, a lap ahead.
+         */
+        atomic_store_explicit (&e->seq, ring.dequeue + LOG_RING_LEN,
+                               memory_order_release);
+        ring.dequeue++;
+        written++;
     }
-    if (flags & LOG_TIME && tm_info
-        && strftime (time_stamp, TS_BUF_LENGTH, "%H:%M:%S", tm_info)) {
-        n += snprintf (log + n, sizeof time_stamp, "%s, ", time_stamp);
+    write_stderr (out, len);
+
+    if (last) {
+        fflush (last);
     }
-    if (msg) {
-        snprintf (log + n, sizeof log - (size_t) n, "\"%s\"", msg);
+    return written;
+}
+
+/**
+*	\brief	Logs how many records were dropped since the last time, if any
+*			were.
+*/
+static void report_drops (FILE *stream)
+{
+    const unsigned long long dropped = atomic_load (&ring.dropped);
+
+    if (dropped != ring.reported) {
+        char msg[LOG_ENTRY_MAX];
+
+        snprintf (msg, sizeof msg, logs[SS_LOG_DROPPED], PROGRAM_NAME,
+                  dropped - ring.reported);
+        ring.reported = dropped;
+        log_msg (stream, msg, LOG_FULLTIME);
+        log_msg (0, msg, LOG_FULLTIME);
+        fflush (stream);
     }
-    n = fprintf (fp, "%s\n", log);
-    return ferror (fp) ? -1 : n;
+}
+
+static void *writer_main (void *arg)
+{
+    FILE *const stream = arg;
+    static char out[LOG_BATCH_BYTES];
+    struct stamp stamp = { 0 };
+
+    for (;;) {
+        if (write_batch (&stamp, out)) {
+            report_drops (stream);
+            continue;
+        }
+
+        /*
+         * Producers only take the lock to wake us if they see sleeping
+         * set, which is why the ring is checked once more after setting
+         * it.
+         */
+        pthread_mutex_lock (&ring.lock);
+        atomic_store (&ring.sleeping, 1);
+
+        const struct log_entry *const e =
+            &ring.entries[ring.dequeue & (LOG_RING_LEN - 1)];
+
+        if (atomic_load (&e->seq) == ring.dequeue + 1) {
+            atomic_store (&ring.sleeping, 0);
+        } else if (atomic_load (&ring.stopping)) {
+            pthread_mutex_unlock (&ring.lock);
+            break;
+        } else {
+            pthread_cond_wait (&ring.wake, &ring.lock);
+        }
+        atomic_store (&ring.sleeping, 0);
+        pthread_mutex_unlock (&ring.lock);
+    }
+    report_drops (stream);
+    return 0;
+}
+
+int log_start (FILE *stream)
+{
+    for (size_t i = 0; i < LOG_RING_LEN; i++) {
+        atomic_init (&ring.entries[i].seq, i);
+    }
+
+    /*
+     * The writer flushes after each batch, rather than the stream after
+     * each line.
+     */
+    errno = 0;
+
+    if (setvbuf (stream, 0, _IOFBF, BUFSIZ)) {
+        if (errno) {
+            perror ("setvbuf()");
+        }
+        return -1;
+    }
+
+    const int err = pthread_create (&ring.thread, 0, writer_main, stream);
+
+    if (err) {
+        errno = err;
+        perror ("pthread_create()");
+        return -1;
+    }
+    atomic_store (&ring.running, 1);
+    return 0;
+}
+
+void log_stop (void)
+{
+    if (!atomic_exchange (&ring.running, 0)) {
+        return;
+    }
+    pthread_mutex_lock (&ring.lock);
+    atomic_store (&ring.stopping, 1);
+    pthread_cond_signal (&ring.wake);
+    pthread_mutex_unlock (&ring.lock);
+    pthread_join (ring.thread, 0);
+}
+
+/**
+*	\brief	Claims the next slot of the ring.
+*	\return	The slot, to be filled and then published at pos + 1, or NULL
+*			if the ring is full, in which case the record is dropped.
+*/
+static struct log_entry *claim (size_t *pos)
+{
+    size_t p = atomic_load_explicit (&ring.enqueue, memory_order_relaxed);
+
+    for (;;) {
+        struct log_entry *const e = &ring.entries[p & (LOG_RING_LEN - 1)];
+        const size_t seq = atomic_load_explicit (&e->seq, memory_order_acquire);
+        const intptr_t dif = (intptr_t) seq - (intptr_t) p;
+
+        if (!dif) {
+            if (atomic_compare_exchange_weak_explicit (&ring.enqueue, &p,
+                                                       p + 1,
+                                                       memory_order_relaxed,
+                                                       memory_order_relaxed))
+            {
+                *pos = p;
+                return e;
+            }
+        } else if (dif < 0) {
+            /*
+             * The writer is a whole ring behind.
+             */
+            atomic_fetch_add_explicit (&ring.dropped, 1, memory_order_relaxed);
+            return 0;
+        } else {
+            p = atomic_load_explicit (&ring.enqueue, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+*	\brief	Hands a filled slot to the writer, waking it if need be.
+*/
+static void publish (struct log_entry *e, size_t pos)
+{
+    atomic_store (&e->seq, pos + 1);
+
+    if (atomic_load (&ring.sleeping) && atomic_exchange (&ring.sleeping, 0)) {
+        pthread_mutex_lock (&ring.lock);
+        pthread_cond_signal (&ring.wake);
+        pthread_mutex_unlock (&ring.lock);
+    }
+}
+
+/**
+*	\brief	Writes msg at once, for when there is no writer.
+*/
+static void post_now (FILE *stream, const char *msg, unsigned flags)
+{
+    log_msg (stream, msg, flags);
+
+    if (stream) {
+        log_msg (0, msg, flags);
+    }
+}
+
+void log_post (FILE *stream, const char *msg, unsigned flags)
+{
+    if (!atomic_load (&ring.running)) {
+        post_now (stream, msg, flags);
+        return;
+    }
+
+    size_t pos;
+    struct log_entry *const e = claim (&pos);
+
+    if (!e) {
+        return;
+    }
+    e->stream = stream;
+    e->when = flags & LOG_FULLTIME ? time (0) : 0;
+    e->flags = flags;
+    e->record = 0;
+    strncpy (e->msg, msg ? msg : "", sizeof e->msg - 1);
+    e->msg[sizeof e->msg - 1] = '\0';
+    publish (e, pos);
+}
+
+void log_post_record (FILE *stream, const char *rec, unsigned flags)
+{
+    if (!atomic_load (&ring.running)) {
+        char text[BUFSIZE];
+
+        render_record (text, sizeof text, rec);
+        post_now (stream, text, flags);
+        return;
+    }
+
+    size_t pos;
+    struct log_entry *const e = claim (&pos);
+    uint32_t len;
+
+    if (!e) {
+        return;
+    }
+    memcpy (&len, rec, sizeof len);
+    e->stream = stream;
+    e->when = flags & LOG_FULLTIME ? time (0) : 0;
+    e->flags = flags;
+    e->record = 1;
+    memcpy (e->msg, rec, len < sizeof e->msg ? len : sizeof e->msg);
+    publish (e, pos);
+}
+
+unsigned long long log_dropped (void)
+{
+    return atomic_load (&ring.dropped);
 }
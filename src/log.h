@@ -10,6 +10,8 @@
 #define LOG_ALL             0xFF        /* 0b11111111 */
 #define LOG_FULLTIME        0x03        /* 0b00000011 */
 
+#define LOG_RECORD_MAX      240         /* Bytes of an event record. */
+
 /** 
 *	\brief	log_msg() writes msg to stream in the ISO 8601 format:
 *			"03-02-16T10:05:41, msg", if msg is not NULL. If stream is NULL,
@@ -23,4 +25,37 @@
 */
 int log_msg (FILE *stream, const char *msg, unsigned options);
 
+/**
+*	\brief	Starts a thread that writes what log_post() is given, so that the
+*			threads posting never wait on the disk. stream is switched to
+*			full buffering, and flushed after each batch of records.
+*	\return	0 on success, or -1 on failure.
+*/
+int log_start (FILE *stream);
+
+/**
+*	\brief	Writes whatever is still queued, and stops the writer. Records
+*			posted from then on are written straight away.
+*/
+void log_stop (void);
+
+/**
+*	\brief	Logs msg to stream, as log_msg() does, and to stderr. Once
+*			log_start() has been called, the record is queued for the writer
+*			instead, with the time it was posted, or dropped and counted if
+*			the writer has fallen too far behind.
+*/
+void log_post (FILE *stream, const char *msg, unsigned flags);
+
+/**
+*	\brief	Like log_post(), but for an event record, as evlog_encode() makes
+*			them, of up to LOG_RECORD_MAX bytes. The writer formats it.
+*/
+void log_post_record (FILE *stream, const char *rec, unsigned flags);
+
+/**
+*	\return	How many records have been dropped so far.
+*/
+unsigned long long log_dropped (void);
+
 #endif /* LOG_H */
@@ -1,4 +1,5 @@
 #include "internal.h"
+#include "evlog.h"
 
 /*
 *   An array of log message templates for different types of events.	
@@ -13,7 +14,7 @@ const char *const logs[] = {
     [SS_FAILED_EXCUSE] = 
         "%s: [ ERROR ]: Couldn't send the peer the full message.\n",
     [SS_NEW_CONN] =
-        "%s: [ INFO ]: New connection from HOST:%s, SERVICE:%s,\n\t\t\t\t\t   LOCAL IP ADDRESS:%s, on socket %d.",
+        "%s: [ INFO ]: New connection from %s on socket %d.",
     [SS_OVERLOAD] =     
         "%s: [ WARNING ]: Server overloaded. Caution advised.\n",
     [SS_SOCKET_ERROR] =  
@@ -22,6 +23,89 @@ const char *const logs[] = {
         "%s: [ ERROR ]: fclose() failed. Logs might have been lost.\n",
     [SS_INITIATE] =     
         "%s: [ INFO ]: Listening for connections on port %s.\n",
+    [SS_SLOW_CONSUMER] =
+        "%s: [ WARNING ]: Socket %d could not keep up and was disconnected.",
+    [SS_LINE_TOO_LONG] =
+        "%s: [ WARNING ]: Socket %d sent a line longer than %d bytes and was disconnected.",
+    [SS_BAD_FRAME] =
+        "%s: [ WARNING ]: Socket %d sent a malformed frame and was disconnected.",
+    [SS_POOL_STATS] =
+        "%s: [ INFO ]: Reactor %d %s: %llu hits, %llu misses, %zu bytes resident.",
+    [SS_LOG_DROPPED] =
+        "%s: [ WARNING ]: %llu log records were dropped while the log fell behind.",
+    [SS_SHEDDING] =
+        "%s: [ WARNING ]: Reactor %d is taking %d ms a pass; turning new connections away.",
+    [SS_RECOVERED] =
+        "%s: [ INFO ]: Reactor %d has caught up; accepting new connections again.",
+    [SS_IDLE_TIMEOUT] =
+        "%s: [ INFO ]: Socket %d was silent for %d s and was disconnected.",
+    [SS_HANDSHAKE_TIMEOUT] =
+        "%s: [ INFO ]: Socket %d sent nothing within %d s and was disconnected.",
+    [SS_TLS_FAILED] =
+        "%s: [ INFO ]: TLS with socket %d failed, and it was disconnected: %s.",
+    [SS_UPGRADE_STARTED] =
+        "%s: [ INFO ]: Starting a new process to take over.",
+    [SS_UPGRADE_FAILED] =
+        "%s: [ WARNING ]: The upgrade failed, and this process carries on: %s.",
+    [SS_HANDED_OVER] =
+        "%s: [ INFO ]: Handed %d connections over to the new process.",
+    [SS_TOOK_OVER] =
+        "%s: [ INFO ]: Took over %d connections from the old process.",
 };
 
 
+
+/*
+*   The arguments each template takes, for the event log (see evlog.h).
+*/
+const char *const log_args[] = {
+    [SS_SEND_ERROR] = "pz",
+    [SS_CLOSED_CONN] = "pd",
+    [SS_CONN_SURPLUS] = "p",
+    [SS_FAILED_EXCUSE] = "p",
+    [SS_NEW_CONN] = "pad",
+    [SS_OVERLOAD] = "p",
+    [SS_SOCKET_ERROR] = "p",
+    [SS_FCLOSE_ERROR] = "p",
+    [SS_INITIATE] = "ps",
+    [SS_SLOW_CONSUMER] = "pd",
+    [SS_LINE_TOO_LONG] = "pdd",
+    [SS_BAD_FRAME] = "pd",
+    [SS_POOL_STATS] = "pdsuuz",
+    [SS_LOG_DROPPED] = "pu",
+    [SS_SHEDDING] = "pdd",
+    [SS_RECOVERED] = "pd",
+    [SS_IDLE_TIMEOUT] = "pdd",
+    [SS_HANDSHAKE_TIMEOUT] = "pdd",
+    [SS_TLS_FAILED] = "pds",
+    [SS_UPGRADE_STARTED] = "p",
+    [SS_UPGRADE_FAILED] = "ps",
+    [SS_HANDED_OVER] = "pd",
+    [SS_TOOK_OVER] = "pd",
+};
+
+const char *const log_names[] = {
+    [SS_SEND_ERROR] = "send_error",
+    [SS_CLOSED_CONN] = "closed_conn",
+    [SS_CONN_SURPLUS] = "conn_surplus",
+    [SS_FAILED_EXCUSE] = "failed_excuse",
+    [SS_NEW_CONN] = "new_conn",
+    [SS_OVERLOAD] = "overload",
+    [SS_SOCKET_ERROR] = "socket_error",
+    [SS_FCLOSE_ERROR] = "fclose_error",
+    [SS_INITIATE] = "initiate",
+    [SS_SLOW_CONSUMER] = "slow_consumer",
+    [SS_LINE_TOO_LONG] = "line_too_long",
+    [SS_BAD_FRAME] = "bad_frame",
+    [SS_POOL_STATS] = "pool_stats",
+    [SS_LOG_DROPPED] = "log_dropped",
+    [SS_SHEDDING] = "shedding",
+    [SS_RECOVERED] = "recovered",
+    [SS_IDLE_TIMEOUT] = "idle_timeout",
+    [SS_HANDSHAKE_TIMEOUT] = "handshake_timeout",
+    [SS_TLS_FAILED] = "tls_failed",
+    [SS_UPGRADE_STARTED] = "upgrade_started",
+    [SS_UPGRADE_FAILED] = "upgrade_failed",
+    [SS_HANDED_OVER] = "handed_over",
+    [SS_TOOK_OVER] = "took_over",
+};
@@ -0,0 +1,427 @@
+#ifdef _POSIX_C_SOURCE
+#undef _POSIX_C_SOURCE
+#endif
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "metrics.h"
+#include "config.h"
+#include "internal.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+/*
+*	Histogram buckets are log-linear, as in HDR histograms: each power of
+*	2 from 2^HIST_MIN_SHIFT ns up is split into HIST_SUB equal buckets, so
+*	that a bucket is never wider than a quarter of its lower bound. Below
+*	the first lies bucket 0, and past the last, the overflow bucket.
+*/
+#define HIST_MIN_SHIFT	8       /* 256 ns. */
+#define HIST_MAX_SHIFT	35      /* About 34 s. */
+#define HIST_SUB_SHIFT	2
+#define HIST_SUB		(1 << HIST_SUB_SHIFT)
+#define HIST_BUCKETS	(2 + (HIST_MAX_SHIFT - HIST_MIN_SHIFT) * HIST_SUB)
+
+/*
+*	Threads beyond the reactors (the main one is reactor 0) share the last
+*	shard, which is safe as every update is atomic.
+*/
+#define MAX_SHARDS		(MAX_THREADS + 1)
+
+#define RENDER_MAX		(64 * 1024)
+
+struct histogram {
+    atomic_ullong buckets[HIST_BUCKETS];
+    atomic_ullong sum;          /* In nanoseconds. */
+};
+
+/*
+*	One thread's metrics. Only it writes them, so the atomics are never
+*	contended; they are atomic so that a scrape reads whole values.
+*/
+struct shard {
+    alignas (64) atomic_ullong counters[M_COUNTERS];
+    struct histogram histograms[H_HISTOGRAMS];
+};
+
+static struct shard shards[MAX_SHARDS];
+static atomic_int n_shards;
+static _Thread_local struct shard *shard;
+
+static const struct {
+    const char *name;
+    const char *help;
+} counters[] = {
+    [M_ACCEPTED] = { "ss_connections_accepted_total",
+                     "Connections admitted." },
+    [M_REJECTED] = { "ss_connections_rejected_total",
+                     "Connections turned away because the server was full." },
+    [M_EVICTED] = { "ss_connections_evicted_total",
+                    "Connections closed for a newer one from the same address." },
+    [M_BYTES_IN] = { "ss_received_bytes_total", "Bytes read from clients." },
+    [M_BYTES_OUT] = { "ss_sent_bytes_total", "Bytes sent to clients." },
+    [M_SHORT_SENDS] = { "ss_short_sends_total",
+                        "Sends that the socket took only part of." },
+    [M_WAKEUPS] = { "ss_loop_wakeups_total",
+                    "Times an event loop woke up." },
+    [M_SHED] = { "ss_connections_shed_total",
+                 "Connections turned away while an event loop was overloaded." },
+    [M_RATE_LIMITED] = { "ss_connections_rate_limited_total",
+                         "Connections over their address's connect rate." },
+    [M_THROTTLED] = { "ss_messages_throttled_total",
+                      "Messages dropped for their address's message or byte rate." },
+    [M_JOURNAL_BYTES] = { "ss_journal_bytes_total",
+                          "Bytes committed to the message journal." },
+    [M_JOURNAL_COMMITS] = { "ss_journal_commits_total",
+                            "Groups of messages committed with one fdatasync()." },
+    [M_JOURNAL_STALLS] = { "ss_journal_stalls_total",
+                           "Times an event loop waited for the journal to catch up." },
+    [M_JOURNAL_FAILED] = { "ss_journal_failed_total",
+                           "Messages that could not be written to the journal." },
+    [M_TIMED_OUT] = { "ss_connections_timed_out_total",
+                      "Connections closed for sending nothing in time." },
+    [M_PINGS] = { "ss_pings_sent_total",
+                  "Pings sent to binary clients that had gone quiet." },
+    [M_TLS_HANDSHAKES] = { "ss_tls_handshakes_total",
+                           "TLS handshakes completed and handed to the kernel." },
+    [M_TLS_RESUMED] = { "ss_tls_resumed_total",
+                        "TLS handshakes that resumed an earlier session." },
+    [M_TLS_FAILED] = { "ss_tls_failed_total",
+                       "TLS handshakes that failed, or could not be offloaded." },
+    [M_COMPRESSED] = { "ss_messages_compressed_total",
+                       "Messages compressed for the clients that asked." },
+    [M_COMPRESS_NS] = { "ss_compress_nanoseconds_total",
+                        "Time spent compressing messages." },
+    [M_COMPRESS_SAVED] = { "ss_compress_saved_bytes_total",
+                           "Bytes that compressed messages saved, over all their recipients." },
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+} histograms[] = {
+    [H_TICK] = { "ss_loop_tick_seconds",
+                 "Time spent handling one batch of ready events." },
+    [H_FANOUT] = { "ss_fanout_seconds",
+                   "Time spent queueing one message for its room." },
+    [H_JOURNAL_LAG] = { "ss_journal_lag_seconds",
+                        "Time from relaying a message to having it on disk." },
+};
+
+static struct {
+    int fd;
+    char path[sizeof ((struct sockaddr_un *) 0)->sun_path];
+    ino_t ino;                  /* Of the socket at path, while it is ours. */
+    pthread_t thread;
+    atomic_bool stopping;
+    int running;
+} admin = {.fd = -1 };
+
+static struct shard *my_shard (void)
+{
+    if (!shard) {
+        const int i = atomic_fetch_add (&n_shards, 1);
+
+        shard = &shards[i < MAX_SHARDS ? i : MAX_SHARDS - 1];
+    }
+    return shard;
+}
+
+void metric_add (enum metric_counter c, unsigned long long n)
+{
+    atomic_fetch_add_explicit (&my_shard ()->counters[c], n,
+                               memory_order_relaxed);
+}
+
+static int bucket_of (unsigned long long ns)
+{
+    if (ns < 1ULL << HIST_MIN_SHIFT) {
+        return 0;
+    }
+
+    const int e = 63 - __builtin_clzll (ns);
+
+    if (e >= HIST_MAX_SHIFT) {
+        return HIST_BUCKETS - 1;
+    }
+
+    const int sub = (int) (ns >> (e - HIST_SUB_SHIFT)) & (HIST_SUB - 1);
+
+    return 1 + (e - HIST_MIN_SHIFT) * HIST_SUB + sub;
+}
+
+/**
+*	\return	The upper bound of bucket i, in nanoseconds. The overflow bucket
+*			has none.
+*/
+static unsigned long long bucket_bound (int i)
+{
+    if (!i) {
+        return 1ULL << HIST_MIN_SHIFT;
+    }
+
+    const int e = HIST_MIN_SHIFT + (i - 1) / HIST_SUB;
+    const unsigned long long sub = (unsigned long long) ((i - 1) % HIST_SUB);
+
+    return (1ULL << e) + (sub + 1) * (1ULL << (e - HIST_SUB_SHIFT));
+}
+
+void metric_observe (enum metric_histogram h, long long ns)
+{
+    struct histogram *const hist = &my_shard ()->histograms[h];
+    const unsigned long long v = ns > 0 ? (unsigned long long) ns : 0;
+
+    atomic_fetch_add_explicit (&hist->buckets[bucket_of (v)], 1,
+                               memory_order_relaxed);
+    atomic_fetch_add_explicit (&hist->sum, v, memory_order_relaxed);
+}
+
+long long metrics_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned long long sum_counter (enum metric_counter c, int n)
+{
+    unsigned long long total = 0;
+
+    for (int i = 0; i < n; i++) {
+        total += atomic_load_explicit (&shards[i].counters[c],
+                                       memory_order_relaxed);
+    }
+    return total;
+}
+
+size_t metrics_render (char *buf, size_t size)
+{
+    const int n = atomic_load (&n_shards) < MAX_SHARDS
+        ? atomic_load (&n_shards) : MAX_SHARDS;
+    size_t len = 0;
+    int w;
+
+#define APPEND(...) \
+    (w = snprintf (buf + (len < size ? len : size), \
+                   len < size ? size - len : 0, __VA_ARGS__), \
+     len += w > 0 ? (size_t) w : 0)
+
+    for (int c = 0; c < M_COUNTERS; c++) {
+        APPEND ("# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+                counters[c].name, counters[c].help, counters[c].name,
+                counters[c].name, sum_counter ((enum metric_counter) c, n));
+    }
+    APPEND ("# HELP ss_log_dropped_total Log records dropped because the "
+            "log fell behind.\n# TYPE ss_log_dropped_total counter\n"
+            "ss_log_dropped_total %llu\n", log_dropped ());
+
+    for (int h = 0; h < H_HISTOGRAMS; h++) {
+        const char *const name = histograms[h].name;
+        unsigned long long count = 0;
+        unsigned long long sum = 0;
+
+        APPEND ("# HELP %s %s\n# TYPE %s histogram\n", name,
+                histograms[h].help, name);
+
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+            for (int i = 0; i < n; i++) {
+                count += atomic_load_explicit (&shards[i].histograms[h].
+                                               buckets[b],
+                                               memory_order_relaxed);
+            }
+            if (b == HIST_BUCKETS - 1) {
+                APPEND ("%s_bucket{le=\"+Inf\"} %llu\n", name, count);
+            } else {
+                APPEND ("%s_bucket{le=\"%.9g\"} %llu\n", name,
+                        (double) bucket_bound (b) / 1e9, count);
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            sum += atomic_load_explicit (&shards[i].histograms[h].sum,
+                                         memory_order_relaxed);
+        }
+        APPEND ("%s_sum %.9f\n%s_count %llu\n", name, (double) sum / 1e9,
+                name, count);
+    }
+
+#undef APPEND
+    return len;
+}
+
+static void write_all (int fd, const char *buf, size_t len)
+{
+    while (len) {
+        const ssize_t n = send (fd, buf, len, MSG_NOSIGNAL);
+
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        buf += n;
+        len -= (size_t) n;
+    }
+}
+
+/**
+*	\brief	Answers one scrape. A client that sends nothing within a moment
+*			is taken to want the plain text.
+*/
+static void answer (int fd, char *body)
+{
+    struct pollfd pfd = {.fd = fd,.events = POLLIN };
+    char req[512];
+    ssize_t n = 0;
+
+    if (poll (&pfd, 1, 200) == 1) {
+        n = recv (fd, req, sizeof req - 1, 0);
+    }
+
+    size_t len = metrics_render (body, RENDER_MAX);
+
+    if (len >= RENDER_MAX) {
+        len = RENDER_MAX - 1;
+    }
+    if (n >= 4 && !memcmp (req, "GET ", 4)) {
+        char hdr[256];
+        const int h = snprintf (hdr, sizeof hdr,
+                                "HTTP/1.0 200 OK\r\n"
+                                "Content-Type: text/plain; version=0.0.4\r\n"
+                                "Content-Length: %zu\r\n\r\n", len);
+
+        write_all (fd, hdr, (size_t) h);
+    }
+    write_all (fd, body, len);
+}
+
+static void *admin_main (void *arg)
+{
+    static char body[RENDER_MAX];
+
+    (void) arg;
+
+    for (;;) {
+        const int fd = accept (admin.fd, 0, 0);
+
+        if (fd == -1) {
+            if (atomic_load (&admin.stopping)) {
+                break;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror ("accept()");
+            break;
+        }
+
+        /*
+         * A scraper that stops reading cannot hold us up for long.
+         */
+        const struct timeval tv = {.tv_sec = 1 };
+
+        setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+        answer (fd, body);
+        close (fd);
+    }
+    return 0;
+}
+
+int metrics_serve (const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX };
+
+    if (strlen (path) >= sizeof addr.sun_path) {
+        fprintf (stderr, "%s: admin socket path too long: %s\n",
+                 PROGRAM_NAME, path);
+        return -1;
+    }
+    strcpy (addr.sun_path, path);
+
+    if ((admin.fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+        perror ("socket()");
+        return -1;
+    }
+
+    /*
+     * A socket left behind by an earlier run would keep us from binding.
+     */
+    unlink (path);
+
+    if (bind (admin.fd, (struct sockaddr *) &addr, sizeof addr) == -1
+        || listen (admin.fd, SOMAXCONN) == -1) {
+        perror ("bind()");
+        close (admin.fd);
+        admin.fd = -1;
+        return -1;
+    }
+    strcpy (admin.path, path);
+
+    struct stat st;
+
+    admin.ino = stat (path, &st) == 0 ? st.st_ino : 0;
+
+    /*
+     * Signals are for the reactors.
+     */
+    sigset_t all, old;
+
+    sigfillset (&all);
+    pthread_sigmask (SIG_SETMASK, &all, &old);
+
+    const int err = pthread_create (&admin.thread, 0, admin_main, 0);
+
+    pthread_sigmask (SIG_SETMASK, &old, 0);
+
+    if (err) {
+        errno = err;
+        perror ("pthread_create()");
+        close (admin.fd);
+        admin.fd = -1;
+        unlink (path);
+        return -1;
+    }
+    admin.running = 1;
+    return 0;
+}
+
+void metrics_stop (void)
+{
+    if (!admin.running) {
+        return;
+    }
+    atomic_store (&admin.stopping, 1);
+
+    /*
+     * Wakes the thread from accept().
+     */
+    shutdown (admin.fd, SHUT_RDWR);
+    pthread_join (admin.thread, 0);
+
+    close (admin.fd);
+
+    /*
+     * After an upgrade, the path is the new process's socket.
+     */
+    struct stat st;
+
+    if (stat (admin.path, &st) == 0 && st.st_ino == admin.ino) {
+        unlink (admin.path);
+    }
+    admin.fd = -1;
+    admin.running = 0;
+}
@@ -0,0 +1,76 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+
+/*
+*	Counters and latency histograms, kept per thread so that updating
+*	them never contends, and summed when they are scraped from the admin
+*	socket.
+*/
+enum metric_counter {
+    M_ACCEPTED,                 /* Connections admitted. */
+    M_REJECTED,                 /* Connections turned away, being full. */
+    M_EVICTED,                  /* Connections closed for a newer one. */
+    M_BYTES_IN,
+    M_BYTES_OUT,
+    M_SHORT_SENDS,              /* Sends the socket took only part of. */
+    M_WAKEUPS,                  /* Returns from event_wait(). */
+    M_SHED,                     /* Connections turned away, overloaded. */
+    M_RATE_LIMITED,             /* Connections over their address's rate. */
+    M_THROTTLED,                /* Messages over their address's rate. */
+    M_JOURNAL_BYTES,            /* Committed to the journal. */
+    M_JOURNAL_COMMITS,          /* fdatasync() calls that did so. */
+    M_JOURNAL_STALLS,           /* Waits for room in the journal's queue. */
+    M_JOURNAL_FAILED,           /* Messages the journal could not write. */
+    M_TIMED_OUT,                /* Connections closed for being silent. */
+    M_PINGS,                    /* FRAME_PINGs sent to quiet clients. */
+    M_TLS_HANDSHAKES,           /* Completed and offloaded to the kernel. */
+    M_TLS_RESUMED,              /* Of those, ones that resumed a session. */
+    M_TLS_FAILED,               /* Handshakes that failed, or not offloaded. */
+    M_COMPRESSED,               /* Messages compressed, once each. */
+    M_COMPRESS_NS,              /* Time spent compressing them. */
+    M_COMPRESS_SAVED,           /* Bytes not sent for being compressed. */
+    M_COUNTERS
+};
+
+enum metric_histogram {
+    H_TICK,                     /* Handling one batch of events. */
+    H_FANOUT,                   /* Queueing one message for a room. */
+    H_JOURNAL_LAG,              /* From relaying a message to committing it. */
+    H_HISTOGRAMS
+};
+
+void metric_add (enum metric_counter c, unsigned long long n);
+
+/**
+*	\brief	Records a duration, in nanoseconds.
+*/
+void metric_observe (enum metric_histogram h, long long ns);
+
+/**
+*	\return	CLOCK_MONOTONIC, in nanoseconds.
+*/
+long long metrics_now (void);
+
+/**
+*	\brief	Writes every metric in the Prometheus text format.
+*	\return	The length of the text, which may be more than size, in which
+*			case it was truncated.
+*/
+size_t metrics_render (char *buf, size_t size);
+
+/**
+*	\brief	Serves metrics_render() on a Unix-domain socket at path, from a
+*			thread of its own. Plain connections are sent the text, and
+*			HTTP GET requests get it as a response.
+*	\return	0 on success, or -1 on failure.
+*/
+int metrics_serve (const char *path);
+
+/**
+*	\brief	Stops serving, and removes the socket.
+*/
+void metrics_stop (void);
+
+#endif /* METRICS_H */
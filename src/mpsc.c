@@ -0,0 +1,57 @@
+#include "mpsc.h"
+
+#include <stddef.h>
+
+void mpsc_init (struct mpsc_queue *q)
+{
+    atomic_init (&q->stub.next, 0);
+    atomic_init (&q->head, &q->stub);
+    q->tail = &q->stub;
+}
+
+void mpsc_push (struct mpsc_queue *q, struct mpsc_node *node)
+{
+    atomic_store_explicit (&node->next, 0, memory_order_relaxed);
+
+    struct mpsc_node *const prev = atomic_exchange_explicit (&q->head, node,
+                                                             memory_order_acq_rel);
+
+    /*
+     * Until this store, the consumer sees the queue end at prev.
+     */
+    atomic_store_explicit (&prev->next, node, memory_order_release);
+}
+
+struct mpsc_node *mpsc_pop (struct mpsc_queue *q)
+{
+    struct mpsc_node *tail = q->tail;
+    struct mpsc_node *next = atomic_load_explicit (&tail->next,
+                                                   memory_order_acquire);
+
+    if (tail == &q->stub) {
+        if (!next) {
+            return 0;
+        }
+        q->tail = tail = next;
+        next = atomic_load_explicit (&next->next, memory_order_acquire);
+    }
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_explicit (&q->head, memory_order_acquire)) {
+        return 0;
+    }
+    /*
+     * tail is the last node. Put the stub behind it so that it can be
+     * handed out without leaving the queue empty of nodes.
+     */
+    mpsc_push (q, &q->stub);
+    next = atomic_load_explicit (&tail->next, memory_order_acquire);
+
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef MPSC_H
+#define MPSC_H
+
+#include <stdatomic.h>
+
+/*
+*	An intrusive, lock-free, multiple-producer single-consumer queue
+*	(Dmitry Vyukov's). Producers never wait on each other or on the
+*	consumer: a push is one atomic exchange and one store.
+*/
+struct mpsc_node {
+    _Atomic (struct mpsc_node *) next;
+};
+
+struct mpsc_queue {
+    _Atomic (struct mpsc_node *) head;      /* Producers push here. */
+    struct mpsc_node *tail;                 /* The consumer pops here. */
+    struct mpsc_node stub;
+};
+
+void mpsc_init (struct mpsc_queue *q);
+
+/**
+*	\brief	Appends node to q. Safe to call from any thread.
+*/
+void mpsc_push (struct mpsc_queue *q, struct mpsc_node *node);
+
+/**
+*	\brief	Removes the oldest node. Must only be called by the consumer.
+*	\return	The node, or NULL if q is empty or a push is still in progress.
+*			In the latter case the pushing thread has yet to signal the
+*			consumer, so it is safe to stop draining.
+*/
+struct mpsc_node *mpsc_pop (struct mpsc_queue *q);
+
+#endif /* MPSC_H */
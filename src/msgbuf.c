@@ -0,0 +1,233 @@
+#include "msgbuf.h"
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+/*
+*	Classes hold 64 bytes, and four times more each step up, to 64 KiB.
+*	Anything larger comes straight from malloc().
+*/
+#define N_CLASSES	6
+#define MIN_SHIFT	6
+#define CLASS_STEP	2
+#define OVERSIZE	N_CLASSES
+
+/*
+*	How many free messages each thread keeps per class.
+*/
+#define POOL_DEPTH	64
+
+/*
+*	The reactors, and the main thread.
+*/
+#define MAX_POOLS	(MAX_THREADS + 1)
+
+struct msgbuf_pool {
+    struct msgbuf *free[N_CLASSES];
+    unsigned count[N_CLASSES];
+    unsigned long long hits;
+    unsigned long long misses;
+    struct mpsc_queue returned; /* Released by other threads. */
+    atomic_bool retired;        /* Its thread has drained it. */
+};
+
+/*
+*	Each thread that allocates messages claims a pool of its own, so
+*	neither allocating nor releasing takes a lock. A message released by
+*	another thread is queued back to the pool it came from, and taken in
+*	when that pool runs dry. Otherwise a thread that only ever releases,
+*	like the journal's writer, would hoard what the reactors then miss.
+*/
+static struct msgbuf_pool pools[MAX_POOLS];
+static atomic_int n_pools;
+static _Thread_local struct msgbuf_pool *pool;
+static _Thread_local int pool_claimed;
+
+/*
+*	A message may be freed by another thread than the one that allocated
+*	it, so this is kept for the process. It only changes on a miss.
+*/
+static atomic_size_t resident;
+
+static unsigned size_class (size_t cap)
+{
+    unsigned c = 0;
+
+    while (c < N_CLASSES && cap > (size_t) 1 << (MIN_SHIFT + CLASS_STEP * c)) {
+        c++;
+    }
+    return c;
+}
+
+/**
+*	\return	The calling thread's pool, or NULL if there are none left, in
+*			which case its messages are allocated and freed directly.
+*/
+static struct msgbuf_pool *my_pool (void)
+{
+    if (!pool_claimed) {
+        const int i = atomic_fetch_add (&n_pools, 1);
+
+        pool_claimed = 1;
+
+        if (i < MAX_POOLS) {
+            pool = &pools[i];
+            mpsc_init (&pool->returned);
+        }
+    }
+    return pool;
+}
+
+static void discard (struct msgbuf *m)
+{
+    atomic_fetch_sub_explicit (&resident, sizeof *m + m->cap,
+                               memory_order_relaxed);
+    free (m);
+}
+
+/**
+*	\brief	Keeps m in p for reuse, unless p is full.
+*/
+static void keep (struct msgbuf_pool *p, struct msgbuf *m)
+{
+    const unsigned c = m->size_class;
+
+    if (p->count[c] == POOL_DEPTH) {
+        discard (m);
+        return;
+    }
+    m->next = p->free[c];
+    p->free[c] = m;
+    p->count[c]++;
+}
+
+/**
+*	\brief	Takes in the messages other threads have released to p.
+*/
+static void reclaim (struct msgbuf_pool *p)
+{
+    struct mpsc_node *node;
+
+    while ((node = mpsc_pop (&p->returned))) {
+        keep (p, (struct msgbuf *) (void *) ((char *) node
+                                             - offsetof (struct msgbuf,
+                                                         node)));
+    }
+}
+
+struct msgbuf *msgbuf_alloc (size_t cap)
+{
+    struct msgbuf_pool *const p = my_pool ();
+    const unsigned c = size_class (cap);
+    struct msgbuf *m = 0;
+
+    if (p && c != OVERSIZE && !p->free[c]) {
+        reclaim (p);
+    }
+    if (p && c != OVERSIZE && (m = p->free[c])) {
+        p->free[c] = m->next;
+        p->count[c]--;
+        p->hits++;
+    } else {
+        if (p) {
+            p->misses++;
+        }
+
+        if (c != OVERSIZE) {
+            cap = (size_t) 1 << (MIN_SHIFT + CLASS_STEP * c);
+        }
+        if (!(m = malloc (sizeof *m + cap))) {
+            return 0;
+        }
+        m->size_class = c;
+        m->cap = cap;
+        atomic_fetch_add_explicit (&resident, sizeof *m + cap,
+                                   memory_order_relaxed);
+    }
+    atomic_init (&m->refs, 1);
+    m->owner = p;
+    m->len = 0;
+    m->next = 0;
+    m->packed = 0;
+    return m;
+}
+
+struct msgbuf *msgbuf_new (const char *data, size_t len)
+{
+    struct msgbuf *const m = msgbuf_alloc (len);
+
+    if (m) {
+        memcpy (m->data, data, len);
+        m->len = len;
+    }
+    return m;
+}
+
+struct msgbuf *msgbuf_grow (struct msgbuf *m, size_t cap)
+{
+    if (cap <= m->cap) {
+        return m;
+    }
+
+    struct msgbuf *const new = msgbuf_alloc (cap);
+
+    if (new) {
+        memcpy (new->data, m->data, m->len);
+        new->len = m->len;
+    }
+    msgbuf_put (m);
+    return new;
+}
+
+void msgbuf_put (struct msgbuf *m)
+{
+    if (atomic_fetch_sub_explicit (&m->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    struct msgbuf_pool *const owner = m->owner;
+
+    if (m->packed) {
+        msgbuf_put (m->packed);
+    }
+    if (m->size_class == OVERSIZE || !owner
+        || atomic_load_explicit (&owner->retired, memory_order_acquire)) {
+        discard (m);
+    } else if (owner == pool) {
+        keep (owner, m);
+    } else {
+        mpsc_push (&owner->returned, &m->node);
+    }
+}
+
+void msgbuf_stats (struct pool_stats *stats)
+{
+    stats->hits = pool ? pool->hits : 0;
+    stats->misses = pool ? pool->misses : 0;
+    stats->resident = atomic_load_explicit (&resident, memory_order_relaxed);
+}
+
+void msgbuf_drain (void)
+{
+    if (!pool) {
+        return;
+    }
+    /*
+     * Messages released from now on are freed. One released just before
+     * may yet be queued after the reclaim, and stays there until exit.
+     */
+    atomic_store_explicit (&pool->retired, 1, memory_order_release);
+    reclaim (pool);
+
+    for (unsigned c = 0; c < N_CLASSES; c++) {
+        while (pool->free[c]) {
+            struct msgbuf *const next = pool->free[c]->next;
+
+            discard (pool->free[c]);
+            pool->free[c] = next;
+        }
+        pool->count[c] = 0;
+    }
+}
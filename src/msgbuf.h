@@ -0,0 +1,75 @@
+#ifndef MSGBUF_H
+#define MSGBUF_H
+
+#include "mpsc.h"
+#include "pool.h"
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*
+*	A message on its way to many clients. It is filled in once, then only
+*	read: every recipient's queue, and every reactor it is relayed to, holds
+*	a reference to the same buffer, and the last to let go of it returns it
+*	to the pool it came from.
+*/
+struct msgbuf {
+    atomic_uint refs;
+    unsigned size_class;
+    size_t cap;                 /* Bytes data has room for. */
+    size_t len;
+    struct msgbuf *next;        /* While it sits in the pool. */
+    struct msgbuf_pool *owner;  /* The pool it goes back to, or NULL. */
+    struct mpsc_node node;      /* While on its way back from another thread. */
+    struct msgbuf *packed;      /* A compressed copy, or NULL. */
+    char data[];
+};
+
+/**
+*	\brief	Gets an empty message with room for at least cap bytes, with one
+*			reference held by the caller. Messages are pooled in size
+*			classes, so this is usually just a pop off a free list.
+*	\return	The message, or NULL if the system is out of memory.
+*/
+struct msgbuf *msgbuf_alloc (size_t cap);
+
+/**
+*	\brief	Makes a message holding a copy of len bytes of data.
+*	\return	The message, or NULL if the system is out of memory.
+*/
+struct msgbuf *msgbuf_new (const char *data, size_t len);
+
+/**
+*	\brief	Makes room for at least cap bytes in a message that is still only
+*			the caller's, moving it to a larger class if need be.
+*	\return	The message, which may have moved, or NULL if the system is out
+*			of memory. The original is released either way.
+*/
+struct msgbuf *msgbuf_grow (struct msgbuf *m, size_t cap);
+
+static inline struct msgbuf *msgbuf_get (struct msgbuf *m)
+{
+    atomic_fetch_add_explicit (&m->refs, 1, memory_order_relaxed);
+    return m;
+}
+
+/**
+*	\brief	Drops a reference. Safe to call from any thread: the last one
+*			hands the message back to the thread that allocated it.
+*/
+void msgbuf_put (struct msgbuf *m);
+
+/**
+*	\brief	Fills in the calling thread's hits and misses, and the bytes held
+*			in messages by the whole process, pooled or not.
+*/
+void msgbuf_stats (struct pool_stats *stats);
+
+/**
+*	\brief	Frees the calling thread's pooled messages. Called by each thread
+*			on its way out; its messages still held elsewhere are freed by
+*			whoever releases them last.
+*/
+void msgbuf_drain (void);
+
+#endif /* MSGBUF_H */
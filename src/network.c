@@ -1,11 +1,22 @@
 #include "network.h"
+#include "config.h"
 #include "err.h"
+#include "event.h"
+#include "evlog.h"
+#include "frame.h"
+#include "history.h"
 #include "internal.h"
+#include "metrics.h"
+#include "msgbuf.h"
+#include "sendq.h"
+#include "server.h"
+#include "utils.h"
 
-#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <stddef.h>
 
@@ -28,112 +39,340 @@ int send_internal (int slave_fd, const char *line, size_t *len)
     return ret_val == -1 ? -1 : 0;
 }
 
-void send_response (size_t nbytes, const char *line, int sender_fd,
-                           int master_fd, fd_set master, int fd_max)
+/*
+*	Most queued messages one sendmsg() gathers.
+*/
+#define MAX_GATHER 64
+
+/**
+*	\brief	Brings what the loop watches slave for in line with its state:
+*			readable unless paused, and writable while it has a queue.
+*/
+static void update_events (struct event_loop *loop, struct client_info *slave)
 {
-    for (int i = 0; i <= fd_max && FD_ISSET (i, &master); i++) {
-        /*
-         * Send it to everyone. 
-         */
-        if (i != master_fd && i != sender_fd && i != pfds[0]) {
-            /*
-             * Excluding the master, sender, and the write end of the pipe. 
-             */
-            size_t len = nbytes;
-
-            if (send_internal (i, line, &len) == -1) {
-                perror ("send()");
-            } else if (len != nbytes) {
-                err_ret (log_fp, LOG_FULLTIME, logs[SS_SEND_ERROR],
-                         PROGRAM_NAME, len);
-            }
+    const unsigned events = (slave->flags & CLIENT_PAUSED ? 0u : EV_RECV)
+        | (sendq_empty (&slave->sendq) ? 0u : EV_WRITE);
+
+    if (events == slave->events) {
+        return;
+    }
+    if (event_mod (loop, slave->sock, events) == -1) {
+        perror ("event_mod()");
+        return;
+    }
+    slave->events = events;
+}
+
+static void resume_senders (struct event_loop *loop, struct client_table *table)
+{
+    for (int i = 0; i < table->count; i++) {
+        struct client_info *const slave = table->members[i];
+
+        if (slave->flags & CLIENT_PAUSED) {
+            slave->flags &= ~(unsigned) CLIENT_PAUSED;
+            update_events (loop, slave);
         }
     }
 }
 
-/** 
-*	\brief	Get the number of bytes that are immediately available for reading.
-*	\param	slave_fd - Socket to peek.	
-*   \return	The number of bytes available, or -1 on failure.
+static void pause_sender (struct event_loop *loop, struct client_table *table,
+                          int sender_fd)
+{
+    struct client_info *const sender = find_client_by_fd (table, sender_fd);
+
+    if (sender && !(sender->flags & CLIENT_PAUSED)) {
+        sender->flags |= CLIENT_PAUSED;
+        update_events (loop, sender);
+    }
+}
+
+/**
+*	\brief	Marks slave as over its queue limit or not. Once no client is,
+*			paused senders are read from again.
 */
-static int get_bytes (int slave_fd)
+static void set_congested (struct event_loop *loop, struct client_info *slave,
+                           struct client_table *table, int congested)
 {
-    int flag = 0;
+    if (congested && !(slave->flags & CLIENT_CONGESTED)) {
+        slave->flags |= CLIENT_CONGESTED;
+        table->congested++;
+    } else if (!congested && slave->flags & CLIENT_CONGESTED) {
+        slave->flags &= ~(unsigned) CLIENT_CONGESTED;
 
-    if (ioctl (slave_fd, FIONREAD, &flag) == -1) {
-        perror ("ioctl()");
-        return -1;
+        if (!--table->congested) {
+            resume_senders (loop, table);
+        }
+    }
+}
+
+void discard_output (struct event_loop *loop, struct client_info *slave,
+                     struct client_table *table)
+{
+    sendq_clear (&slave->sendq);
+    set_congested (loop, slave, table, 0);
+}
+
+/**
+*	\brief	Calls sendmsg() once for the gathered buffers.
+*	\return	The number of bytes sent, 0 if the socket is full, or -1 on any
+*			other error. The peer is gone then, and reading from it will tell.
+*/
+static ssize_t send_gather (int slave_fd, struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg = {.msg_iov = iov,.msg_iovlen = (size_t) iovcnt };
+    ssize_t ret_val;
+
+    while ((ret_val = sendmsg (slave_fd, &msg, MSG_NOSIGNAL)) == -1
+           && errno == EINTR) ;
+
+    if (ret_val == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        perror ("sendmsg()");
     }
-    return flag;
+    return ret_val;
 }
 
-char *get_response (size_t *nbytes, int slave_fd,
-                           unsigned *err_code)
+/**
+*	\brief	Updates slave's congestion and watch list after its queue shrank.
+*/
+static void after_send (struct event_loop *loop, struct client_info *slave,
+                        struct client_table *table)
 {
     /*
-     * This is an arbitrary limit.
-     * Does anyone know how to do this without a limit? 
+     * Hysteresis, so that a paused sender is not resumed and paused again
+     * for every message.
      */
-    const size_t page_size = BUFSIZE;
-    char *buf = 0;
-    int flag = 0;
-    ssize_t ret_val = 0;
-    size_t total = 0;
-	
-    do {
-        if (total > (BUFSIZE * 10)) {
-            /*
-             * Likely a DOS attack.
-             */
-            *err_code = SS_CLOSE_CONN;
-            goto out_free;
-        }
-        char *new = realloc (buf, total + page_size);
+    if (slave->sendq.bytes <= cfg.queue_limit / 2) {
+        set_congested (loop, slave, table, 0);
+    }
+    update_events (loop, slave);
+}
+
+void flush_client (struct event_loop *loop, struct client_info *slave,
+                   struct client_table *table)
+{
+    struct sendq *const q = &slave->sendq;
+    struct iovec iov[MAX_GATHER];
+    size_t len;
+    int iovcnt;
 
-        if (!new) {
-            *err_code = SS_NO_MEMORY;
-            perror ("realloc()");
-            goto out_free;
+    while ((iovcnt = sendq_iov (q, iov, MAX_GATHER, &len))) {
+        const ssize_t n = send_gather (slave->sock, iov, iovcnt);
+
+        if (n == -1) {
+            sendq_clear (q);
+            break;
         }
-        buf = new;
+        sendq_consume (q, (size_t) n);
+        metric_add (M_BYTES_OUT, (unsigned long long) n);
 
-		/*
-		* Disable SIGHUP, because a dropped connection causes a write error, which 
-		* would make server process exit.
-		*/
-        if ((ret_val = recv (slave_fd, buf + total, page_size - 1, MSG_NOSIGNAL)) > 0) {
-            total += (size_t) ret_val;
-            buf[ret_val] = '\0';
-
-            if ((flag = get_bytes (slave_fd)) == -1) {
-                *err_code = SS_CLOSE_CONN;
-                goto out_free;
-            }
-        } else {
-            flag = !flag;
+        if ((size_t) n < len) {
+            metric_add (M_SHORT_SENDS, 1);
+            break;
         }
-    } while (flag > 0);
+    }
+    after_send (loop, slave, table);
+}
+
+/**
+*	\brief	Queues msg for slave, applying the slow consumer policy if that
+*			takes it over the limit. A message is always taken onto an
+*			empty queue, however large.
+*/
+static void queue_message (struct event_loop *loop, struct client_table *table,
+                           struct client_info *slave, struct msgbuf *msg,
+                           int sender_fd)
+{
+    struct sendq *const q = &slave->sendq;
 
-    if (ret_val == 0) {
-        err_ret (log_fp, LOG_FULLTIME, logs[SS_CLOSED_CONN],
-                 PROGRAM_NAME, slave_fd);
-        *err_code = SS_CLOSE_CONN;
-        goto out_free;
+    /*
+     * The compressed copy was made once, for all who asked for it.
+     */
+    if (slave->flags & CLIENT_DEFLATE && msg->packed) {
+        metric_add (M_COMPRESS_SAVED,
+                    (unsigned long long) (msg->len - msg->packed->len));
+        msg = msg->packed;
     }
-    if (ret_val == -1) {
-        if (errno == EWOULDBLOCK || errno == EAGAIN) {
-            *err_code = SS_WOULD_BLOCK;
-            goto out_free;
+
+    /*
+     * Messages are stored framed; a line client is sent just the payload.
+     */
+    const size_t skip = slave->rbuf.mode == RECV_FRAMES ? 0 : FRAME_HDR_LEN;
+    const size_t len = msg->len - skip;
+
+    /*
+     * An empty frame's payload is nothing at all to a line client.
+     */
+    if (!len) {
+        return;
+    }
+    if (!sendq_empty (q) && q->bytes + len > cfg.queue_limit) {
+        switch (cfg.slow_policy) {
+            case SLOW_DISCONNECT:
+                log_event (SS_SLOW_CONSUMER, PROGRAM_NAME, slave->sock);
+                drop_connection (loop, slave, table);
+                return;
+            case SLOW_PAUSE:
+                /*
+                 * A sender on another thread cannot be paused from here.
+                 */
+                if (sender_fd != -1) {
+                    set_congested (loop, slave, table, 1);
+                    pause_sender (loop, table, sender_fd);
+                    break;
+                }
+                /* FALLTHROUGH */
+            case SLOW_DROP:
+                sendq_drop_oldest (q, q->bytes + len - cfg.queue_limit);
+
+                if (!sendq_empty (q) && q->bytes + len > cfg.queue_limit) {
+                    return;
+                }
+                break;
+        }
+    }
+    if (sendq_push (q, msg, skip) == -1) {
+        perror ("malloc()");
+        return;
+    }
+    /*
+     * A client waiting for its socket to drain is flushed when it does.
+     */
+    if (!(slave->flags & CLIENT_PENDING) && !(slave->events & EV_WRITE)) {
+        slave->flags |= CLIENT_PENDING;
+        table->pending[table->n_pending++] = slave->id;
+    }
+}
+
+void send_response (struct event_loop *loop, struct msgbuf *msg, int room,
+                    int sender_fd, struct client_table *table)
+{
+    struct room_members *const rm = &table->rooms[room];
+
+    /*
+     * Backwards, because a slow consumer may be dropped on the way, and
+     * the room's last member moved into its place.
+     */
+    for (int i = rm->count - 1; i >= 0; i--) {
+        struct client_info *const slave = rm->slots[i];
+
+        /*
+         * Send it to everyone except the sender.
+         */
+        if (slave->sock != sender_fd) {
+            queue_message (loop, table, slave, msg, sender_fd);
         }
-        *err_code = SS_CLOSE_CONN;
-        goto out_free;
     }
-    *nbytes = total;
-    return buf;
+}
 
-  out_free:
-    free (buf);
+int send_frame (struct event_loop *loop, struct client_info *slave,
+                enum frame_type type, int room, const void *payload,
+                size_t len, struct client_table *table)
+{
+    struct msgbuf *const msg = msgbuf_alloc (FRAME_HDR_LEN + len);
+
+    if (!msg) {
+        return -1;
+    }
+    frame_encode ((unsigned char *) msg->data, &(struct frame) {
+                  .length = (uint32_t) len,.type = (uint8_t) type,
+                  .room = (uint16_t) room}
+    );
+    if (len) {
+        memcpy (msg->data + FRAME_HDR_LEN, payload, len);
+    }
+    msg->len = FRAME_HDR_LEN + len;
+    queue_message (loop, table, slave, msg, -1);
+    msgbuf_put (msg);
     return 0;
 }
 
+int send_history (struct event_loop *loop, struct client_info *slave,
+                  int room, struct client_table *table)
+{
+    struct msgbuf *msg;
 
+    if (history_replay (room, slave->rbuf.mode == RECV_FRAMES, &msg) == -1) {
+        return -1;
+    }
+    if (msg) {
+        queue_message (loop, table, slave, msg, -1);
+        msgbuf_put (msg);
+    }
+    return 0;
+}
+
+/*
+*	What batch_sent() needs to know.
+*/
+struct flush_ctx {
+    struct event_loop *loop;
+    struct client_table *table;
+};
+
+/**
+*	\brief	Called by event_flush() as each batched send completes.
+*/
+static void batch_sent (void *cookie, long res, void *arg)
+{
+    const struct flush_ctx *const ctx = arg;
+    struct client_info *const slave = cookie;
+
+    if (res > 0) {
+        /*
+         * There may be more than one gather's worth queued. If the socket
+         * filled up instead, this finds out with EAGAIN.
+         */
+        metric_add (M_BYTES_OUT, (unsigned long long) res);
+        sendq_consume (&slave->sendq, (size_t) res);
+        flush_client (ctx->loop, slave, ctx->table);
+        return;
+    }
+    if (res < 0 && res != -EAGAIN && res != -EWOULDBLOCK) {
+        errno = (int) -res;
+        perror ("sendmsg()");
+        sendq_clear (&slave->sendq);
+    }
+    after_send (ctx->loop, slave, ctx->table);
+}
+
+void flush_pending (struct event_loop *loop, struct client_table *table)
+{
+    struct flush_ctx ctx = {.loop = loop,.table = table };
+    int batched = 0;
+
+    for (int i = 0; i < table->n_pending; i++) {
+        struct client_info *const slave =
+            unlist_client_entry (table->pending[i], table);
+
+        /*
+         * It may have been closed, or gone on to wait for writability, since
+         * it was listed.
+         */
+        if (!slave || slave->events & EV_WRITE
+            || sendq_empty (&slave->sendq)) {
+            continue;
+        }
+
+        struct iovec iov[MAX_GATHER];
+        size_t len;
+        const int iovcnt = sendq_iov (&slave->sendq, iov, MAX_GATHER, &len);
+
+        /*
+         * Backends that can batch take every client's sends in one
+         * submission.
+         */
+        if (event_sendv (loop, slave->sock, iov, iovcnt, slave) == 0) {
+            batched++;
+            continue;
+        }
+        flush_client (loop, slave, table);
+    }
+    table->n_pending = 0;
+
+    if (batched && event_flush (loop, batch_sent, &ctx) == -1) {
+        perror ("event_flush()");
+    }
+}
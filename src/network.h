@@ -1,15 +1,11 @@
 #ifndef NETWORK_H
 #define NETWORK_H
 
-#include <stddef.h>
-#include <sys/select.h>
+#include "client_info.h"
+#include "frame.h"
+#include "msgbuf.h"
 
-/* 
-*	Error codes for get_response().
-*/
-#define SS_NO_MEMORY	0
-#define SS_CLOSE_CONN	1
-#define SS_WOULD_BLOCK	2
+#include <stddef.h>
 
 /** 
 *	\brief	Calls send() in a loop to ensure that all data is sent. 
@@ -20,29 +16,54 @@
 */
 int send_internal (int slave_fd, const char *line, size_t *len);
 
-void send_response (size_t nbytes, const char *line, int sender_fd,
-                           int master_fd, fd_set master, int fd_max);
+struct event_loop;
 
 /**
-*	\brief	 Calls recv() in a loop to read as much as available. 	
-*  	\param	 nbytes	  - To store the number of bytes read.
-*  	\param	 slave_fd - The file descriptor to receive from.
-*	\param	 err_code - An out pointer to hold the error code in case of failure.
-
-*  	In case of an error, all allocated memory is freed and err_code
-*  	is set to one of the following:
-* 
-*  	1) SS_NO_MEMORY 	- The system is out of memory.	
-*  	2) SS_CLOSE_CONN 	- There was a recv() or fcntl() error.
-*  	3) SS_WOULD_BLOCK	- The socket has been marked unblocking, but a subsequent
-*					  	  call to recv() would block.
+*	\brief	Queues msg, by reference rather than by copy, for every member of
+*			room in table except sender_fd, to go out with flush_pending().
 *
-*  	\return	 A pointer to the line, or NULL on failure.
-*	
-*   \warning The caller is responsible for freeing the returned memory in
-*  			 case of success, else we risk exhaustion.
+*	A queue that would grow past cfg.queue_limit is dealt with according
+*	to cfg.slow_policy.
+*/
+void send_response (struct event_loop *loop, struct msgbuf *msg, int room,
+                    int sender_fd, struct client_table *table);
+
+/**
+*	\brief	Queues a frame, such as FRAME_PONG, for slave alone. A line client
+*			gets only the payload.
+*	\return	0 on success, or -1 if the system is out of memory.
+*/
+int send_frame (struct event_loop *loop, struct client_info *slave,
+                enum frame_type type, int room, const void *payload,
+                size_t len, struct client_table *table);
+
+/**
+*	\brief	Queues what was last said in room for slave, all in one message.
+*	\return	0 on success, or -1 if the system is out of memory.
+*/
+int send_history (struct event_loop *loop, struct client_info *slave,
+                  int room, struct client_table *table);
+
+/**
+*	\brief	Sends what has been queued since the last call, gathering each
+*			client's messages into one sendmsg(). If the loop's backend
+*			batches sends, they are all submitted together. Whatever a socket
+*			cannot take stays queued, and the loop is asked to report when it
+*			is writable.
+*/
+void flush_pending (struct event_loop *loop, struct client_table *table);
+
+/**
+*	\brief	Sends as much of slave's queue as its socket takes. Called when the
+*			loop reports it writable.
+*/
+void flush_client (struct event_loop *loop, struct client_info *slave,
+                   struct client_table *table);
+
+/**
+*	\brief	Throws away slave's queue, e.g. because it is being closed.
 */
-char *get_response (size_t *nbytes, int slave_fd,
-                           unsigned *err_code);
+void discard_output (struct event_loop *loop, struct client_info *slave,
+                     struct client_table *table);
 
 #endif /* NETWORK_H */
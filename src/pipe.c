@@ -5,6 +5,7 @@
 #include <unistd.h>
 #include <stddef.h>
 #include <errno.h>
+#include <signal.h>
 
 int set_pipe_nonblock (void)
 {
@@ -27,12 +28,23 @@ void close_pipe (void)
 
 int read_pipe (void)
 {
-    char ch = '\0';
+    char buf[64];
+    int sig = 0;
+    ssize_t n;
 
-    if (read (pfds[0], &ch, 1) == -1
-        && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-        return 0;
+    while ((n = read (pfds[0], buf, sizeof buf)) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            /*
+             * Any signal that stops the server wins over SIGUSR2.
+             */
+            if (!sig || sig == SIGUSR2) {
+                sig = (unsigned char) buf[i];
+            }
+        }
+    }
+    if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        return -1;
     }
-    return -1;
+    return sig;
 }
 
@@ -3,6 +3,11 @@
 
 int set_pipe_nonblock (void);
 void close_pipe (void);
+/**
+*	\brief	Empties the self pipe.
+*	\return	The signal that was caught, one that stops the server rather
+*			than SIGUSR2 if there were both, 0 if none was, or -1 on failure.
+*/
 int read_pipe (void);
 
 #endif /* PIPE_H */
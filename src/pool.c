@@ -0,0 +1,88 @@
+#include "pool.h"
+
+#include <stdlib.h>
+#include <stdalign.h>
+
+struct slab_chunk {
+    struct slab_chunk *next;
+    alignas (max_align_t) unsigned char objs[];
+};
+
+void slab_init (struct slab *s, size_t obj_size, unsigned per_chunk)
+{
+    const size_t align = alignof (max_align_t);
+
+    if (obj_size < sizeof (void *)) {
+        obj_size = sizeof (void *);
+    }
+    s->obj_size = (obj_size + align - 1) / align * align;
+    s->per_chunk = per_chunk ? per_chunk : 1;
+    s->free = 0;
+    s->chunks = 0;
+    s->stats = (struct pool_stats) { 0 };
+}
+
+/**
+*	\brief	Allocates a chunk and puts all its objects on the free list.
+*	\return	0 on success, or -1 on failure.
+*/
+static int grow (struct slab *s)
+{
+    const size_t size = sizeof (struct slab_chunk)
+        + s->per_chunk * s->obj_size;
+    struct slab_chunk *const chunk = malloc (size);
+
+    if (!chunk) {
+        return -1;
+    }
+    chunk->next = s->chunks;
+    s->chunks = chunk;
+    s->stats.resident += size;
+
+    /*
+     * Thread them last to first, so they are handed out in address order.
+     */
+    for (unsigned i = s->per_chunk; i-- > 0;) {
+        void **const obj = (void **) (void *) (chunk->objs + i * s->obj_size);
+
+        *obj = s->free;
+        s->free = obj;
+    }
+    return 0;
+}
+
+void *slab_alloc (struct slab *s)
+{
+    if (s->free) {
+        s->stats.hits++;
+    } else {
+        s->stats.misses++;
+
+        if (grow (s) == -1) {
+            return 0;
+        }
+    }
+
+    void **const obj = s->free;
+
+    s->free = *obj;
+    return obj;
+}
+
+void slab_free (struct slab *s, void *p)
+{
+    *(void **) p = s->free;
+    s->free = p;
+}
+
+void slab_destroy (struct slab *s)
+{
+    while (s->chunks) {
+        struct slab_chunk *const next = s->chunks->next;
+
+        free (s->chunks);
+        s->chunks = next;
+    }
+    s->free = 0;
+    s->stats.resident = 0;
+}
@@ -0,0 +1,56 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/*
+*	How well an allocator is doing. A hit is served from memory it already
+*	holds; a miss has to go to malloc().
+*/
+struct pool_stats {
+    unsigned long long hits;
+    unsigned long long misses;
+    size_t resident;            /* Bytes held, in use or free. */
+};
+
+struct slab_chunk;
+
+/*
+*	A fixed-size object allocator. Objects are carved out of chunks that are
+*	only given back when the slab is destroyed, so allocating and freeing
+*	is a pop and a push on a free list, and churn never fragments the heap.
+*	Not thread-safe: each slab belongs to one thread.
+*/
+struct slab {
+    size_t obj_size;
+    unsigned per_chunk;         /* Objects in each chunk. */
+    void *free;                 /* Linked through each object's first bytes. */
+    struct slab_chunk *chunks;
+    struct pool_stats stats;
+};
+
+/**
+*	\brief	Sets up an empty slab. No memory is allocated until the first
+*			slab_alloc().
+*	\param	obj_size  - The size of each object.
+*	\param	per_chunk - How many objects to allocate at a time.
+*/
+void slab_init (struct slab *s, size_t obj_size, unsigned per_chunk);
+
+/**
+*	\return	An uninitialised object, suitably aligned for any type, or NULL
+*			if the system is out of memory.
+*/
+void *slab_alloc (struct slab *s);
+
+/**
+*	\brief	Returns p, which must have come from s, to it.
+*/
+void slab_free (struct slab *s, void *p);
+
+/**
+*	\brief	Frees every chunk, and with them every object, in use or not.
+*/
+void slab_destroy (struct slab *s);
+
+#endif /* POOL_H */
@@ -0,0 +1,145 @@
+#ifdef _POSIX_C_SOURCE
+#undef _POSIX_C_SOURCE
+#endif
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "ratelimit.h"
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RATEMAP_CAP	4096        /* Addresses remembered per event loop. */
+#define RATE_PROBES	8
+
+/**
+*	\return	The limit on kind.
+*/
+static const struct rate_limit *limit_of (enum rate_kind kind)
+{
+    switch (kind) {
+        case RATE_CONNECT:
+            return &cfg.connect_rate;
+        case RATE_MESSAGES:
+            return &cfg.message_rate;
+        default:
+            return &cfg.byte_rate;
+    }
+}
+
+int ratemap_init (struct ratemap *m)
+{
+    *m = (struct ratemap) { 0 };
+
+    for (int k = 0; k < RATE_KINDS; k++) {
+        if (limit_of ((enum rate_kind) k)->rate > 0) {
+            m->cap = RATEMAP_CAP;
+        }
+    }
+    if (!m->cap) {
+        return 0;
+    }
+    if (!(m->slots = calloc (m->cap, sizeof *m->slots))) {
+        m->cap = 0;
+        return -1;
+    }
+
+    struct timespec ts;
+
+    clock_gettime (CLOCK_REALTIME, &ts);
+    m->seed = (uint32_t) ts.tv_nsec ^ (uint32_t) getpid () * 2654435761u;
+    return 0;
+}
+
+void ratemap_free (struct ratemap *m)
+{
+    free (m->slots);
+    *m = (struct ratemap) { 0 };
+}
+
+/*
+*	FNV-1a, from a seed.
+*/
+static uint32_t hash (const struct ratemap *m, const struct client_addr *addr)
+{
+    const unsigned char *const p = (const unsigned char *) addr;
+    uint32_t h = 2166136261u ^ m->seed;
+
+    for (size_t i = 0; i < sizeof *addr; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+/**
+*	\return	addr's entry, taking over the stalest of the slots it may be in
+*			if it has none.
+*/
+static struct rate_entry *lookup (struct ratemap *m,
+                                  const struct client_addr *addr,
+                                  long long now)
+{
+    const unsigned mask = m->cap - 1;
+    const unsigned home = hash (m, addr) & mask;
+    struct rate_entry *stalest = 0;
+
+    for (unsigned i = 0; i < RATE_PROBES; i++) {
+        struct rate_entry *const e = &m->slots[(home + i) & mask];
+
+        if (!memcmp (&e->addr, addr, sizeof *addr)) {
+            return e;
+        }
+        if (!e->addr.family) {
+            stalest = e;
+            break;
+        }
+        if (!stalest || e->last < stalest->last) {
+            stalest = e;
+        }
+    }
+    stalest->addr = *addr;
+    stalest->last = now;
+
+    for (int k = 0; k < RATE_KINDS; k++) {
+        stalest->tokens[k] = (float) limit_of ((enum rate_kind) k)->burst;
+    }
+    return stalest;
+}
+
+int rate_take (struct ratemap *m, const struct client_addr *addr,
+               const float cost[RATE_KINDS], long long now)
+{
+    /*
+     * Nothing is limited, or no one knows where the peer is.
+     */
+    if (!m->cap || !addr->family) {
+        return 1;
+    }
+
+    struct rate_entry *const e = lookup (m, addr, now);
+    const double secs = (double) (now - e->last) / 1e9;
+
+    e->last = now;
+
+    for (int k = 0; k < RATE_KINDS; k++) {
+        const struct rate_limit *const l = limit_of ((enum rate_kind) k);
+        const double t = e->tokens[k] + l->rate * secs;
+
+        e->tokens[k] = (float) (t < l->burst ? t : l->burst);
+    }
+    for (int k = 0; k < RATE_KINDS; k++) {
+        if (cost[k] > 0 && limit_of ((enum rate_kind) k)->rate > 0
+            && e->tokens[k] <= 0) {
+            return 0;
+        }
+    }
+    for (int k = 0; k < RATE_KINDS; k++) {
+        if (limit_of ((enum rate_kind) k)->rate > 0) {
+            e->tokens[k] -= cost[k];
+        }
+    }
+    return 1;
+}
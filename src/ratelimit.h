@@ -0,0 +1,56 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include "addrmap.h"
+
+#include <stdint.h>
+
+/*
+*	Per-address token buckets, one of each kind for every peer address an
+*	event loop has heard from lately.
+*/
+enum rate_kind {
+    RATE_CONNECT,               /* Connections accepted. */
+    RATE_MESSAGES,              /* Messages relayed. */
+    RATE_BYTES,                 /* Bytes of them. */
+    RATE_KINDS
+};
+
+struct rate_entry {
+    struct client_addr addr;    /* A family of 0 if the entry is free. */
+    float tokens[RATE_KINDS];
+    long long last;             /* When they were last topped up, in ns. */
+};
+
+/*
+*	A fixed-size, open-addressed table. An address is looked for in the
+*	RATE_PROBES slots from its home only, and takes the stalest of them if
+*	it is not there, so every lookup is O(1) however many addresses call,
+*	and an address forgotten that way has its buckets full anyway, or
+*	near enough.
+*/
+struct ratemap {
+    struct rate_entry *slots;
+    unsigned cap;               /* A power of 2, or 0 if nothing is limited. */
+    uint32_t seed;              /* So that peers cannot choose collisions. */
+};
+
+/**
+*	\brief	Sets up an empty table, if cfg asks for any limit.
+*	\return	0 on success, or -1 if the system is out of memory.
+*/
+int ratemap_init (struct ratemap *m);
+void ratemap_free (struct ratemap *m);
+
+/**
+*	\brief	Takes cost[kind] tokens from each of addr's buckets, if each has
+*			some left; a cost above what is left puts the bucket in debt,
+*			so a message larger than the burst is not refused forever.
+*	\param	now - CLOCK_MONOTONIC, in nanoseconds.
+*	\return	1 if they were taken, or 0 if addr is over a limit, in which
+*			case none were.
+*/
+int rate_take (struct ratemap *m, const struct client_addr *addr,
+               const float cost[RATE_KINDS], long long now);
+
+#endif /* RATELIMIT_H */
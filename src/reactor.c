@@ -0,0 +1,1615 @@
+#ifdef _POSIX_C_SOURCE
+#undef _POSIX_C_SOURCE
+#endif
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "reactor.h"
+#include "client_info.h"
+#include "command.h"
+#include "compress.h"
+#include "config.h"
+#include "err.h"
+#include "event.h"
+#include "evlog.h"
+#include "frame.h"
+#include "history.h"
+#include "internal.h"
+#include "journal.h"
+#include "metrics.h"
+#include "mpsc.h"
+#include "msgbuf.h"
+#include "network.h"
+#include "pipe.h"
+#include "ratelimit.h"
+#include "recvbuf.h"
+#include "room.h"
+#include "server.h"
+#include "tls.h"
+#include "upgrade.h"
+#include "utils.h"
+#include "wheel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+/*
+*	Upper bound on the events handled per wakeup.
+*/
+#define MAX_EVENTS 256
+#define ACCEPT_BUDGET 128       /* Connections accepted per pass. */
+
+/*
+*	One event loop and everything it owns. Only its own thread touches
+*	anything but inbox and signalled.
+*/
+struct reactor {
+    int id;
+    pthread_t thread;
+    int master_fd;
+    int wake_fd;                /* An eventfd that other reactors poke. */
+    struct event_loop *loop;
+    struct client_table table;
+    struct mpsc_queue inbox;
+    atomic_int signalled;       /* Whether wake_fd has been poked. */
+    long long batch_deadline;   /* When queued output must go, or 0. */
+    int accept_pending;         /* The backlog may not be empty yet. */
+    struct ratemap rates;       /* Per peer address. */
+    long long now;              /* When this pass started, in ns. */
+    long long tick_avg;         /* How long a pass takes, on average. */
+    int overloaded;             /* Counted in overloaded. */
+    int status;
+};
+
+enum relay_type {
+    RELAY_MSG,                  /* Send data to our members of a room. */
+    RELAY_EVICT                 /* Close older connections from an address. */
+};
+
+/*
+*	Something one reactor hands to all the others. It is allocated once,
+*	with a queue node for each reactor, and freed by the last one to be
+*	done with it.
+*/
+struct relay {
+    atomic_int refs;
+    enum relay_type type;
+    struct client_info slave_info;      /* RELAY_EVICT */
+    struct msgbuf *msg;                 /* RELAY_MSG */
+    int room;                           /* RELAY_MSG */
+    struct mpsc_node nodes[];           /* One per reactor. */
+};
+
+static struct reactor *reactors;
+static int n_reactors;
+static atomic_bool stopping;
+
+/*
+*	Orders connections across reactors, so that evictions racing each other
+*	keep the newest connection rather than none.
+*/
+static atomic_ullong serials;
+
+/*
+*	How many reactors are overloaded. While any is, every reactor turns
+*	new connections away.
+*/
+static atomic_int overloaded;
+
+/*
+*	A live upgrade (see upgrade.h), which the first reactor runs: the socket
+*	to the new process, or -1. While handing_over is set, the other reactors
+*	park, and the first hands over what they all have; parked counts them,
+*	and park_gen moves on once they may go on.
+*/
+static int upgrade_chan = -1;
+static atomic_bool handing_over;
+static pthread_mutex_t park_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t park_cond = PTHREAD_COND_INITIALIZER;
+static int parked;
+static unsigned park_gen;
+
+static void wake (struct reactor *r)
+{
+    if (!atomic_exchange (&r->signalled, 1)) {
+        const uint64_t one = 1;
+
+        if (write (r->wake_fd, &one, sizeof one) == -1 && errno != EAGAIN) {
+            perror ("write()");
+        }
+    }
+}
+
+static void stop_all (void)
+{
+    atomic_store (&stopping, 1);
+
+    for (int i = 0; i < n_reactors; i++) {
+        wake (&reactors[i]);
+    }
+    /*
+     * The first reactor may be waiting for this one to park.
+     */
+    pthread_mutex_lock (&park_lock);
+    pthread_cond_broadcast (&park_cond);
+    pthread_mutex_unlock (&park_lock);
+}
+
+static struct relay *new_relay (enum relay_type type)
+{
+    struct relay *const rl = malloc (sizeof *rl
+                                     + (size_t) n_reactors
+                                     * sizeof rl->nodes[0]);
+
+    if (!rl) {
+        perror ("malloc()");
+        return 0;
+    }
+    atomic_init (&rl->refs, n_reactors - 1);
+    rl->type = type;
+    rl->msg = 0;
+    return rl;
+}
+
+static void put_relay (struct relay *rl)
+{
+    if (atomic_fetch_sub (&rl->refs, 1) == 1) {
+        if (rl->msg) {
+            msgbuf_put (rl->msg);
+        }
+        free (rl);
+    }
+}
+
+/**
+*	\brief	Hands rl to every reactor but r.
+*/
+static void post_relay (const struct reactor *r, struct relay *rl)
+{
+    for (int i = 0; i < n_reactors; i++) {
+        if (i != r->id) {
+            mpsc_push (&reactors[i].inbox, &rl->nodes[i]);
+            wake (&reactors[i]);
+        }
+    }
+}
+
+/**
+*	\brief	Sends msg to our members of room other than sender_fd, and to
+*			every member the other reactors have.
+*/
+static void broadcast (struct reactor *r, struct msgbuf *msg, int room,
+                       int sender_fd)
+{
+    const long long start = metrics_now ();
+
+    send_response (r->loop, msg, room, sender_fd, &r->table);
+
+    if (n_reactors > 1) {
+        struct relay *const rl = new_relay (RELAY_MSG);
+
+        if (rl) {
+            rl->msg = msgbuf_get (msg);
+            rl->room = room;
+            post_relay (r, rl);
+        }
+    }
+    metric_observe (H_FANOUT, metrics_now () - start);
+}
+
+/**
+*	\brief	Handles whatever the other reactors have sent us.
+*/
+static void drain_inbox (struct reactor *r)
+{
+    uint64_t count;
+
+    if (read (r->wake_fd, &count, sizeof count) == -1 && errno != EAGAIN) {
+        perror ("read()");
+    }
+    /*
+     * Clear the flag before draining: anything pushed from here on wakes
+     * us again, and anything pushed before is drained below.
+     */
+    atomic_store (&r->signalled, 0);
+
+    struct mpsc_node *node;
+
+    while ((node = mpsc_pop (&r->inbox))) {
+        struct relay *const rl =
+            (struct relay *) (void *) ((char *) (node - r->id)
+                                       - offsetof (struct relay, nodes));
+
+        switch (rl->type) {
+            case RELAY_MSG:{
+                    const long long start = metrics_now ();
+
+                    send_response (r->loop, rl->msg, rl->room, -1, &r->table);
+                    metric_observe (H_FANOUT, metrics_now () - start);
+                    break;
+                }
+            case RELAY_EVICT:
+                remove_existing_connection (r->loop, &rl->slave_info,
+                                            &r->table);
+                break;
+        }
+        put_relay (rl);
+    }
+}
+
+/**
+*	\return	When slave's next deadline falls, in ms, or -1 if it has none.
+*			A client that has not yet said which protocol it speaks has
+*			cfg.handshake_timeout to do so, any client cfg.idle_timeout
+*			to say anything, and a binary one cfg.ping_interval before it
+*			is pinged, and as long again to answer.
+*/
+static long long next_deadline (const struct client_info *slave)
+{
+    long long when = -1;
+
+    if (cfg.handshake_timeout && slave->rbuf.mode == RECV_UNDECIDED) {
+        when = slave->since + cfg.handshake_timeout * 1000LL;
+    }
+    if (cfg.idle_timeout) {
+        const long long idle = slave->active + cfg.idle_timeout * 1000LL;
+
+        when = when == -1 || idle < when ? idle : when;
+    }
+    if (cfg.ping_interval && slave->rbuf.mode == RECV_FRAMES) {
+        const long long ping = slave->active + cfg.ping_interval * 1000LL
+            * (slave->flags & CLIENT_PINGED ? 2 : 1);
+
+        when = when == -1 || ping < when ? ping : when;
+    }
+    return when;
+}
+
+/**
+*	\brief	Schedules slave's timer for its next deadline, if it has one.
+*/
+static void arm (struct reactor *r, struct client_info *slave)
+{
+    const long long when = next_deadline (slave);
+
+    if (when == -1) {
+        timer_cancel (&r->table.timers, &slave->timer);
+    } else {
+        timer_schedule (&r->table.timers, &slave->timer, when);
+    }
+}
+
+/**
+*	\brief	Notes that slave has sent something. Its timer is left where it
+*			is: moving it on every read would cost more than letting it
+*			fire early and be rescheduled.
+*/
+static void touch (struct reactor *r, struct client_info *slave)
+{
+    slave->active = r->now / 1000000;
+    slave->flags &= ~(unsigned) CLIENT_PINGED;
+}
+
+/**
+*	\brief	Acts on the deadline of the client whose timer has expired:
+*			disconnects it if it has run out of time, pings it if it has
+*			gone quiet, and otherwise schedules the timer again.
+*/
+static void on_timer (struct timer *t, void *arg)
+{
+    struct reactor *const r = arg;
+    struct client_info *const slave =
+        (struct client_info *) (void *) ((char *) t
+                                         - offsetof (struct client_info,
+                                                     timer));
+    const long long now = r->now / 1000000;
+
+    if (cfg.handshake_timeout && slave->rbuf.mode == RECV_UNDECIDED
+        && now >= slave->since + cfg.handshake_timeout * 1000LL) {
+        log_event (SS_HANDSHAKE_TIMEOUT, PROGRAM_NAME, slave->sock,
+                   cfg.handshake_timeout);
+    } else if (cfg.idle_timeout
+               && now >= slave->active + cfg.idle_timeout * 1000LL) {
+        log_event (SS_IDLE_TIMEOUT, PROGRAM_NAME, slave->sock,
+                   cfg.idle_timeout);
+    } else if (cfg.ping_interval && slave->rbuf.mode == RECV_FRAMES
+               && slave->flags & CLIENT_PINGED
+               && now >= slave->active + cfg.ping_interval * 2000LL) {
+        log_event (SS_IDLE_TIMEOUT, PROGRAM_NAME, slave->sock,
+                   cfg.ping_interval * 2);
+    } else {
+        if (cfg.ping_interval && slave->rbuf.mode == RECV_FRAMES
+            && !(slave->flags & CLIENT_PINGED)
+            && now >= slave->active + cfg.ping_interval * 1000LL) {
+            const int slave_fd = slave->sock;
+
+            if (send_frame (r->loop, slave, FRAME_PING, 0, 0, 0,
+                            &r->table) == -1) {
+                perror ("malloc()");
+            }
+            /*
+             * The slow-consumer policy may have dropped it.
+             */
+            if (find_client_by_fd (&r->table, slave_fd) != slave) {
+                return;
+            }
+            slave->flags |= CLIENT_PINGED;
+            metric_add (M_PINGS, 1);
+        }
+        arm (r, slave);
+        return;
+    }
+    metric_add (M_TIMED_OUT, 1);
+    drop_connection (r->loop, slave, &r->table);
+}
+
+/**
+*	\brief	Puts a connection that is ready to talk in the lobby, and sends
+*			it what was said there.
+*	\return	0 on success, or -1 if the system is out of memory.
+*/
+static int welcome (struct reactor *r, struct client_info *slave)
+{
+    return room_join (&r->table, slave, ROOM_LOBBY) == 0
+        && send_history (r->loop, slave, ROOM_LOBBY, &r->table) == 0 ? 0 : -1;
+}
+
+/**
+*	\return	0 on success, or -1 if the system is out of memory.
+*/
+static int start_tls (struct client_info *slave)
+{
+    return (slave->tls = tls_accept (slave->sock)) ? 0 : -1;
+}
+
+/**
+*	\brief	Takes slave's TLS handshake as far as it will go. Once it is
+*			done, the kernel has the session, and slave is received from
+*			and welcomed like any other client; until then it is in no
+*			room, so nothing is queued for it.
+*/
+static void handshake (struct reactor *r, struct client_info *slave)
+{
+    const char *why;
+    unsigned events;
+
+    switch (tls_handshake (slave->tls, &events, &why)) {
+        case 0:
+            if (events != slave->events
+                && event_mod (r->loop, slave->sock, events) == 0) {
+                slave->events = events;
+            }
+            return;
+        case -1:
+            log_event (SS_TLS_FAILED, PROGRAM_NAME, slave->sock, why);
+            drop_connection (r->loop, slave, &r->table);
+            return;
+    }
+    tls_close (slave->tls);
+    slave->tls = 0;
+
+    if (event_mod (r->loop, slave->sock, EV_RECV) == -1) {
+        perror ("event_mod()");
+        drop_connection (r->loop, slave, &r->table);
+        return;
+    }
+    slave->events = EV_RECV;
+
+    if (welcome (r, slave) == -1) {
+        perror ("malloc()");
+        drop_connection (r->loop, slave, &r->table);
+    }
+}
+
+/**
+*	\brief	Admits a newly accepted connection, or turns it away if we are full,
+*			overloaded, or its address is connecting too often.
+*/
+static void admit_connection (struct reactor *r, int slave_fd,
+                              struct client_info *slave_info)
+{
+    /*
+     * Shed what we cannot serve before spending anything on it.
+     */
+    if (atomic_load_explicit (&overloaded, memory_order_relaxed)) {
+        metric_add (M_SHED, 1);
+        excuse_server (slave_fd);
+        close_descriptor (slave_fd);
+        return;
+    }
+    if (!rate_take (&r->rates, &slave_info->address,
+                    (const float[RATE_KINDS]) {[RATE_CONNECT] = 1}, r->now)) {
+        metric_add (M_RATE_LIMITED, 1);
+        close_descriptor (slave_fd);
+        return;
+    }
+    slave_info->serial = atomic_fetch_add (&serials, 1) + 1;
+
+    /*
+     * We will forcibly close any existing connections from the new
+     * connection's IP address. This mean that any given attacking 
+     * computer could only tie up a maximum of one socket on the 
+     * server at a time, which would make it harder for that attacker
+     * to DOS the machine, unless the attacker has access to a number 
+     * of client machines.
+     *
+     * The other reactors may hold some of them too.
+     */
+    if (cfg.evict_same_address) {
+        remove_existing_connection (r->loop, slave_info, &r->table);
+
+        if (n_reactors > 1) {
+            struct relay *const rl = new_relay (RELAY_EVICT);
+
+            if (rl) {
+                rl->slave_info = *slave_info;
+                post_relay (r, rl);
+            }
+        }
+    }
+
+    const int entry = find_empty_slot (&r->table);
+
+    /*
+     * A TLS client is watched for readiness until the kernel has its
+     * session, even by completion backends, since OpenSSL does the reading.
+     */
+    slave_info->events = cfg.tls_cert ? EV_READ : EV_RECV;
+    slave_info->since = r->now / 1000000;
+
+    if (entry != -1
+        && fill_client_entry (slave_fd, entry, &r->table, slave_info) == 0) {
+        struct client_info *const slave = r->table.p_slaves[entry];
+
+        /*
+         * What was said in the lobby goes out with this pass's output.
+         */
+        if (event_add (r->loop, slave_fd, slave->events) == 0
+            && (cfg.tls_cert ? start_tls (slave) : welcome (r, slave)) == 0) {
+            arm (r, slave);
+            metric_add (M_ACCEPTED, 1);
+
+            /*
+             * Its ClientHello may be in already.
+             */
+            if (slave->tls) {
+                handshake (r, slave);
+            }
+            return;
+        }
+        clear_client_entry (entry, &r->table);
+    }
+    metric_add (M_REJECTED, 1);
+    log_event (SS_OVERLOAD, PROGRAM_NAME);
+    excuse_server (slave_fd);
+    close_descriptor (slave_fd);
+}
+
+/**
+*	\brief	Accepts connections until the backlog is empty, or ACCEPT_BUDGET
+*			of them, so that a storm of them cannot starve the clients
+*			already connected. What is left is accepted on the next pass
+*			through the loop, which does not wait for it: the listener may
+*			not be reported again until more arrive.
+*/
+static void accept_connections (struct reactor *r)
+{
+    r->accept_pending = 0;
+
+    for (int budget = ACCEPT_BUDGET; budget; budget--) {
+        struct client_info slave_info = { 0 };
+        const int slave_fd = accept_new_connection (r->master_fd,
+                                                    &slave_info);
+
+        if (slave_fd == -1) {
+            if (errno == ECONNABORTED || errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        admit_connection (r, slave_fd, &slave_info);
+    }
+    r->accept_pending = 1;
+}
+
+static struct client_info *find_client (struct reactor *r, int slave_fd)
+{
+    return find_client_by_fd (&r->table, slave_fd);
+}
+
+/**
+*	\brief	Tells whether slave, last known to be on slave_fd, is still
+*			connected. Anything sent to it may have dropped it, and its
+*			record is not to be read once it has been.
+*/
+static int still_connected (struct reactor *r, const struct client_info *slave,
+                            int slave_fd)
+{
+    return find_client (r, slave_fd) == slave;
+}
+
+/**
+*	\brief	Forgets about a client and closes its socket.
+*/
+static void drop_client (struct reactor *r, int slave_fd)
+{
+    struct client_info *const key = find_client (r, slave_fd);
+
+    if (key) {
+        drop_connection (r->loop, key, &r->table);
+        return;
+    }
+    event_del (r->loop, slave_fd);
+    close_descriptor (slave_fd);
+}
+
+/**
+*	\brief	Sends what is queued for a client whose socket has drained, or
+*			goes on with its TLS handshake.
+*/
+static void flush_slave (struct reactor *r, int slave_fd)
+{
+    struct client_info *const key = find_client (r, slave_fd);
+
+    if (key && key->tls) {
+        handshake (r, key);
+    } else if (key) {
+        flush_client (r->loop, key, &r->table);
+    }
+}
+
+/**
+*	\brief	Relays a message from slave to the rest of the room it is for, if
+*			slave is in it.
+*/
+static int speak (struct reactor *r, struct client_info *slave,
+                  struct msgbuf *msg)
+{
+    struct frame f;
+
+    frame_decode ((const unsigned char *) msg->data, &f);
+
+    if (room_has (slave, f.room)) {
+        /*
+         * A flood is dropped here, before it costs anyone else anything.
+         */
+        if (!rate_take (&r->rates, &slave->address, (const float[RATE_KINDS]) {
+                        [RATE_MESSAGES] = 1,
+                        [RATE_BYTES] = (float) (msg->len - FRAME_HDR_LEN)},
+                        r->now)) {
+            metric_add (M_THROTTLED, 1);
+            return 0;
+        }
+        compress_message (msg);
+        history_add (f.room, msg);
+        journal_append (f.room, msg, &slave->address, r->now);
+        broadcast (r, msg, f.room, slave->sock);
+        return 0;
+    }
+    return send_error (r->loop, slave, f.room, slave->room == -1
+                       ? "Join a room first." : "You are not in that room.",
+                       &r->table);
+}
+
+/**
+*	\brief	Acts on everything slave has sent in full so far: messages are
+*			relayed to the rest of their room, and commands and control
+*			frames answered. A client
+*			whose line can never complete, or that breaks the framing, is
+*			disconnected.
+*	\return	0 on success, or -1 if the system is out of memory.
+*/
+static int deliver (struct reactor *r, struct client_info *slave)
+{
+    const int slave_fd = slave->sock;
+    struct msgbuf *msg;
+    int ret_val;
+
+    while (still_connected (r, slave, slave_fd)
+           && (ret_val = recvbuf_take (&slave->rbuf, (uint16_t) slave->room,
+                                       &msg)) != RECV_NONE) {
+        /*
+         * A line client in no room has a room of -1, which wraps to one
+         * that no one can be in.
+         */
+        switch (ret_val) {
+            case RECV_MESSAGE:
+            case RECV_COMMAND:
+                ret_val = ret_val == RECV_MESSAGE
+                    ? speak (r, slave, msg)
+                    : run_command (r->loop, slave, msg, &r->table);
+                msgbuf_put (msg);
+
+                if (ret_val == -1) {
+                    perror ("malloc()");
+                    return -1;
+                }
+                break;
+            case RECV_HELLO:
+                /*
+                 * Whatever is already queued goes out framed too, and it is
+                 * pinged from now on.
+                 */
+                sendq_reskip (&slave->sendq, 0);
+                arm (r, slave);
+                /* FALLTHROUGH */
+            case RECV_PING:
+                if (send_frame (r->loop, slave, ret_val == RECV_HELLO
+                                ? FRAME_HELLO : FRAME_PONG, 0, 0, 0,
+                                &r->table) == -1) {
+                    perror ("malloc()");
+                    return -1;
+                }
+                break;
+            case RECV_PONG:
+                /*
+                 * Receiving it was enough to show the client is alive.
+                 */
+                break;
+            case RECV_INVALID:
+                /*
+                 * Likely a DOS attack.
+                 */
+                if (slave->rbuf.mode == RECV_FRAMES) {
+                    log_event (SS_BAD_FRAME, PROGRAM_NAME, slave_fd);
+                } else {
+                    log_event (SS_LINE_TOO_LONG, PROGRAM_NAME, slave_fd,
+                               RECVBUF_LEN);
+                }
+                drop_connection (r->loop, slave, &r->table);
+                break;
+            default:
+                perror ("malloc()");
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+*	\brief	Reads from a client until it runs dry, relaying each complete
+*			message to everyone else.
+*	\return	0 on success, or -1 if the system is out of memory.
+*/
+static int handle_client (struct reactor *r, int slave_fd)
+{
+    struct client_info *const slave = find_client (r, slave_fd);
+
+    if (!slave) {
+        return 0;
+    }
+    if (slave->tls) {
+        handshake (r, slave);
+        return 0;
+    }
+
+    /*
+     * The backend may be edge-triggered, so read until the socket is empty,
+     * unless the client is paused on the way.
+     */
+    while (still_connected (r, slave, slave_fd)
+           && !(slave->flags & CLIENT_PAUSED)) {
+        const ssize_t n = recvbuf_read (&slave->rbuf, &r->table.rings,
+                                        slave_fd);
+
+        if (n > 0) {
+            metric_add (M_BYTES_IN, (unsigned long long) n);
+            touch (r, slave);
+
+            if (deliver (r, slave) == -1) {
+                return -1;
+            }
+            continue;
+        }
+        if (n == 0) {
+            log_event (SS_CLOSED_CONN, PROGRAM_NAME, slave_fd);
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno == ENOMEM) {
+            perror ("malloc()");
+            return -1;
+        }
+        drop_connection (r->loop, slave, &r->table);
+        break;
+    }
+    return 0;
+}
+
+/**
+*	\brief	Frames what a completion backend has received for a client, and
+*			relays the complete messages.
+*	\return	0 on success, or -1 if the system is out of memory.
+*/
+static int receive_data (struct reactor *r, int slave_fd, const char *data,
+                         size_t len)
+{
+    struct client_info *const slave = find_client (r, slave_fd);
+
+    metric_add (M_BYTES_IN, len);
+
+    if (slave && len) {
+        touch (r, slave);
+    }
+    while (slave && still_connected (r, slave, slave_fd) && len) {
+        const ssize_t n = recvbuf_append (&slave->rbuf, &r->table.rings,
+                                          data, len);
+
+        if (n == -1) {
+            perror ("malloc()");
+            return -1;
+        }
+        data += n;
+        len -= (size_t) n;
+
+        if (deliver (r, slave) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static long long now_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/**
+*	\brief	Sends what this pass over the ready descriptors queued, unless
+*			it may wait for more.
+*/
+static void flush_due (struct reactor *r)
+{
+    if (!r->table.n_pending) {
+        return;
+    }
+    if (cfg.batch_delay) {
+        const long long now = now_ms ();
+
+        if (!r->batch_deadline) {
+            r->batch_deadline = now + cfg.batch_delay;
+        }
+        if (now < r->batch_deadline) {
+            return;
+        }
+    }
+    flush_pending (r->loop, &r->table);
+    r->batch_deadline = 0;
+}
+
+/**
+*	\return	How long event_wait() may block without output or a client's
+*			deadline waiting too long, or 0 if there are connections left
+*			to accept.
+*/
+static int wait_timeout (const struct reactor *r)
+{
+    if (r->accept_pending) {
+        return 0;
+    }
+
+    const long long now = now_ms ();
+    const int timers = wheel_timeout (&r->table.timers, now);
+
+    if (!r->batch_deadline) {
+        return timers;
+    }
+
+    const long long left = r->batch_deadline - now;
+    const int batch = left > 0 ? (int) left : 0;
+
+    return timers == -1 || batch < timers ? batch : timers;
+}
+
+/**
+*	\brief	Keeps an average of how long r takes over a pass, and puts the
+*			server in or out of overload on its account.
+*/
+static void watch_load (struct reactor *r, long long tick)
+{
+    const long long limit = (long long) cfg.overload_ms * 1000000;
+
+    if (!limit) {
+        return;
+    }
+    r->tick_avg += (tick - r->tick_avg) / 8;
+
+    if (!r->overloaded && r->tick_avg > limit) {
+        r->overloaded = 1;
+        atomic_fetch_add (&overloaded, 1);
+        log_event (SS_SHEDDING, PROGRAM_NAME, r->id,
+                   (int) (r->tick_avg / 1000000));
+    } else if (r->overloaded && r->tick_avg < limit / 2) {
+        r->overloaded = 0;
+        atomic_fetch_sub (&overloaded, 1);
+        log_event (SS_RECOVERED, PROGRAM_NAME, r->id);
+    }
+}
+
+static int dispatch (struct reactor *r, const struct event *events, int n);
+
+/**
+*	\brief	Stops the kernel receiving and accepting for r, handles what it
+*			had already, and sends what that queued, so that all r has left
+*			is in its table.
+*	\return	0 on success, 1 if the server is to stop, or -1 on failure.
+*/
+static int quiesce (struct reactor *r)
+{
+    struct event events[MAX_EVENTS];
+    int ret_val;
+
+    while ((ret_val = event_quiesce (r->loop)) == 1) {
+        const int n = event_wait (r->loop, events, MAX_EVENTS, 0);
+
+        if (n == -1) {
+            perror ("event_wait()");
+            return -1;
+        }
+        r->now = metrics_now ();
+
+        if ((ret_val = dispatch (r, events, n))) {
+            return ret_val;
+        }
+    }
+    if (ret_val == -1) {
+        perror ("event_quiesce()");
+        return -1;
+    }
+    flush_pending (r->loop, &r->table);
+    r->batch_deadline = 0;
+    return 0;
+}
+
+/**
+*	\brief	Stops r, one of the other reactors, until the first is done
+*			handing over.
+*	\return	0 on success, or -1 on failure.
+*/
+static int park (struct reactor *r)
+{
+    if (quiesce (r)) {
+        stop_all ();
+        return -1;
+    }
+    pthread_mutex_lock (&park_lock);
+
+    const unsigned gen = park_gen;
+
+    parked++;
+    pthread_cond_broadcast (&park_cond);
+
+    while (park_gen == gen) {
+        pthread_cond_wait (&park_cond, &park_lock);
+    }
+    pthread_mutex_unlock (&park_lock);
+    return 0;
+}
+
+/**
+*	\brief	Sends the new process every reactor's listener, the rooms, and
+*			every reactor's clients but those still in a TLS handshake.
+*	\return	The number of clients handed over, or -1 on failure.
+*/
+static int hand_over (int chan)
+{
+    struct upgrade_record rec;
+    char data[UPGRADE_CHUNK];
+    int handed = 0;
+    int fd;
+
+    for (int i = 0; i < n_reactors; i++) {
+        if (upgrade_send (chan, UPGRADE_LISTENER, 0, 0,
+                          reactors[i].master_fd) == -1) {
+            return -1;
+        }
+    }
+    for (int room = ROOM_LOBBY + 1, n = room_count (); room < n; room++) {
+        const char *const name = room_name (room);
+
+        if (upgrade_send (chan, UPGRADE_ROOM, name, strlen (name), -1) == -1) {
+            return -1;
+        }
+    }
+    for (int i = 0; i < n_reactors; i++) {
+        const struct client_table *const table = &reactors[i].table;
+
+        for (int j = 0; j < table->count; j++) {
+            if (table->members[j]->tls) {
+                continue;
+            }
+            if (upgrade_send_client (chan, i, table->members[j]) == -1) {
+                return -1;
+            }
+            handed++;
+        }
+    }
+    rec = (struct upgrade_record) {
+        .type = UPGRADE_END,.total = atomic_load (&serials)
+    };
+    if (upgrade_send_record (chan, &rec, 0, -1) == -1
+        || upgrade_recv (chan, &rec, data, &fd) != 1) {
+        return -1;
+    }
+    if (fd != -1) {
+        close_descriptor (fd);
+    }
+    return rec.type == UPGRADE_DONE ? handed : -1;
+}
+
+/**
+*	\brief	Has every reactor receive and accept again, after a handover
+*			that failed.
+*/
+static void resume (void)
+{
+    for (int i = 0; i < n_reactors; i++) {
+        struct reactor *const r = &reactors[i];
+
+        if (event_mod (r->loop, r->master_fd, EV_ACCEPT) == -1) {
+            perror ("event_mod()");
+        }
+        for (int j = r->table.count - 1; j >= 0; j--) {
+            struct client_info *const slave = r->table.members[j];
+
+            if (event_mod (r->loop, slave->sock, slave->events) == -1) {
+                perror ("event_mod()");
+                drop_connection (r->loop, slave, &r->table);
+            }
+        }
+    }
+}
+
+/**
+*	\brief	Parks every reactor, and hands over everything they have. If
+*			that works, the server stops; otherwise it carries on.
+*/
+static void start_handover (struct reactor *r)
+{
+    const char *why = 0;
+    int handed = -1;
+
+    event_del (r->loop, upgrade_chan);
+    atomic_store (&handing_over, 1);
+
+    for (int i = 1; i < n_reactors; i++) {
+        wake (&reactors[i]);
+    }
+
+    const int quiesced = quiesce (r);
+
+    if (quiesced == 1) {
+        stop_all ();
+    }
+    pthread_mutex_lock (&park_lock);
+
+    while (parked < n_reactors - 1 && !atomic_load (&stopping)) {
+        pthread_cond_wait (&park_cond, &park_lock);
+    }
+    if (quiesced || atomic_load (&stopping)) {
+        why = "the server is stopping";
+    } else {
+        /*
+         * What the others were sent before they parked goes out first.
+         */
+        for (int i = 0; i < n_reactors; i++) {
+            drain_inbox (&reactors[i]);
+            flush_pending (reactors[i].loop, &reactors[i].table);
+        }
+        if ((handed = hand_over (upgrade_chan)) == -1) {
+            why = "the new process did not take over";
+        }
+    }
+    if (why) {
+        resume ();
+        upgrade_abort (upgrade_chan);
+        log_event (SS_UPGRADE_FAILED, PROGRAM_NAME, why);
+    } else {
+        close_descriptor (upgrade_chan);
+        atomic_store (&stopping, 1);
+        log_event (SS_HANDED_OVER, PROGRAM_NAME, handed);
+    }
+    upgrade_chan = -1;
+    atomic_store (&handing_over, 0);
+    parked = 0;
+    park_gen++;
+    pthread_cond_broadcast (&park_cond);
+    pthread_mutex_unlock (&park_lock);
+}
+
+/**
+*	\brief	Hears from the new process, which says it is ready, or has
+*			gone.
+*/
+static void on_upgrade (struct reactor *r)
+{
+    struct upgrade_record rec;
+    char data[UPGRADE_CHUNK];
+    int fd;
+
+    if (upgrade_recv (upgrade_chan, &rec, data, &fd) == 1
+        && rec.type == UPGRADE_READY && fd == -1) {
+        start_handover (r);
+        return;
+    }
+    if (fd != -1) {
+        close_descriptor (fd);
+    }
+    event_del (r->loop, upgrade_chan);
+    upgrade_abort (upgrade_chan);
+    upgrade_chan = -1;
+    log_event (SS_UPGRADE_FAILED, PROGRAM_NAME, "the new process did not start");
+}
+
+/**
+*	\brief	Starts the new process, on SIGUSR2, unless an upgrade is under
+*			way already.
+*/
+static void start_upgrade (struct reactor *r)
+{
+    if (upgrade_chan != -1) {
+        return;
+    }
+    if ((upgrade_chan = upgrade_spawn ()) == -1) {
+        log_event (SS_UPGRADE_FAILED, PROGRAM_NAME,
+                   "the new process could not be started");
+        return;
+    }
+    if (event_add (r->loop, upgrade_chan, EV_READ) == -1) {
+        perror ("event_add()");
+        upgrade_abort (upgrade_chan);
+        upgrade_chan = -1;
+        return;
+    }
+    log_event (SS_UPGRADE_STARTED, PROGRAM_NAME);
+}
+
+/**
+*	\brief	Handles a batch of events from event_wait().
+*	\return	0 on success, 1 if the server is to stop, or -1 on allocation
+*			failure.
+*/
+static int dispatch (struct reactor *r, const struct event *events, int n)
+{
+    /*
+     * Only the descriptors that are ready are visited.
+     */
+    for (int i = 0; i < n; i++) {
+        const int fd = events[i].fd;
+
+        if (fd == pfds[0]) {
+            const int sig = read_pipe ();
+
+            if (sig == SIGUSR2) {
+                start_upgrade (r);
+            } else if (sig) {
+                /*
+                 * Handler was called.
+                 */
+                return 1;
+            }
+        } else if (!r->id && fd == upgrade_chan) {
+            on_upgrade (r);
+
+            /*
+             * Anything else is the new process's to handle now.
+             */
+            if (atomic_load (&stopping)) {
+                return 1;
+            }
+        } else if (fd == r->wake_fd) {
+            drain_inbox (r);
+        } else if (events[i].events & EV_ACCEPT) {
+            /*
+             * The backend has accepted it for us.
+             */
+            struct client_info slave_info = { 0 };
+
+            init_connection (events[i].res, &slave_info);
+            admit_connection (r, events[i].res, &slave_info);
+        } else if (fd == r->master_fd) {
+            accept_connections (r);
+        } else {
+            const unsigned ev = events[i].events;
+
+            if (ev & EV_WRITE) {
+                flush_slave (r, fd);
+            }
+            if (ev & EV_DATA) {
+                if (receive_data (r, fd, events[i].data,
+                                  events[i].len) == -1) {
+                    return -1;
+                }
+            } else if (ev & EV_HUP && !(ev & EV_READ)) {
+                log_event (SS_CLOSED_CONN, PROGRAM_NAME, fd);
+                drop_client (r, fd);
+            } else if (ev & EV_READ && handle_client (r, fd) == -1) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+*	\brief	Waits for events and handles new connections.
+*	\return 0 on SIGINT, or -1 on allocation or event_wait() failure.
+*/
+static int handle_connections (struct reactor *r)
+{
+    struct event events[MAX_EVENTS];
+
+    while (!atomic_load (&stopping)) {
+        if (atomic_load (&handing_over)) {
+            if (park (r) == -1) {
+                return -1;
+            }
+            continue;
+        }
+
+        const int n = event_wait (r->loop, events, MAX_EVENTS,
+                                  wait_timeout (r));
+
+        if (n == -1) {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+                continue;
+            }
+            perror ("event_wait()");
+            return -1;
+        }
+
+        const long long start = r->now = metrics_now ();
+
+        metric_add (M_WAKEUPS, 1);
+
+        /*
+         * Deadlines are checked once per pass, a slot at a time, however
+         * many clients there are.
+         */
+        if (r->table.timers.count) {
+            wheel_advance (&r->table.timers, start / 1000000, on_timer, r);
+        }
+        if (r->accept_pending) {
+            accept_connections (r);
+        }
+
+        const int ret_val = dispatch (r, events, n);
+
+        if (ret_val) {
+            return ret_val == 1 ? 0 : -1;
+        }
+        /*
+         * Everything queued for a client while handling this batch of
+         * events goes out in one system call.
+         */
+        flush_due (r);
+
+        const long long tick = metrics_now () - start;
+
+        metric_observe (H_TICK, tick);
+        watch_load (r, tick);
+    }
+    return 0;
+}
+
+/**
+*	\brief	Logs how the allocators fared. Must be called on r's thread.
+*/
+static void log_pool_stats (const struct reactor *r)
+{
+    struct pool_stats msgs;
+    const struct {
+        const char *name;
+        const struct pool_stats *stats;
+    } pools[] = {
+        { "connection records", &r->table.records.stats },
+        { "receive rings", &r->table.rings.stats },
+        { "messages", &msgs },
+    };
+
+    msgbuf_stats (&msgs);
+
+    for (size_t i = 0; i < ARRAY_CARDINALITY (pools); i++) {
+        log_event (SS_POOL_STATS, PROGRAM_NAME, r->id, pools[i].name,
+                   pools[i].stats->hits, pools[i].stats->misses,
+                   pools[i].stats->resident);
+    }
+}
+
+static void *reactor_main (void *arg)
+{
+    struct reactor *const r = arg;
+
+    r->status = handle_connections (r);
+    /*
+     * Whichever reactor stops first, be it on a signal or an error,
+     * takes the rest down with it.
+     */
+    stop_all ();
+    log_pool_stats (r);
+    msgbuf_drain ();
+    compress_drain ();
+    evlog_detach ();
+    return 0;
+}
+
+static void close_reactor (struct reactor *r)
+{
+    /*
+     * Drop whatever is still queued, so the relays get freed.
+     */
+    for (struct mpsc_node * node; (node = mpsc_pop (&r->inbox));) {
+        put_relay ((struct relay *) (void *) ((char *) (node - r->id)
+                                               - offsetof (struct relay,
+                                                           nodes)));
+    }
+    for (int i = 0; i < r->table.count; i++) {
+        sendq_clear (&r->table.members[i]->sendq);
+        tls_close (r->table.members[i]->tls);
+        close_descriptor (r->table.members[i]->sock);
+    }
+    /*
+     * Records and receive rings go with their slabs.
+     */
+    free_clients (&r->table);
+    ratemap_free (&r->rates);
+    event_loop_free (r->loop);
+
+    if (r->wake_fd != -1) {
+        close_descriptor (r->wake_fd);
+    }
+    if (r->master_fd != -1) {
+        close_descriptor (r->master_fd);
+    }
+}
+
+/**
+*	\param	listen - Whether to open a listener, rather than take one over.
+*/
+static int open_reactor (struct reactor *r, int id, int limit, int listen)
+{
+    r->id = id;
+    r->batch_deadline = 0;
+    r->master_fd = r->wake_fd = -1;
+    r->loop = 0;
+    mpsc_init (&r->inbox);
+    atomic_init (&r->signalled, 0);
+
+    if (listen && (r->master_fd = setup_server (n_reactors > 1
+                                                ? SERVER_REUSEPORT : 0)) == -1) {
+        return -1;
+    }
+    if ((r->wake_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        perror ("eventfd()");
+        return -1;
+    }
+    if (!(r->loop = event_loop_new (cfg.backend, limit))) {
+        perror ("event_loop_new()");
+        return -1;
+    }
+    if (init_clients (&r->table, event_loop_capacity (r->loop)) == -1
+        || ratemap_init (&r->rates) == -1) {
+        perror ("calloc()");
+        return -1;
+    }
+    wheel_init (&r->table.timers, now_ms ());
+    /*
+     * Only the first reactor hears about signals.
+     */
+    if ((listen && event_add (r->loop, r->master_fd, EV_ACCEPT) == -1)
+        || event_add (r->loop, r->wake_fd, EV_READ) == -1
+        || (!id && event_add (r->loop, pfds[0], EV_READ) == -1)) {
+        perror ("event_add()");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+*	\brief	Restores a client the old process handed over, with fd, its
+*			socket, in the reactor that is to serve it.
+*	\return	The client, or NULL on failure, in which case fd is closed.
+*/
+static struct client_info *take_client (const struct upgrade_client *c,
+                                        const char *input, size_t len, int fd)
+{
+    struct reactor *const r = &reactors[c->reactor % (unsigned) n_reactors];
+    const int entry = find_empty_slot (&r->table);
+    const struct client_info slave_info = {
+        .address = c->address,
+        .serial = c->serial,
+        .events = EV_RECV,
+        .since = c->since,
+    };
+
+    if (entry == -1
+        || fill_client_entry (fd, entry, &r->table, &slave_info) == -1) {
+        close_descriptor (fd);
+        return 0;
+    }
+
+    struct client_info *const slave = r->table.p_slaves[entry];
+
+    slave->active = c->active;
+    slave->flags |= c->flags & (CLIENT_PINGED | CLIENT_DEFLATE);
+    slave->rbuf.mode = (enum recv_mode) c->mode;
+
+    if (slave->flags & CLIENT_DEFLATE) {
+        compress_attach ();
+    }
+    for (uint32_t i = 0; i < c->n_rooms && i < CLIENT_MAX_ROOMS; i++) {
+        if (room_join (&r->table, slave, c->rooms[i]) == -1) {
+            goto fail;
+        }
+    }
+    /*
+     * Joining made the last room joined the one lines go to, which it
+     * need not have been.
+     */
+    slave->room = c->room;
+
+    if (len && recvbuf_append (&slave->rbuf, &r->table.rings, input,
+                               len) != (ssize_t) len) {
+        goto fail;
+    }
+    return slave;
+
+  fail:
+    drop_connection (r->loop, slave, &r->table);
+    return 0;
+}
+
+/**
+*	\brief	Takes over the listeners and clients of the process on the other
+*			end of chan, which the reactors have been opened without, and
+*			waits for it to let go of them.
+*	\return	The number of clients taken over, or -1 on failure.
+*/
+static int take_over (int chan)
+{
+    struct upgrade_record rec;
+    char data[UPGRADE_CHUNK];
+    struct client_info *slave = 0;
+    struct msgbuf *out = 0;
+    size_t sent = 0;
+    int listeners = 0;
+    int rooms = ROOM_LOBBY + 1;
+    int clients = 0;
+    int fd;
+
+    if (upgrade_send (chan, UPGRADE_READY, 0, 0, -1) == -1) {
+        return -1;
+    }
+    while (upgrade_recv (chan, &rec, data, &fd) == 1) {
+        if (rec.type == UPGRADE_LISTENER && fd != -1) {
+            if (listeners < n_reactors) {
+                reactors[listeners].master_fd = fd;
+            } else {
+                close_descriptor (fd);
+            }
+            listeners++;
+            continue;
+        }
+        if (fd != -1 && rec.type != UPGRADE_CLIENT) {
+            close_descriptor (fd);
+            break;
+        }
+        /*
+         * A client's output follows it, so what it had half sent can be
+         * counted off once the next record comes along.
+         */
+        if (slave && rec.type != UPGRADE_OUTPUT) {
+            sendq_consume (&slave->sendq, sent);
+            slave = 0;
+        }
+        if (rec.type == UPGRADE_ROOM) {
+            if (room_open (data, rec.len) != rooms++) {
+                break;
+            }
+        } else if (rec.type == UPGRADE_CLIENT) {
+            if (fd == -1 || rec.len < sizeof (struct upgrade_client)) {
+                if (fd != -1) {
+                    close_descriptor (fd);
+                }
+                break;
+            }
+
+            const struct upgrade_client *const c =
+                (const struct upgrade_client *) (const void *) data;
+
+            if (!(slave = take_client (c, data + sizeof *c,
+                                       rec.len - sizeof *c, fd))) {
+                break;
+            }
+            sent = c->sent;
+            clients++;
+        } else if (rec.type == UPGRADE_OUTPUT) {
+            if (!slave
+                || (!out && !(out = msgbuf_alloc (rec.total)))
+                || out->len + rec.len > rec.total) {
+                break;
+            }
+            memcpy (out->data + out->len, data, rec.len);
+            out->len += rec.len;
+
+            if (out->len == rec.total) {
+                const int ret_val = sendq_push (&slave->sendq, out,
+                                                rec.skip);
+
+                msgbuf_put (out);
+                out = 0;
+
+                if (ret_val == -1) {
+                    break;
+                }
+            }
+        } else if (rec.type == UPGRADE_END && listeners) {
+            atomic_store (&serials, rec.total);
+
+            /*
+             * Whatever the listeners were short of is shared.
+             */
+            for (int i = listeners; i < n_reactors; i++) {
+                if ((reactors[i].master_fd =
+                     dup (reactors[i % listeners].master_fd)) == -1) {
+                    perror ("dup()");
+                    return -1;
+                }
+            }
+            if (upgrade_send (chan, UPGRADE_DONE, 0, 0, -1) == -1) {
+                return -1;
+            }
+            /*
+             * Nothing is ours until the old process has let go of it.
+             */
+            if (upgrade_recv (chan, &rec, data, &fd) != 0) {
+                return -1;
+            }
+            close_descriptor (chan);
+            return clients;
+        } else {
+            break;
+        }
+    }
+    if (out) {
+        msgbuf_put (out);
+    }
+    fprintf (stderr, "%s: the old process could not be taken over\n",
+             PROGRAM_NAME);
+    return -1;
+}
+
+/**
+*	\brief	Starts serving what was taken over.
+*	\return	0 on success, or -1 on failure.
+*/
+static int start_serving (void)
+{
+    for (int i = 0; i < n_reactors; i++) {
+        struct reactor *const r = &reactors[i];
+
+        if (event_add (r->loop, r->master_fd, EV_ACCEPT) == -1) {
+            perror ("event_add()");
+            return -1;
+        }
+        r->now = metrics_now ();
+
+        for (int j = r->table.count - 1; j >= 0; j--) {
+            struct client_info *const slave = r->table.members[j];
+
+            if (event_add (r->loop, slave->sock, EV_RECV) == -1) {
+                perror ("event_add()");
+                drop_connection (r->loop, slave, &r->table);
+                continue;
+            }
+            arm (r, slave);
+
+            if (!sendq_empty (&slave->sendq)) {
+                flush_client (r->loop, slave, &r->table);
+            }
+        }
+    }
+    return 0;
+}
+
+int run_reactors (int n)
+{
+    const int fd_limit = raise_fd_limit ();
+    const int limit = fd_limit == -1 ? MAX_SLAVES : fd_limit;
+    int status = -1;
+    int opened = 0;
+    int started = 1;
+
+    if (!(reactors = calloc ((size_t) n, sizeof *reactors))) {
+        perror ("calloc()");
+        return close_log_file ();
+    }
+    n_reactors = n;
+
+    const int chan = upgrade_inherited ();
+
+    /*
+     * The listeners a new process takes over are ours already.
+     */
+    if (chan == -1 && n > 1 && probe_server () == -1) {
+        goto out;
+    }
+    for (; opened < n; opened++) {
+        if (open_reactor (&reactors[opened], opened, limit, chan == -1) == -1) {
+            opened++;
+            goto out;
+        }
+    }
+    if (chan != -1) {
+        const int clients = take_over (chan);
+
+        if (clients == -1 || start_serving () == -1) {
+            goto out;
+        }
+        log_event (SS_TOOK_OVER, PROGRAM_NAME, clients);
+    }
+
+    /*
+     * Signals are left to the first reactor: the others start with them
+     * blocked.
+     */
+    sigset_t all, old;
+
+    sigfillset (&all);
+    pthread_sigmask (SIG_SETMASK, &all, &old);
+
+    for (; started < n; started++) {
+        const int err = pthread_create (&reactors[started].thread, 0,
+                                        reactor_main, &reactors[started]);
+
+        if (err) {
+            errno = err;
+            perror ("pthread_create()");
+            break;
+        }
+    }
+    pthread_sigmask (SIG_SETMASK, &old, 0);
+
+    if (started == n) {
+        fprintf (stdout, logs[SS_INITIATE], PROGRAM_NAME, PORT);
+        reactor_main (&reactors[0]);
+        status = reactors[0].status;
+    }
+    stop_all ();
+
+    for (int i = 1; i < started; i++) {
+        pthread_join (reactors[i].thread, 0);
+
+        if (reactors[i].status == -1) {
+            status = -1;
+        }
+    }
+
+  out:
+    for (int i = 0; i < opened; i++) {
+        close_reactor (&reactors[i]);
+    }
+    msgbuf_drain ();
+    free (reactors);
+    reactors = 0;
+    journal_close ();
+    history_close ();
+    tls_free ();
+    metrics_stop ();
+    close_log_file ();
+    return status;
+}
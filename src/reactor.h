@@ -0,0 +1,15 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+/**
+*	\brief	Runs n event loops, each with its own listening socket (sharing
+*			the port through SO_REUSEPORT), connections, and thread. The
+*			first runs on the calling thread. Messages, and evictions of
+*			connections from the same address, are passed between the
+*			loops through lock-free queues.
+*	\param	n - The number of event loops.
+*	\return	0 on SIGINT, or -1 on failure.
+*/
+int run_reactors (int n);
+
+#endif /* REACTOR_H */
@@ -0,0 +1,370 @@
+#define _GNU_SOURCE             /* memrchr() */
+
+#include "recvbuf.h"
+#include "frame.h"
+#include "internal.h"
+
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#define MASK (RECVBUF_LEN - 1)
+
+static int ensure_buf (struct recvbuf *rb, struct slab *rings)
+{
+    if (!rb->buf && !(rb->buf = slab_alloc (rings))) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+*	\brief	Describes the free part of the ring, which wraps at most once.
+*	\return	The number of entries filled in, or 0 if the ring is full.
+*/
+static int free_iov (const struct recvbuf *rb, struct iovec iov[2])
+{
+    const size_t space = RECVBUF_LEN - (rb->tail - rb->head);
+    const size_t t = rb->tail & MASK;
+    const size_t first = space < RECVBUF_LEN - t ? space : RECVBUF_LEN - t;
+
+    if (!space) {
+        return 0;
+    }
+    iov[0].iov_base = rb->buf + t;
+    iov[0].iov_len = first;
+    iov[1].iov_base = rb->buf;
+    iov[1].iov_len = space - first;
+    return space > first ? 2 : 1;
+}
+
+ssize_t recvbuf_read (struct recvbuf *rb, struct slab *rings, int fd)
+{
+    struct iovec iov[2];
+
+    if (ensure_buf (rb, rings) == -1) {
+        return -1;
+    }
+
+    const int iovcnt = free_iov (rb, iov);
+
+    if (!iovcnt) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    const ssize_t ret_val = readv (fd, iov, iovcnt);
+
+    if (ret_val > 0) {
+        rb->tail += (size_t) ret_val;
+    }
+    return ret_val;
+}
+
+ssize_t recvbuf_append (struct recvbuf *rb, struct slab *rings,
+                        const char *data, size_t len)
+{
+    struct iovec iov[2];
+
+    if (ensure_buf (rb, rings) == -1) {
+        return -1;
+    }
+
+    const int iovcnt = free_iov (rb, iov);
+    size_t copied = 0;
+
+    for (int i = 0; i < iovcnt && copied < len; i++) {
+        const size_t n = len - copied < iov[i].iov_len ? len - copied
+            : iov[i].iov_len;
+
+        memcpy (iov[i].iov_base, data + copied, n);
+        copied += n;
+    }
+    rb->tail += copied;
+    return (ssize_t) copied;
+}
+
+/**
+*	\return	One past the last newline in [from, to), or 0 if there is none.
+*/
+static size_t last_newline (const struct recvbuf *rb, size_t from, size_t to)
+{
+    while (to > from) {
+        const size_t t = to & MASK;
+        const size_t room = t ? t : RECVBUF_LEN;
+        const size_t len = to - from < room ? to - from : room;
+        const char *const seg = rb->buf + ((to - len) & MASK);
+        const char *const nl = memrchr (seg, '\n', len);
+
+        if (nl) {
+            return to - len + (size_t) (nl - seg) + 1;
+        }
+        to -= len;
+    }
+    return 0;
+}
+
+/**
+*	\brief	Copies len bytes from the ring, starting at from, to dst.
+*/
+static void copy_out (const struct recvbuf *rb, size_t from, size_t len,
+                      char *dst)
+{
+    const size_t h = from & MASK;
+    const size_t first = len < RECVBUF_LEN - h ? len : RECVBUF_LEN - h;
+
+    memcpy (dst, rb->buf + h, first);
+    memcpy (dst + first, rb->buf, len - first);
+}
+
+/**
+*	\brief	Decides the protocol from as much of the magic as has arrived.
+*	\return	RECV_HELLO if the client asked for frames, or RECV_NONE.
+*/
+static int negotiate (struct recvbuf *rb)
+{
+    const size_t avail = rb->tail - rb->head;
+
+    for (size_t i = 0; i < avail && i < FRAME_MAGIC_LEN; i++) {
+        if (rb->buf[(rb->head + i) & MASK] != FRAME_MAGIC[i]) {
+            rb->mode = RECV_LINES;
+            return RECV_NONE;
+        }
+    }
+    if (avail < FRAME_MAGIC_LEN) {
+        return RECV_NONE;
+    }
+    rb->mode = RECV_FRAMES;
+    rb->head = rb->scan = rb->head + FRAME_MAGIC_LEN;
+    return RECV_HELLO;
+}
+
+/**
+*	\return	One past the first newline in [from, to), or to if there is none.
+*/
+static size_t next_newline (const struct recvbuf *rb, size_t from, size_t to)
+{
+    while (from < to) {
+        const size_t f = from & MASK;
+        const size_t room = RECVBUF_LEN - f;
+        const size_t len = to - from < room ? to - from : room;
+        const char *const seg = rb->buf + f;
+        const char *const nl = memchr (seg, '\n', len);
+
+        if (nl) {
+            return from + (size_t) (nl - seg) + 1;
+        }
+        from += len;
+    }
+    return to;
+}
+
+/**
+*	\return	Where the first line in [from, to) that starts with a slash
+*			starts, or to if none does. from has to start a line.
+*/
+static size_t first_command (const struct recvbuf *rb, size_t from, size_t to)
+{
+    while (from < to && rb->buf[from & MASK] != '/') {
+        from = next_newline (rb, from, to);
+    }
+    return from;
+}
+
+static int is_blank (char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static uint8_t command_type (const char *word, size_t len)
+{
+    static const struct {
+        const char *word;
+        uint8_t type;
+    } commands[] = {
+        { "join", FRAME_JOIN },
+        { "leave", FRAME_LEAVE },
+        { "list", FRAME_LIST },
+    };
+
+    for (size_t i = 0; i < ARRAY_CARDINALITY (commands); i++) {
+        if (strlen (commands[i].word) == len
+            && !memcmp (commands[i].word, word, len)) {
+            return commands[i].type;
+        }
+    }
+    return 0;
+}
+
+/**
+*	\brief	Takes the command line at head, and turns it into the frame a
+*			binary client would have sent, with the argument as payload.
+*/
+static int take_command (struct recvbuf *rb, size_t end, struct msgbuf **msg)
+{
+    const size_t stop = next_newline (rb, rb->head, end);
+    size_t len = stop - rb->head;
+    struct msgbuf *const m = msgbuf_alloc (FRAME_HDR_LEN + len);
+
+    if (!m) {
+        return -1;
+    }
+
+    char *const line = m->data + FRAME_HDR_LEN;
+
+    copy_out (rb, rb->head, len, line);
+    rb->head = rb->scan = stop;
+
+    while (len && is_blank (line[len - 1])) {
+        len--;
+    }
+
+    size_t word = 1;
+
+    while (word < len && !is_blank (line[word])) {
+        word++;
+    }
+
+    size_t arg = word;
+
+    while (arg < len && is_blank (line[arg])) {
+        arg++;
+    }
+    frame_encode ((unsigned char *) m->data, &(struct frame) {
+                  .length = (uint32_t) (len - arg),
+                  .type = command_type (line + 1, word - 1)}
+    );
+    memmove (line, line + arg, len - arg);
+    m->len = FRAME_HDR_LEN + len - arg;
+    *msg = m;
+    return RECV_COMMAND;
+}
+
+static int take_lines (struct recvbuf *rb, uint16_t room, struct msgbuf **msg)
+{
+    size_t end = last_newline (rb, rb->scan, rb->tail);
+
+    if (!end) {
+        rb->scan = rb->tail;
+        return rb->tail - rb->head == RECVBUF_LEN ? RECV_INVALID : RECV_NONE;
+    }
+
+    /*
+     * Commands are taken a line at a time, and cut short the run of lines
+     * before them, which may go to another room than the lines after.
+     */
+    const size_t cmd = first_command (rb, rb->head, end);
+
+    if (cmd == rb->head) {
+        return take_command (rb, end, msg);
+    }
+
+    const size_t len = cmd - rb->head;
+    struct msgbuf *const m = msgbuf_alloc (FRAME_HDR_LEN + len);
+
+    if (!m) {
+        return -1;
+    }
+    frame_encode ((unsigned char *) m->data, &(struct frame) {
+                  .length = (uint32_t) len,.type = FRAME_DATA,.room = room}
+    );
+    copy_out (rb, rb->head, len, m->data + FRAME_HDR_LEN);
+    m->len = FRAME_HDR_LEN + len;
+    rb->head = cmd;
+    /*
+     * Whatever follows the last newline is a partial line, so it need not
+     * be searched again, unless a command was left for next time.
+     */
+    rb->scan = cmd == end ? rb->tail : cmd;
+    *msg = m;
+    return RECV_MESSAGE;
+}
+
+static int take_frame (struct recvbuf *rb, struct msgbuf **msg)
+{
+    unsigned char hdr[FRAME_HDR_LEN];
+    struct frame f;
+
+    if (rb->tail - rb->head < FRAME_HDR_LEN) {
+        return RECV_NONE;
+    }
+    copy_out (rb, rb->head, FRAME_HDR_LEN, (char *) hdr);
+    frame_decode (hdr, &f);
+
+    /*
+     * Anything longer could never fit in the ring.
+     */
+    if (f.length > RECVBUF_LEN - FRAME_HDR_LEN
+        || (f.type != FRAME_DATA && f.type != FRAME_PING
+            && f.type != FRAME_PONG && f.type != FRAME_JOIN && f.type != FRAME_LEAVE
+            && f.type != FRAME_LIST && f.type != FRAME_COMPRESS)) {
+        return RECV_INVALID;
+    }
+    if (rb->tail - rb->head < FRAME_HDR_LEN + f.length) {
+        return RECV_NONE;
+    }
+    if (f.type == FRAME_PING || f.type == FRAME_PONG) {
+        rb->head = rb->scan = rb->head + FRAME_HDR_LEN + f.length;
+        return f.type == FRAME_PING ? RECV_PING : RECV_PONG;
+    }
+
+    struct msgbuf *const m = msgbuf_alloc (FRAME_HDR_LEN + f.length);
+
+    if (!m) {
+        return -1;
+    }
+    /*
+     * The payload is copied without being looked at, under a header of our
+     * own so that reserved fields go out as 0.
+     */
+    frame_encode ((unsigned char *) m->data, &(struct frame) {
+                  .length = f.length,.type = f.type,.room = f.room}
+    );
+    copy_out (rb, rb->head + FRAME_HDR_LEN, f.length,
+              m->data + FRAME_HDR_LEN);
+    m->len = FRAME_HDR_LEN + f.length;
+    rb->head = rb->scan = rb->head + FRAME_HDR_LEN + f.length;
+    *msg = m;
+    return f.type == FRAME_DATA ? RECV_MESSAGE : RECV_COMMAND;
+}
+
+int recvbuf_take (struct recvbuf *rb, uint16_t room, struct msgbuf **msg)
+{
+    *msg = 0;
+
+    switch (rb->mode) {
+        case RECV_UNDECIDED:
+            if (rb->head == rb->tail) {
+                return RECV_NONE;
+            }
+            if (negotiate (rb) == RECV_HELLO) {
+                return RECV_HELLO;
+            }
+            return rb->mode == RECV_LINES ? take_lines (rb, room, msg)
+                : RECV_NONE;
+        case RECV_LINES:
+            return take_lines (rb, room, msg);
+        case RECV_FRAMES:
+            return take_frame (rb, msg);
+    }
+    return RECV_NONE;
+}
+
+size_t recvbuf_copy (const struct recvbuf *rb, char *dst)
+{
+    const size_t len = rb->tail - rb->head;
+
+    if (len) {
+        copy_out (rb, rb->head, len, dst);
+    }
+    return len;
+}
+
+void recvbuf_free (struct recvbuf *rb, struct slab *rings)
+{
+    if (rb->buf) {
+        slab_free (rings, rb->buf);
+    }
+    *rb = (struct recvbuf) { 0 };
+}
@@ -0,0 +1,98 @@
+#ifndef RECVBUF_H
+#define RECVBUF_H
+
+#include "internal.h"
+#include "msgbuf.h"
+#include "pool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+*	The longest line a client may send, and the size of its receive ring.
+*	Must be a power of 2.
+*/
+#define RECVBUF_LEN		(BUFSIZE * 2)
+
+/*
+*	The protocol a connection speaks, which its first bytes decide.
+*/
+enum recv_mode {
+    RECV_UNDECIDED,
+    RECV_LINES,                 /* Newline-terminated lines. */
+    RECV_FRAMES                 /* See frame.h. */
+};
+
+/*
+*	A connection's receive ring. What arrives is framed into messages as it
+*	comes in; a line or frame split across reads waits here for the rest.
+*
+*	head, scan and tail only ever grow, and are reduced modulo RECVBUF_LEN
+*	to index buf.
+*/
+struct recvbuf {
+    char *buf;                  /* Taken from a slab on first use. */
+    size_t head;                /* First byte not yet taken. */
+    size_t scan;                /* [head, scan) holds no newline. */
+    size_t tail;                /* One past the last byte received. */
+    enum recv_mode mode;
+};
+
+/*
+*	What recvbuf_take() found.
+*/
+enum recv_result {
+    RECV_NONE,                  /* Nothing complete yet. */
+    RECV_MESSAGE,               /* A message to relay. */
+    RECV_HELLO,                 /* The client asked for frames. */
+    RECV_PING,                  /* The client wants a FRAME_PONG. */
+    RECV_PONG,                  /* The client answered a FRAME_PING. */
+    RECV_COMMAND,               /* A FRAME_JOIN, FRAME_LEAVE or FRAME_LIST. */
+    RECV_INVALID                /* A line too long, or a malformed frame. */
+};
+
+/**
+*	\brief	Reads as much as fits into the ring with one readv().
+*	\param	rings - The slab of RECVBUF_LEN objects the ring comes from.
+*	\return	The number of bytes read, 0 at end of file, or -1 on failure,
+*			with errno set. ENOBUFS means the ring is full.
+*/
+ssize_t recvbuf_read (struct recvbuf *rb, struct slab *rings, int fd);
+
+/**
+*	\brief	Copies as much of len bytes of data as fits into the ring, for
+*			backends that have received it already.
+*	\return	The number of bytes copied, or -1 if the ring could not be
+*			allocated.
+*/
+ssize_t recvbuf_append (struct recvbuf *rb, struct slab *rings,
+                        const char *data, size_t len);
+
+/**
+*	\brief	Takes the next thing the client has sent in full: in line mode,
+*			every complete line up to the next command as one message, or
+*			the command, and in frame mode, one frame. Messages are stored
+*			framed, for binary clients, with the payload after FRAME_HDR_LEN
+*			bytes of header.
+*	\param	room - The room to address lines to.
+*	\param	msg  - To store the message, for RECV_MESSAGE, or the command,
+*				  for RECV_COMMAND. A command line that is not understood
+*				  is given a type of 0.
+*	\return	An enum recv_result, or -1 if the system is out of memory.
+*/
+int recvbuf_take (struct recvbuf *rb, uint16_t room, struct msgbuf **msg);
+
+/**
+*	\brief	Copies what the ring holds, a partial line or frame, to dst, which
+*			has room for RECVBUF_LEN bytes.
+*	\return	The number of bytes copied.
+*/
+size_t recvbuf_copy (const struct recvbuf *rb, char *dst);
+
+/**
+*	\brief	Returns the ring to rings, and forgets whatever it held.
+*/
+void recvbuf_free (struct recvbuf *rb, struct slab *rings);
+
+#endif /* RECVBUF_H */
@@ -0,0 +1,228 @@
+#include "room.h"
+#include "client_info.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define ROOM_MIN_CAP 8
+
+/*
+*	Names are only looked up when a client joins a room, so a lock and a
+*	linear search will do. Once named, a room's name never changes, and is
+*	read without the lock.
+*/
+static struct {
+    pthread_mutex_t lock;
+    int count;
+    char names[ROOM_MAX][ROOM_NAME_MAX + 1];
+    atomic_int members[ROOM_MAX];       /* Across every reactor. */
+} registry = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .count = 1,
+    .names = {[ROOM_LOBBY] = ROOM_LOBBY_NAME },
+};
+
+static int valid_name (const char *name, size_t len)
+{
+    if (!len || len > ROOM_NAME_MAX) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if ((unsigned char) name[i] <= ' ' || name[i] == 0x7F) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+*	\brief	Looks name up. The caller holds the lock.
+*/
+static int lookup (const char *name, size_t len)
+{
+    for (int i = 0; i < registry.count; i++) {
+        if (!strncmp (registry.names[i], name, len)
+            && !registry.names[i][len]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int room_open (const char *name, size_t len)
+{
+    if (!valid_name (name, len)) {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock (&registry.lock);
+
+    int room = lookup (name, len);
+
+    if (room == -1) {
+        if (registry.count == ROOM_MAX) {
+            errno = ENOSPC;
+        } else {
+            room = registry.count++;
+            memcpy (registry.names[room], name, len);
+            registry.names[room][len] = '\0';
+        }
+    }
+    pthread_mutex_unlock (&registry.lock);
+    return room;
+}
+
+int room_find (const char *name, size_t len)
+{
+    if (!valid_name (name, len)) {
+        return -1;
+    }
+    pthread_mutex_lock (&registry.lock);
+
+    const int room = lookup (name, len);
+
+    pthread_mutex_unlock (&registry.lock);
+    return room;
+}
+
+const char *room_name (int room)
+{
+    return registry.names[room];
+}
+
+int room_count (void)
+{
+    pthread_mutex_lock (&registry.lock);
+
+    const int count = registry.count;
+
+    pthread_mutex_unlock (&registry.lock);
+    return count;
+}
+
+size_t room_list (char *buf, size_t size, const char *prefix, int numbers)
+{
+    size_t len = 0;
+
+    pthread_mutex_lock (&registry.lock);
+
+    for (int i = 0; i < registry.count; i++) {
+        const int members = atomic_load_explicit (&registry.members[i],
+                                                  memory_order_relaxed);
+
+        if (!members) {
+            continue;
+        }
+
+        const int n = numbers
+            ? snprintf (buf + (len < size ? len : size),
+                        len < size ? size - len : 0, "%s%d %s %d\n", prefix,
+                        i, registry.names[i], members)
+            : snprintf (buf + (len < size ? len : size),
+                        len < size ? size - len : 0, "%s%s %d\n", prefix,
+                        registry.names[i], members);
+
+        len += n > 0 ? (size_t) n : 0;
+    }
+    pthread_mutex_unlock (&registry.lock);
+    return len;
+}
+
+static struct membership *find_membership (struct client_info *slave,
+                                           int room)
+{
+    for (int i = 0; i < slave->n_rooms; i++) {
+        if (slave->rooms[i].room == room) {
+            return &slave->rooms[i];
+        }
+    }
+    return 0;
+}
+
+int room_has (const struct client_info *slave, int room)
+{
+    for (int i = 0; i < slave->n_rooms; i++) {
+        if (slave->rooms[i].room == room) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int room_join (struct client_table *table, struct client_info *slave,
+               int room)
+{
+    struct room_members *const rm = &table->rooms[room];
+
+    if (room_has (slave, room)) {
+        errno = EALREADY;
+        return -1;
+    }
+    if (slave->n_rooms == CLIENT_MAX_ROOMS) {
+        errno = EMLINK;
+        return -1;
+    }
+    if (rm->count == rm->cap) {
+        const int cap = rm->cap ? rm->cap * 2 : ROOM_MIN_CAP;
+        struct client_info **const slots =
+            realloc (rm->slots, (size_t) cap * sizeof *slots);
+
+        if (!slots) {
+            return -1;
+        }
+        rm->slots = slots;
+        rm->cap = cap;
+    }
+    rm->slots[rm->count] = slave;
+    slave->rooms[slave->n_rooms++] = (struct membership) {
+        .room = (uint16_t) room,.index = rm->count++
+    };
+    slave->room = room;
+    atomic_fetch_add_explicit (&registry.members[room], 1,
+                               memory_order_relaxed);
+    return 0;
+}
+
+int room_leave (struct client_table *table, struct client_info *slave,
+                int room)
+{
+    struct membership *const m = find_membership (slave, room);
+
+    if (!m) {
+        return -1;
+    }
+
+    struct room_members *const rm = &table->rooms[room];
+    struct client_info *const last = rm->slots[--rm->count];
+
+    /*
+     * The room's last member takes the leaver's place.
+     */
+    find_membership (last, room)->index = m->index;
+    rm->slots[m->index] = last;
+
+    /*
+     * Keep the client's rooms in the order they were joined.
+     */
+    memmove (m, m + 1, (size_t) (slave->rooms + --slave->n_rooms - m)
+             * sizeof *m);
+    atomic_fetch_sub_explicit (&registry.members[room], 1,
+                               memory_order_relaxed);
+
+    if (slave->room == room) {
+        slave->room = slave->n_rooms
+            ? slave->rooms[slave->n_rooms - 1].room : -1;
+    }
+    return 0;
+}
+
+void room_leave_all (struct client_table *table, struct client_info *slave)
+{
+    while (slave->n_rooms) {
+        room_leave (table, slave, slave->rooms[slave->n_rooms - 1].room);
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef ROOM_H
+#define ROOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+*	Rooms. A message goes to the members of one room, rather than to every
+*	client.
+*
+*	Names are mapped to numbers by a registry shared by every reactor,
+*	while each reactor lists its own members of each room, densely, and
+*	each client the rooms it is in. Every client starts out in ROOM_LOBBY.
+*	A room that has been named keeps its number for as long as the server
+*	runs.
+*/
+#define ROOM_MAX			1024	/* Rooms that may be named. */
+#define ROOM_NAME_MAX		32
+#define ROOM_LOBBY			0
+#define ROOM_LOBBY_NAME		"lobby"
+#define CLIENT_MAX_ROOMS	16		/* Rooms one client may be in. */
+
+struct client_info;
+struct client_table;
+
+/*
+*	One reactor's members of a room.
+*/
+struct room_members {
+    struct client_info **slots;
+    int count;
+    int cap;
+};
+
+/*
+*	A room a client is in, and where it is in the room's members.
+*/
+struct membership {
+    uint16_t room;
+    int index;
+};
+
+/**
+*	\brief	Looks a room up by name, naming it if need be.
+*	\return	Its number, or -1 with errno set: EINVAL if the name is empty,
+*			too long, or holds spaces or control characters, and ENOSPC if
+*			ROOM_MAX rooms have been named already.
+*/
+int room_open (const char *name, size_t len);
+
+/**
+*	\brief	Looks a room up by name.
+*	\return	Its number, or -1 if no room has that name.
+*/
+int room_find (const char *name, size_t len);
+
+/**
+*	\return	The name of room, which must have been opened.
+*/
+const char *room_name (int room);
+
+/**
+*	\return	The number of rooms named so far, the lobby included. They are
+*			numbered from 0 up, in the order they were named.
+*/
+int room_count (void);
+
+/**
+*	\brief	Lists the rooms that have members, one line each. A line is
+*			prefix, then the number (if numbers), name and member count.
+*	\return	The length of the list, which may be more than size, in which
+*			case it was truncated.
+*/
+size_t room_list (char *buf, size_t size, const char *prefix, int numbers);
+
+/**
+*	\brief	Adds slave to room's members.
+*	\return	0 on success, or -1 with errno set: EALREADY if slave is in the
+*			room already, EMLINK if it is in CLIENT_MAX_ROOMS rooms, or
+*			ENOMEM.
+*/
+int room_join (struct client_table *table, struct client_info *slave,
+               int room);
+
+/**
+*	\brief	Takes slave out of room. If that was where its lines went, they
+*			go to the room it joined last instead.
+*	\return	0 on success, or -1 if slave was not in the room.
+*/
+int room_leave (struct client_table *table, struct client_info *slave,
+                int room);
+
+void room_leave_all (struct client_table *table, struct client_info *slave);
+
+/**
+*	\return	Whether slave is in room.
+*/
+int room_has (const struct client_info *slave, int room);
+
+#endif /* ROOM_H */
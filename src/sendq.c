@@ -0,0 +1,138 @@
+#include "sendq.h"
+
+#include <stdlib.h>
+
+#define SENDQ_MIN_CAP 8
+
+static int grow (struct sendq *q)
+{
+    const unsigned cap = q->cap ? q->cap * 2 : SENDQ_MIN_CAP;
+    struct sendq_entry *const ring = malloc (cap * sizeof *ring);
+
+    if (!ring) {
+        return -1;
+    }
+    for (unsigned i = 0; i < q->count; i++) {
+        ring[i] = q->ring[(q->head + i) & (q->cap - 1)];
+    }
+    free (q->ring);
+    q->ring = ring;
+    q->cap = cap;
+    q->head = 0;
+    return 0;
+}
+
+static struct sendq_entry *at (const struct sendq *q, unsigned i)
+{
+    return &q->ring[(q->head + i) & (q->cap - 1)];
+}
+
+static size_t entry_len (const struct sendq_entry *e)
+{
+    return e->msg->len - e->skip;
+}
+
+int sendq_iov (const struct sendq *q, struct iovec *iov, int max,
+               size_t *len)
+{
+    const int n = q->count < (unsigned) max ? (int) q->count : max;
+
+    *len = 0;
+
+    for (int i = 0; i < n; i++) {
+        const struct sendq_entry *const e = at (q, (unsigned) i);
+        const size_t skip = e->skip + (i ? 0 : q->off);
+
+        iov[i].iov_base = e->msg->data + skip;
+        iov[i].iov_len = e->msg->len - skip;
+        *len += iov[i].iov_len;
+    }
+    return n;
+}
+
+const struct sendq_entry *sendq_peek (const struct sendq *q, unsigned i)
+{
+    return at (q, i);
+}
+
+int sendq_push (struct sendq *q, struct msgbuf *m, size_t skip)
+{
+    if (q->count == q->cap && grow (q) == -1) {
+        return -1;
+    }
+    *at (q, q->count++) = (struct sendq_entry) {
+        .msg = msgbuf_get (m),.skip = skip
+    };
+    q->bytes += m->len - skip;
+    return 0;
+}
+
+void sendq_reskip (struct sendq *q, size_t skip)
+{
+    for (unsigned i = q->off ? 1 : 0; i < q->count; i++) {
+        struct sendq_entry *const e = at (q, i);
+
+        q->bytes = q->bytes - entry_len (e) + (e->msg->len - skip);
+        e->skip = skip;
+    }
+}
+
+static struct msgbuf *pop (struct sendq *q)
+{
+    struct msgbuf *const m = q->ring[q->head].msg;
+
+    q->head = (q->head + 1) & (q->cap - 1);
+    q->count--;
+    return m;
+}
+
+void sendq_consume (struct sendq *q, size_t n)
+{
+    q->bytes -= n;
+
+    while (n) {
+        const size_t left = entry_len (at (q, 0)) - q->off;
+
+        if (n < left) {
+            q->off += n;
+            return;
+        }
+        n -= left;
+        q->off = 0;
+        msgbuf_put (pop (q));
+    }
+}
+
+size_t sendq_drop_oldest (struct sendq *q, size_t need)
+{
+    const struct sendq_entry partial = q->off ? q->ring[q->head]
+        : (struct sendq_entry) { 0 };
+    size_t freed = 0;
+
+    if (partial.msg) {
+        pop (q);
+    }
+    while (q->count && freed < need) {
+        freed += entry_len (at (q, 0));
+        msgbuf_put (pop (q));
+    }
+    /*
+     * Put the partly sent message back in front, in the slot just vacated.
+     */
+    if (partial.msg) {
+        q->head = (q->head - 1) & (q->cap - 1);
+        q->ring[q->head] = partial;
+        q->count++;
+    }
+    q->bytes -= freed;
+    return freed;
+}
+
+void sendq_clear (struct sendq *q)
+{
+    while (q->count) {
+        msgbuf_put (pop (q));
+    }
+    free (q->ring);
+    *q = (struct sendq) { 0 };
+}
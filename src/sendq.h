@@ -0,0 +1,79 @@
+#ifndef SENDQ_H
+#define SENDQ_H
+
+#include "msgbuf.h"
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+/*
+*	A queued message, and where in it this connection's copy starts: a
+*	line client skips the frame header that a binary client is sent.
+*/
+struct sendq_entry {
+    struct msgbuf *msg;
+    size_t skip;
+};
+
+/*
+*	A connection's outbound queue: whole messages waiting for the socket
+*	to become writable, oldest first. It holds references, not copies, so
+*	a message queued for a thousand clients is still stored once.
+*/
+struct sendq {
+    struct sendq_entry *ring;   /* Power-of-two capacity. */
+    unsigned cap;
+    unsigned head;
+    unsigned count;
+    size_t off;                 /* Bytes of the head already sent. */
+    size_t bytes;               /* Bytes queued, less off. */
+};
+
+static inline int sendq_empty (const struct sendq *q)
+{
+    return !q->count;
+}
+
+/**
+*	\brief	Describes up to max of the oldest queued messages in iov, starting
+*			with what is left of the head.
+*	\param	len - To store the number of bytes described.
+*	\return	The number of entries filled in.
+*/
+int sendq_iov (const struct sendq *q, struct iovec *iov, int max,
+               size_t *len);
+
+/**
+*	\return	The i-th oldest entry of q, which must hold more than i.
+*/
+const struct sendq_entry *sendq_peek (const struct sendq *q, unsigned i);
+
+/**
+*	\brief	Appends m to q, taking a reference to it. The first skip bytes of
+*			m are not sent.
+*	\return	0 on success, or -1 on failure.
+*/
+int sendq_push (struct sendq *q, struct msgbuf *m, size_t skip);
+
+/**
+*	\brief	Makes every message that has not started going out skip skip
+*			bytes instead, for a connection that changed protocol.
+*/
+void sendq_reskip (struct sendq *q, size_t skip);
+
+/**
+*	\brief	Marks n bytes from the front of q as sent.
+*/
+void sendq_consume (struct sendq *q, size_t n);
+
+/**
+*	\brief	Drops whole messages, oldest first, until at least need bytes have
+*			been freed. A message that is partly sent is kept, so that the
+*			peer never sees half of one.
+*	\return	The number of bytes freed.
+*/
+size_t sendq_drop_oldest (struct sendq *q, size_t need);
+
+void sendq_clear (struct sendq *q);
+
+#endif /* SENDQ_H */
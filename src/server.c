@@ -8,24 +8,35 @@
 
 #define _POSIX_C_SOURCE 200819L
 #define _XOPEN_SOURCE   700
+#define _DEFAULT_SOURCE         /* SO_REUSEPORT */
+#define _GNU_SOURCE             /* accept4() */
 
 
 
 #include "server.h"
 #include "client_info.h"
 #include "err.h"
+#include "event.h"
+#include "evlog.h"
+#include "metrics.h"
 #include "internal.h"
 #include "network.h"
+#include "recvbuf.h"
 #include "utils.h"
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <netinet/tcp.h>
 
 
-static void configure_tcp (int slave_fd)
+/**
+*	\brief	Turns on keepalive. Set on a listener, it is inherited by every
+*			socket accepted from it.
+*/
+static void configure_tcp (int fd)
 {
     struct option {
         int level;
@@ -40,7 +51,7 @@ static void configure_tcp (int slave_fd)
 
     for (size_t i = 0; i < ARRAY_CARDINALITY (options); i++) {
         if (setsockopt
-            (slave_fd, options[i].level, options[i].opt_name,
+            (fd, options[i].level, options[i].opt_name,
              options[i].opt_val, sizeof (int)) == -1) {
             perror ("setsockopt()");
         }
@@ -55,97 +66,118 @@ void excuse_server (int slave_fd)
     if (send_internal (slave_fd, logs[SS_CONN_SURPLUS], &nbytes) == -1) {
         perror ("send()");
     } else if (nbytes != len) {
-        err_ret (log_fp, LOG_FULLTIME, logs[SS_FAILED_EXCUSE],
-                 PROGRAM_NAME);
+        log_event (SS_FAILED_EXCUSE, PROGRAM_NAME);
     }
 }
 
-static void write_slave_info (int slave_fd, struct client_info *client_info)
+/**
+*	\brief	Stores the binary form of a peer's address, with IPv4-mapped IPv6
+*			addresses unmapped.
+*/
+static void set_client_addr (struct client_addr *addr,
+                             const struct sockaddr_storage *peer)
 {
-    struct sockaddr slave_addr = { 0 };
-    socklen_t addr_len = sizeof slave_addr;
-    char local_ip[INET6_ADDRSTRLEN] = { 0 };
+    static const uint8_t v4_mapped[12] = {[10] = 0xFF,[11] = 0xFF };
 
-    if (getsockname (slave_fd, &slave_addr, &addr_len) == -1) {
-        perror ("getsockname()");
-        return;
-    }
-    if (!inet_ntop (AF_INET6, &slave_addr, local_ip, sizeof local_ip)) {
-        perror ("inet_ntop()");
-        return;
+    *addr = (struct client_addr) { 0 };
+
+    if (peer->ss_family == AF_INET) {
+        const struct sockaddr_in *const sin = (const void *) peer;
+
+        addr->family = AF_INET;
+        memcpy (addr->bytes, &sin->sin_addr, sizeof sin->sin_addr);
+    } else if (peer->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *const sin6 = (const void *) peer;
+        const uint8_t *const a = sin6->sin6_addr.s6_addr;
+
+        if (!memcmp (a, v4_mapped, sizeof v4_mapped)) {
+            addr->family = AF_INET;
+            memcpy (addr->bytes, a + sizeof v4_mapped, 4);
+        } else {
+            addr->family = AF_INET6;
+            memcpy (addr->bytes, a, 16);
+        }
     }
-    char host[NI_MAXHOST] = { 0 };
-    char service[NI_MAXSERV] = { 0 };
-    int ret_val = 0;
+}
 
-    if ((ret_val =
-         getnameinfo (&slave_addr, addr_len, host,
-                      sizeof host, service, sizeof service,
-                      NI_NUMERICHOST | NI_NUMERICSERV)) != 0) {
-        err_ret (log_fp, LOG_FULLTIME, "%s: getnameinfo(): %s\n",
-                 PROGRAM_NAME, gai_strerror (ret_val));
+/**
+*	\brief	Records where a new connection came from, and logs it. The
+*			address is formatted, if at all, by whoever writes the log.
+*/
+static void note_peer (int slave_fd, struct client_info *client_info,
+                       const struct sockaddr_storage *peer)
+{
+    set_client_addr (&client_info->address, peer);
+    log_event (SS_NEW_CONN, PROGRAM_NAME, (const struct sockaddr *) peer,
+               slave_fd);
+}
+
+void init_connection (int slave_fd, struct client_info *client_info)
+{
+    struct sockaddr_storage peer = { 0 };
+    socklen_t addr_len = sizeof peer;
+
+    if (getpeername (slave_fd, (struct sockaddr *) &peer, &addr_len) == -1) {
+        perror ("getpeername()");
         return;
     }
-    err_ret (log_fp, LOG_FULLTIME, logs[SS_NEW_CONN], PROGRAM_NAME, host,
-             service, local_ip, slave_fd);
-    memcpy (client_info->address, local_ip, sizeof local_ip);
+    note_peer (slave_fd, client_info, &peer);
 }
+
 /**
-*	\brief 	 Accepts a new connection.
+*	\brief 	 Accepts a new connection, non-blocking and close-on-exec from the
+*			 start, with the options the listener was given.
 *	\param	 master_fd - The listening server socket.
-*	\param   client_info - To store the slave IP address.
+*	\param   client_info - To store the peer's address.
 *	\return	 The slave file descriptor on success, or -1 on failure.
 */
 int accept_new_connection (int master_fd, struct client_info *client_info)
 {
-    int slave_fd = 0;
-    struct sockaddr slave_addr = { 0 };
-    socklen_t addr_len = sizeof slave_addr;
-
-    if ((slave_fd = accept (master_fd, &slave_addr, &addr_len)) == -1) {
-        perror ("accept()");
-        goto fail;
-    }
-    configure_tcp (slave_fd);
-
-    if (enable_nonblocking (slave_fd) == -1) {
-        perror ("fcntl()");
-        goto close_n_fail;
+    struct sockaddr_storage peer = { 0 };
+    socklen_t addr_len = sizeof peer;
+    const int slave_fd = accept4 (master_fd, (struct sockaddr *) &peer,
+                                  &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (slave_fd == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror ("accept4()");
+        }
+        return -1;
     }
-    write_slave_info (slave_fd, client_info);
+    note_peer (slave_fd, client_info, &peer);
     return slave_fd;
-
-  close_n_fail:
-    close_descriptor (slave_fd);
-  fail:
-    return -1;
 }
 
-void remove_existing_connection (fd_set * master, int max,
-                                        int slave_fd,
-                                        struct client_info *slave_info,
-                                        struct client_info *p_slaves[],
-                                        int *n_slaves)
+void remove_existing_connection (struct event_loop *loop,
+                                 struct client_info *slave_info,
+                                 struct client_table *table)
 {
-    const struct client_info *key;
+    struct client_info *key;
 
-    for (key = 0; key = ss_search (*n_slaves, p_slaves, &slave_info, comp_client_address); ) {
-        FD_CLR (key->sock, master);
-        close_descriptor (key->sock);
-        clear_client_entry (key->id, p_slaves);
-        (*n_slaves)--;
+    while ((key = find_predecessor (table, slave_info))) {
+        metric_add (M_EVICTED, 1);
+        drop_connection (loop, key, table);
     }
-    fill_client_entry (slave_fd, find_empty_slot (p_slaves, max), *n_slaves,
-                p_slaves, slave_info);
+}
+
+void drop_connection (struct event_loop *loop, struct client_info *slave,
+                      struct client_table *table)
+{
+    discard_output (loop, slave, table);
+    recvbuf_free (&slave->rbuf, &table->rings);
+    event_del (loop, slave->sock);
+    close_descriptor (slave->sock);
+    clear_client_entry (slave->id, table);
 }
 
 
 /**
 *	\brief 	Opens a TCP socket, binds to it, and sets it to listening and non-blocking mode.
 *	\param	servinfo - A struct of type struct addrinfo.
+*	\param	flags - SERVER_REUSEPORT, or 0.
 *	\return A listening socket descriptor, or -1 on failure. 
 */
-static int open_tcp_socket (struct addrinfo *const *servinfo)
+static int open_tcp_socket (struct addrinfo *const *servinfo, unsigned flags)
 {
     int master_fd = 0;
     struct addrinfo *p = 0;
@@ -161,6 +193,17 @@ static int open_tcp_socket (struct addrinfo *const *servinfo)
                         sizeof (int)) == -1) {
             perror ("setsockopt()");
         }
+        /*
+         * Let every reactor bind its own listener to the port, and the
+         * kernel spread incoming connections between them.
+         */
+        if (flags & SERVER_REUSEPORT
+            && setsockopt (master_fd, SOL_SOCKET, SO_REUSEPORT, (int[]) { 1 },
+                           sizeof (int)) == -1) {
+            perror ("setsockopt()");
+            close_descriptor (master_fd);
+            continue;
+        }
         if (bind (master_fd, p->ai_addr, p->ai_addrlen) == -1) {
             perror ("bind()");
             close_descriptor (master_fd);
@@ -170,14 +213,15 @@ static int open_tcp_socket (struct addrinfo *const *servinfo)
     }
 
     if (!p) {
-        err_ret (log_fp, LOG_FULLTIME, logs[SS_SOCKET_ERROR],
-                 PROGRAM_NAME);
+        log_event (SS_SOCKET_ERROR, PROGRAM_NAME);
         goto fail;
     }
     if (enable_nonblocking (master_fd) == -1) {
         perror ("fcntl()");
         goto close_n_fail;
     }
+    configure_tcp (master_fd);
+
     if (listen (master_fd, SOMAXCONN) == -1) {
         perror ("listen()");
         goto close_n_fail;
@@ -206,11 +250,52 @@ static int init_addr (struct addrinfo **servinfo)
     return ret_val ? -1 : 0;
 }
 
+int probe_server (void)
+{
+    struct addrinfo *servinfo;
+    int status = 0;
+
+    if (init_addr (&servinfo)) {
+        return -1;
+    }
+    for (struct addrinfo * p = servinfo; p; p = p->ai_next) {
+        const int fd = socket (p->ai_family, p->ai_socktype, p->ai_protocol);
+
+        if (fd == -1) {
+            continue;
+        }
+        if (setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, (int[]) { 1 },
+                        sizeof (int)) == -1) {
+            perror ("setsockopt()");
+        }
+        /*
+         * Only a port in use counts: an address we could not bind for
+         * any other reason is skipped by setup_server() too.
+         */
+        if (bind (fd, p->ai_addr, p->ai_addrlen) == -1 && errno == EADDRINUSE) {
+            perror ("bind()");
+            status = -1;
+        }
+        close_descriptor (fd);
+
+        if (status == -1) {
+            break;
+        }
+    }
+    freeaddrinfo (servinfo);
+
+    if (status == -1) {
+        log_event (SS_SOCKET_ERROR, PROGRAM_NAME);
+    }
+    return status;
+}
+
 /**
 *	\brief	Opens a new file descriptor, binds to it, and set it to listening mode.
+*	\param	flags - SERVER_REUSEPORT, or 0.
 *	\return	A new socket descriptor on success, or -1 on failure. 
 */
-int setup_server (void)
+int setup_server (unsigned flags)
 {
     struct addrinfo *servinfo;
 
@@ -218,7 +303,7 @@ int setup_server (void)
         goto fail;
     }
 
-    const int master_fd = open_tcp_socket (&servinfo);
+    const int master_fd = open_tcp_socket (&servinfo, flags);
 
     if (master_fd == -1) {
         freeaddrinfo (servinfo);
@@ -3,30 +3,66 @@
 
 #include "client_info.h"
 
-#include <sys/select.h>
 #include <netdb.h>
 
+struct event_loop;
+
 /**
 *	\brief 	 Accepts a new connection.
 *	\param	 master_fd - The listening server socket.
-*	\param   client_info - To store the slave IP address.
-*	\return	 The slave file descriptor on success, or -1 on failure.
+*	\param   client_info - To store the peer's address.
+*	\return	 The slave file descriptor on success, or -1 on failure. errno is
+*			 EAGAIN or EWOULDBLOCK once the backlog has been drained, and
+*			 ECONNABORTED if only this connection was lost.
 */
 int accept_new_connection (int master_fd, struct client_info *client_info);
 
-// int open_tcp_socket (struct addrinfo *const *servinfo);
+/**
+*	\brief	Sets up a connection that has already been accepted as non-blocking,
+*			e.g. by io_uring, which does not say who from.
+*	\param	slave_fd - The accepted socket.
+*	\param	client_info - To store the peer's address.
+*/
+void init_connection (int slave_fd, struct client_info *client_info);
+
+// int open_tcp_socket (struct addrinfo *const *servinfo, unsigned flags);
+
+/*
+*	Flags for setup_server().
+*/
+#define SERVER_REUSEPORT	0x01	/* Share the port with other listeners. */
 
 /**
 *	\brief	Opens a new file descriptor, binds to it, and set it to listening mode.
+*	\param	flags - SERVER_REUSEPORT, or 0.
 *	\return	A new socket descriptor on success, or -1 on failure. 
 */
-int setup_server (void);
+int setup_server (unsigned flags);
+
+/**
+*	\brief	Checks that nothing is listening on the port yet. Listeners that
+*			share the port with SO_REUSEPORT would share it just as readily
+*			with another copy of the server, so this binds without it.
+*	\return	0 if the port is free, or -1 if it is in use or cannot be
+*			looked up.
+*/
+int probe_server (void);
 
 void excuse_server (int slave_fd);
-void remove_existing_connection (fd_set * master, int max,
-                                        int slave_fd,
-                                        struct client_info *slave_info,
-                                        struct client_info *p_slaves[],
-                                        int *n_slaves);
+
+/**
+*	\brief	Closes every connection in table from slave_info's address that
+*			was accepted before it, and stops watching it.
+*/
+void remove_existing_connection (struct event_loop *loop,
+                                 struct client_info *slave_info,
+                                 struct client_table *table);
+
+/**
+*	\brief	Stops watching slave, throws away its queued output and any
+*			partial line, closes its socket, and frees its entry in table.
+*/
+void drop_connection (struct event_loop *loop, struct client_info *slave,
+                      struct client_table *table);
 
 #endif /* SERVER_H */
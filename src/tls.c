@@ -0,0 +1,188 @@
+#ifdef _POSIX_C_SOURCE
+#undef _POSIX_C_SOURCE
+#endif
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE         /* TCP_ULP */
+
+#include "tls.h"
+#include "config.h"
+#include "event.h"
+#include "internal.h"
+#include "metrics.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+/*
+*	Ciphers the kernel can take TLS 1.2 sessions over in.
+*/
+#define KTLS_CIPHERS \
+    "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:" \
+    "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:" \
+    "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305"
+
+/*
+*	Shared by every reactor: OpenSSL locks the session cache itself.
+*/
+static SSL_CTX *ctx;
+
+/**
+*	\return	Whether the kernel has TLS support, which it shows by letting a
+*			connected TCP socket take the "tls" upper-layer protocol.
+*/
+static int ktls_available (void)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl (INADDR_LOOPBACK)
+    };
+    socklen_t len = sizeof addr;
+    const int listener = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    const int fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    const int ok = listener != -1 && fd != -1
+        && bind (listener, (struct sockaddr *) &addr, len) == 0
+        && listen (listener, 1) == 0
+        && getsockname (listener, (struct sockaddr *) &addr, &len) == 0
+        && connect (fd, (struct sockaddr *) &addr, len) == 0
+        && setsockopt (fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof "tls") == 0;
+
+    if (fd != -1) {
+        close (fd);
+    }
+    if (listener != -1) {
+        close (listener);
+    }
+    return ok;
+}
+
+int tls_init (const char *cert, const char *key)
+{
+    if (!ktls_available ()) {
+        fprintf (stderr, "%s: kernel TLS is not available; is the tls "
+                 "module loaded?\n", PROGRAM_NAME);
+        return -1;
+    }
+    if (!(ctx = SSL_CTX_new (TLS_server_method ()))) {
+        goto fail;
+    }
+    SSL_CTX_set_options (ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION
+                         | SSL_OP_NO_COMPRESSION
+                         | SSL_OP_CIPHER_SERVER_PREFERENCE);
+    SSL_CTX_set_min_proto_version (ctx, TLS1_2_VERSION);
+#if OPENSSL_VERSION_NUMBER < 0x30200000L
+    SSL_CTX_set_max_proto_version (ctx, TLS1_2_VERSION);
+#endif
+
+    if (!SSL_CTX_set_cipher_list (ctx, KTLS_CIPHERS)
+        || SSL_CTX_use_certificate_chain_file (ctx, cert) != 1
+        || SSL_CTX_use_PrivateKey_file (ctx, key, SSL_FILETYPE_PEM) != 1
+        || SSL_CTX_check_private_key (ctx) != 1
+        || !SSL_CTX_set_session_id_context (ctx,
+                                            (const unsigned char *)
+                                            PROGRAM_NAME,
+                                            sizeof PROGRAM_NAME - 1)) {
+        goto fail;
+    }
+
+    /*
+     * OpenSSL takes a cache size of 0 to mean no limit.
+     */
+    if (cfg.tls_sessions) {
+        SSL_CTX_set_session_cache_mode (ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size (ctx, cfg.tls_sessions);
+    } else {
+        SSL_CTX_set_session_cache_mode (ctx, SSL_SESS_CACHE_OFF);
+        SSL_CTX_set_options (ctx, SSL_OP_NO_TICKET);
+        SSL_CTX_set_num_tickets (ctx, 0);
+    }
+    return 0;
+
+  fail:
+    fprintf (stderr, "%s: could not set up TLS:\n", PROGRAM_NAME);
+    ERR_print_errors_fp (stderr);
+    tls_free ();
+    return -1;
+}
+
+void tls_free (void)
+{
+    SSL_CTX_free (ctx);
+    ctx = 0;
+}
+
+struct ssl_st *tls_accept (int fd)
+{
+    SSL *const ssl = SSL_new (ctx);
+
+    if (!ssl) {
+        ERR_clear_error ();
+        return 0;
+    }
+    if (!SSL_set_fd (ssl, fd)) {
+        ERR_clear_error ();
+        SSL_free (ssl);
+        return 0;
+    }
+    SSL_set_accept_state (ssl);
+    return ssl;
+}
+
+int tls_handshake (struct ssl_st *ssl, unsigned *events, const char **why)
+{
+    const int ret_val = SSL_do_handshake (ssl);
+
+    if (ret_val == 1) {
+        /*
+         * OpenSSL offloads each direction as its keys are set, if it can.
+         */
+        if (!BIO_get_ktls_send (SSL_get_wbio (ssl))
+            || !BIO_get_ktls_recv (SSL_get_rbio (ssl))) {
+            *why = "the kernel did not take the session";
+            metric_add (M_TLS_FAILED, 1);
+            return -1;
+        }
+        metric_add (M_TLS_HANDSHAKES, 1);
+
+        if (SSL_session_reused (ssl)) {
+            metric_add (M_TLS_RESUMED, 1);
+        }
+        return 1;
+    }
+    switch (SSL_get_error (ssl, ret_val)) {
+        case SSL_ERROR_WANT_READ:
+            *events = EV_READ;
+            return 0;
+        case SSL_ERROR_WANT_WRITE:
+            *events = EV_WRITE;
+            return 0;
+        case SSL_ERROR_SSL:{
+                const char *const reason =
+                    ERR_reason_error_string (ERR_peek_last_error ());
+
+                *why = reason ? reason : "protocol error";
+                break;
+            }
+        default:
+            *why = "the connection was lost";
+            break;
+    }
+    /*
+     * The error queue is per thread, and would otherwise grow.
+     */
+    ERR_clear_error ();
+    metric_add (M_TLS_FAILED, 1);
+    return -1;
+}
+
+void tls_close (struct ssl_st *ssl)
+{
+    SSL_free (ssl);
+}
@@ -0,0 +1,51 @@
+#ifndef TLS_H
+#define TLS_H
+
+/*
+*	TLS on the listener, with --tls-cert. OpenSSL does the handshake, on
+*	the event loop like any other I/O, and then hands the session's keys
+*	to the kernel (kTLS), which encrypts what is sent and decrypts what is
+*	received from then on. The socket goes back to being read and written
+*	with plain readv() and sendmsg(), batched sends included, and the
+*	session's SSL object is freed: a client costs no more once it is
+*	talking than a plaintext one.
+*
+*	Sessions are cached, and tickets issued, so that a client that comes
+*	back resumes its session rather than doing a full handshake.
+*
+*	OpenSSL before 3.2 offloads reception for TLS 1.2 only, so with those
+*	the listener speaks TLS 1.2, with the AEAD ciphers the kernel knows.
+*/
+struct ssl_st;
+
+/**
+*	\brief	Sets up TLS with the certificate chain in cert and the private
+*			key in key, and checks that the kernel can take sessions over.
+*	\return	0 on success, or -1 on failure.
+*/
+int tls_init (const char *cert, const char *key);
+
+void tls_free (void);
+
+/**
+*	\return	A session for the newly accepted socket fd, or NULL on failure.
+*/
+struct ssl_st *tls_accept (int fd);
+
+/**
+*	\brief	Takes ssl's handshake as far as its socket allows, and offloads
+*			the session to the kernel once it is done.
+*	\param	events - To store what the socket must be waited on for next,
+*					 EV_READ or EV_WRITE, if the handshake is not done.
+*	\param	why	   - To store why, if it failed.
+*	\return	1 once the socket carries the session, 0 if the handshake has
+*			further to go, or -1 on failure.
+*/
+int tls_handshake (struct ssl_st *ssl, unsigned *events, const char **why);
+
+/**
+*	\brief	Frees ssl, which may be NULL. Nothing is sent.
+*/
+void tls_close (struct ssl_st *ssl);
+
+#endif /* TLS_H */
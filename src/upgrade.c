@@ -0,0 +1,324 @@
+#ifdef _POSIX_C_SOURCE
+#undef _POSIX_C_SOURCE
+#endif
+
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE             /* close_range(), MSG_CMSG_CLOEXEC */
+
+#include "upgrade.h"
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+/*
+*	Where the new process finds its end of the socket pair.
+*/
+#define UPGRADE_FD	3
+
+_Static_assert (sizeof (struct upgrade_client) + RECVBUF_LEN <= UPGRADE_CHUNK,
+                "a client's record must fit in one chunk");
+
+extern char **environ;
+
+static char *const *args;
+static char exe[PATH_MAX];
+static int inherited = -1;
+static pid_t child = -1;
+
+/**
+*	\brief	Makes either side give up on the other after UPGRADE_TIMEOUT,
+*			rather than wait forever.
+*/
+static void set_timeouts (int chan)
+{
+    const struct timeval tv = {.tv_sec = UPGRADE_TIMEOUT };
+
+    if (setsockopt (chan, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv) == -1
+        || setsockopt (chan, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv) == -1) {
+        perror ("setsockopt()");
+    }
+}
+
+void upgrade_init (char *argv[])
+{
+    const ssize_t len = readlink ("/proc/self/exe", exe, sizeof exe - 1);
+
+    /*
+     * The path is looked up now: once the executable has been replaced,
+     * the link names the old one, deleted.
+     */
+    if (len > 0) {
+        exe[len] = '\0';
+    } else {
+        snprintf (exe, sizeof exe, "%s", argv[0]);
+    }
+    args = argv;
+
+    const char *const fd = getenv (UPGRADE_ENV);
+
+    if (fd) {
+        inherited = atoi (fd);
+        fcntl (inherited, F_SETFD, FD_CLOEXEC);
+        set_timeouts (inherited);
+        unsetenv (UPGRADE_ENV);
+    }
+}
+
+int upgrade_inherited (void)
+{
+    return inherited;
+}
+
+/**
+*	\return	environ, without any UPGRADE_ENV, and with var added, or NULL if
+*			the system is out of memory.
+*/
+static char **make_env (char *var)
+{
+    size_t n = 0;
+
+    while (environ[n]) {
+        n++;
+    }
+
+    char **const envp = malloc ((n + 2) * sizeof *envp);
+
+    if (!envp) {
+        return 0;
+    }
+
+    size_t j = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (strncmp (environ[i], UPGRADE_ENV "=", sizeof UPGRADE_ENV)) {
+            envp[j++] = environ[i];
+        }
+    }
+    envp[j++] = var;
+    envp[j] = 0;
+    return envp;
+}
+
+int upgrade_spawn (void)
+{
+    char var[sizeof UPGRADE_ENV + 16];
+    int sv[2];
+
+    snprintf (var, sizeof var, "%s=%d", UPGRADE_ENV, UPGRADE_FD);
+
+    if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        perror ("socketpair()");
+        return -1;
+    }
+
+    /*
+     * Nothing but system calls may be made between fork() and execve() in
+     * a threaded process, so the environment is made first.
+     */
+    char **const envp = make_env (var);
+
+    if (!envp) {
+        perror ("malloc()");
+        goto fail;
+    }
+    if ((child = fork ()) == -1) {
+        perror ("fork()");
+        free (envp);
+        goto fail;
+    }
+    if (!child) {
+        /*
+         * dup2() leaves a descriptor that is already in place as it is,
+         * close-on-exec and all.
+         */
+        if (sv[1] == UPGRADE_FD) {
+            fcntl (UPGRADE_FD, F_SETFD, 0);
+        } else if (dup2 (sv[1], UPGRADE_FD) == -1) {
+            _exit (127);
+        }
+        close_range (UPGRADE_FD + 1, ~0U, 0);
+        execve (exe, args, envp);
+        _exit (127);
+    }
+    free (envp);
+    close (sv[1]);
+    set_timeouts (sv[0]);
+    return sv[0];
+
+  fail:
+    close (sv[0]);
+    close (sv[1]);
+    return -1;
+}
+
+void upgrade_abort (int chan)
+{
+    if (child > 0) {
+        kill (child, SIGKILL);
+        waitpid (child, 0, 0);
+        child = -1;
+    }
+    close (chan);
+}
+
+int upgrade_send (int chan, enum upgrade_type type, const void *data,
+                  size_t len, int fd)
+{
+    struct upgrade_record rec = {.type = type,.len = (uint32_t) len };
+
+    return upgrade_send_record (chan, &rec, data, fd);
+}
+
+int upgrade_send_record (int chan, const struct upgrade_record *rec,
+                         const void *data, int fd)
+{
+    struct iovec iov[2] = {
+        {.iov_base = (void *) rec,.iov_len = sizeof *rec },
+        {.iov_base = (void *) data,.iov_len = rec->len },
+    };
+    union {
+        char buf[CMSG_SPACE (sizeof (int))];
+        struct cmsghdr align;
+    } u;
+    struct msghdr msg = {.msg_iov = iov,.msg_iovlen = 2 };
+
+    if (fd != -1) {
+        msg.msg_control = u.buf;
+        msg.msg_controllen = sizeof u.buf;
+
+        struct cmsghdr *const cmsg = CMSG_FIRSTHDR (&msg);
+
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+        memcpy (CMSG_DATA (cmsg), &fd, sizeof fd);
+    }
+
+    ssize_t ret_val;
+
+    while ((ret_val = sendmsg (chan, &msg, MSG_NOSIGNAL)) == -1
+           && errno == EINTR) ;
+
+    if (ret_val == -1) {
+        perror ("sendmsg()");
+        return -1;
+    }
+    return 0;
+}
+
+int upgrade_send_client (int chan, int reactor,
+                         const struct client_info *slave)
+{
+    char data[UPGRADE_CHUNK];
+    struct upgrade_client *const c = (struct upgrade_client *) (void *) data;
+    const struct sendq *const q = &slave->sendq;
+
+    *c = (struct upgrade_client) {
+        .address = slave->address,
+        .serial = slave->serial,
+        .since = slave->since,
+        .active = slave->active,
+        .sent = q->off,
+        .reactor = (uint32_t) reactor,
+        .flags = slave->flags & (CLIENT_PINGED | CLIENT_DEFLATE),
+        .mode = slave->rbuf.mode,
+        .room = slave->room,
+        .n_rooms = (uint32_t) slave->n_rooms,
+    };
+    for (int i = 0; i < slave->n_rooms; i++) {
+        c->rooms[i] = slave->rooms[i].room;
+    }
+
+    const size_t input = slave->rbuf.buf ? recvbuf_copy (&slave->rbuf,
+                                                         data + sizeof *c) : 0;
+
+    if (upgrade_send (chan, UPGRADE_CLIENT, data, sizeof *c + input,
+                      slave->sock) == -1) {
+        return -1;
+    }
+
+    /*
+     * Each message goes whole, skip and all, so that a client still
+     * deciding on its protocol can go on to either.
+     */
+    for (unsigned i = 0; i < q->count; i++) {
+        const struct sendq_entry *const e = sendq_peek (q, i);
+
+        for (size_t off = 0; off < e->msg->len; off += UPGRADE_CHUNK) {
+            const size_t left = e->msg->len - off;
+            const struct upgrade_record rec = {
+                .type = UPGRADE_OUTPUT,
+                .len = (uint32_t) (left < UPGRADE_CHUNK ? left
+                                   : UPGRADE_CHUNK),
+                .total = e->msg->len,
+                .skip = e->skip,
+            };
+
+            if (upgrade_send_record (chan, &rec, e->msg->data + off,
+                                     -1) == -1) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int upgrade_recv (int chan, struct upgrade_record *rec, void *data, int *fd)
+{
+    struct iovec iov[2] = {
+        {.iov_base = rec,.iov_len = sizeof *rec },
+        {.iov_base = data,.iov_len = UPGRADE_CHUNK },
+    };
+    union {
+        char buf[CMSG_SPACE (sizeof (int))];
+        struct cmsghdr align;
+    } u;
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = 2,
+        .msg_control = u.buf,
+        .msg_controllen = sizeof u.buf,
+    };
+    ssize_t ret_val;
+
+    *fd = -1;
+
+    while ((ret_val = recvmsg (chan, &msg, MSG_CMSG_CLOEXEC)) == -1
+           && errno == EINTR) ;
+
+    if (ret_val <= 0) {
+        if (ret_val == -1) {
+            perror ("recvmsg()");
+        }
+        return (int) ret_val;
+    }
+
+    const struct cmsghdr *const cmsg = CMSG_FIRSTHDR (&msg);
+
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET
+        && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy (fd, CMSG_DATA (cmsg), sizeof *fd);
+    }
+    if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)
+        || (size_t) ret_val < sizeof *rec
+        || (size_t) ret_val - sizeof *rec != rec->len) {
+        fprintf (stderr, "%s: malformed upgrade record\n", PROGRAM_NAME);
+
+        if (*fd != -1) {
+            close (*fd);
+            *fd = -1;
+        }
+        return -1;
+    }
+    return 1;
+}
@@ -0,0 +1,124 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include "client_info.h"
+
+#include <stdint.h>
+
+/*
+*	Live upgrade. On SIGUSR2 the server starts its executable afresh, from
+*	the path it was started from and with the same arguments, and hands the
+*	new process its listening sockets and every connection, so that a
+*	deploy neither drops nor refuses anyone.
+*
+*	The two talk over a socket pair, the new process's end of which it
+*	finds through UPGRADE_ENV. The old process goes on serving while the
+*	new one starts up. Once it is set up and says UPGRADE_READY, the old
+*	one stops its reactors where they are and sends, one record each, its
+*	listeners, the names of the rooms in the order they were numbered,
+*	and its clients: each with its socket, passed with SCM_RIGHTS, what the
+*	server knows of it, what it has half sent, and what is queued for it.
+*	The new process takes them over without touching a socket, and says
+*	UPGRADE_DONE; the old one closes its end and exits without a word to
+*	any client, and the new one starts once it sees that. If anything goes
+*	wrong before then, the new process is killed and the old one carries
+*	on as if nothing had happened.
+*
+*	A TLS handshake still under way cannot be handed over and is dropped;
+*	a client whose session the kernel has is handed over like any other.
+*	Histories kept in memory start afresh, and metrics from zero.
+*/
+#define UPGRADE_ENV			"SELECTSERVER_UPGRADE_FD"
+#define UPGRADE_CHUNK		32768	/* Most bytes of data in one record. */
+#define UPGRADE_TIMEOUT		10		/* Seconds either side waits on the other. */
+
+enum upgrade_type {
+    UPGRADE_READY = 1,          /* New: set up, and waiting. */
+    UPGRADE_LISTENER,           /* Old: a listening socket, one per reactor. */
+    UPGRADE_ROOM,               /* Old: the name of the next room. */
+    UPGRADE_CLIENT,             /* Old: a client, with its socket. */
+    UPGRADE_OUTPUT,             /* Old: a message queued for the client. */
+    UPGRADE_END,                /* Old: that was everything. */
+    UPGRADE_DONE                /* New: it has all been taken over. */
+};
+
+/*
+*	What comes before each record's data.
+*/
+struct upgrade_record {
+    uint32_t type;              /* enum upgrade_type */
+    uint32_t len;               /* Bytes of data that follow. */
+    uint64_t total;             /* UPGRADE_OUTPUT: the whole message's length,
+                                   over as many records as it takes.
+                                   UPGRADE_END: the last serial handed out. */
+    uint64_t skip;              /* UPGRADE_OUTPUT: bytes of it not sent. */
+};
+
+/*
+*	An UPGRADE_CLIENT record's data, followed by any partial line or frame.
+*/
+struct upgrade_client {
+    struct client_addr address;
+    uint64_t serial;
+    int64_t since;
+    int64_t active;
+    uint64_t sent;              /* Bytes of its first queued message sent. */
+    uint32_t reactor;
+    uint32_t flags;             /* CLIENT_PINGED and CLIENT_DEFLATE. */
+    uint32_t mode;              /* enum recv_mode */
+    int32_t room;
+    uint32_t n_rooms;
+    uint16_t rooms[CLIENT_MAX_ROOMS];
+};
+
+/**
+*	\brief	Remembers how the server was started, and finds out whether it
+*			was started to take over from another process.
+*/
+void upgrade_init (char *argv[]);
+
+/**
+*	\return	The socket to the process being taken over from, or -1 if
+*			there is none.
+*/
+int upgrade_inherited (void);
+
+/**
+*	\brief	Starts the new process.
+*	\return	The socket to it, or -1 on failure.
+*/
+int upgrade_spawn (void);
+
+/**
+*	\brief	Gives up on the new process: kills it if it is still running,
+*			waits for it, and closes chan.
+*/
+void upgrade_abort (int chan);
+
+/**
+*	\brief	Sends a record of type with len bytes of data, or rec with its
+*			rec->len, and the descriptor fd unless it is -1.
+*	\return	0 on success, or -1 on failure.
+*/
+int upgrade_send (int chan, enum upgrade_type type, const void *data,
+                  size_t len, int fd);
+int upgrade_send_record (int chan, const struct upgrade_record *rec,
+                         const void *data, int fd);
+
+/**
+*	\brief	Sends an UPGRADE_CLIENT record for slave, which reactor serves,
+*			and an UPGRADE_OUTPUT record for each message queued for it.
+*	\return	0 on success, or -1 on failure.
+*/
+int upgrade_send_client (int chan, int reactor,
+                         const struct client_info *slave);
+
+/**
+*	\brief	Receives a record, and its data into data, which has room for
+*			UPGRADE_CHUNK bytes.
+*	\param	fd - To store the descriptor passed with it, or -1.
+*	\return	1 on success, 0 at end of file, or -1 on failure.
+*/
+int upgrade_recv (int chan, struct upgrade_record *rec, void *data, int *fd);
+
+#endif /* UPGRADE_H */
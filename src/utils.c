@@ -3,10 +3,12 @@
 #include "err.h"
 
 #include <stdio.h>
+#include <limits.h>
 #include <errno.h>
 #include <signal.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/resource.h>
 
 int open_logfile (void)
 {
@@ -17,28 +19,12 @@ int open_logfile (void)
     return 0;
 }
 
-int enable_line_buf (void)
-{
-    /*
-     * Be less efficient here, to solve a problem more important
-     * than mere efficiency.
-     */
-	errno = 0;
-
-    if (setvbuf (log_fp, 0, _IOLBF, 0)) {
-        if (errno) {
-			perror ("setvbuf()");
-		}
-		return -1;
-    }
-    return 0;
-}
-
 int close_log_file (void)
 {
+    log_stop ();
+
     if (fclose (log_fp) == EOF) {
-        err_ret (log_fp, LOG_FULLTIME, logs[SS_FCLOSE_ERROR],
-                 PROGRAM_NAME);
+        err_ret (0, LOG_FULLTIME, logs[SS_FCLOSE_ERROR], PROGRAM_NAME);
     }
     return -1;
 }
@@ -47,7 +33,9 @@ void sig_handler (int sig)
 {
     const int saved_errno = errno;
 
-    if (write (pfds[1], "x", 1) == -1
+    const char ch = (char) sig;
+
+    if (write (pfds[1], &ch, 1) == -1
         && (errno != EAGAIN || errno != EWOULDBLOCK)) {
         signal (sig, SIG_DFL);
         raise (sig);
@@ -64,28 +52,31 @@ void close_descriptor (int fd)
 
 int enable_nonblocking (int fd)
 {
-    int cmd = F_GETFL;
-    int flags;
+    /*
+     * A pipe's read end has no flags at all, so 0 from F_GETFL is not
+     * the end of it.
+     */
+    const int flags = fcntl (fd, F_GETFL);
 
-	/* The loop would exit after the second iteration because fcntl()
-	*  would return 0.
-	*/
-    for (flags = 0; flags = fcntl (fd, cmd, flags); flags |= O_NONBLOCK) {
-        cmd = F_SETFL;
-    }
-    return flags;
+    return flags == -1 ? -1 : fcntl (fd, F_SETFL, flags | O_NONBLOCK);
 }
 
-struct client_info *ss_search (int size, struct client_info *p_slaves[size],
-                        struct client_info *const *ptr, int (*func) (const void *,
-                                                              const void *))
+int raise_fd_limit (void)
 {
-    for (int i = 0; i < size; i++) {
-        if (!func (ptr, &p_slaves[i])) {
-            return p_slaves[i];
+    struct rlimit rl;
+
+    if (getrlimit (RLIMIT_NOFILE, &rl) == -1) {
+        perror ("getrlimit()");
+        return -1;
+    }
+    if (rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+
+        if (setrlimit (RLIMIT_NOFILE, &rl) == -1) {
+            perror ("setrlimit()");
+            getrlimit (RLIMIT_NOFILE, &rl);
         }
     }
-    return 0;
+    return rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > INT_MAX
+        ? INT_MAX : (int) rl.rlim_cur;
 }
-
-
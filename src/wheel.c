@@ -0,0 +1,148 @@
+#include "wheel.h"
+
+#include <stddef.h>
+
+#define SLOT_MASK (WHEEL_SLOTS - 1)
+
+void wheel_init (struct wheel *w, long long now)
+{
+    *w = (struct wheel) {.tick = now / WHEEL_TICK_MS };
+}
+
+static void link_timer (struct wheel *w, struct timer *t)
+{
+    const unsigned slot = (unsigned) (t->expires & SLOT_MASK);
+
+    t->next = w->slots[slot];
+    t->pprev = &w->slots[slot];
+
+    if (t->next) {
+        t->next->pprev = &t->next;
+    }
+    w->slots[slot] = t;
+    w->busy[slot / 64] |= (uint64_t) 1 << (slot % 64);
+    w->count++;
+}
+
+static void unlink_timer (struct wheel *w, struct timer *t)
+{
+    const unsigned slot = (unsigned) (t->expires & SLOT_MASK);
+
+    *t->pprev = t->next;
+
+    if (t->next) {
+        t->next->pprev = t->pprev;
+    }
+    t->next = 0;
+    t->pprev = 0;
+
+    if (!w->slots[slot]) {
+        w->busy[slot / 64] &= ~((uint64_t) 1 << (slot % 64));
+    }
+    w->count--;
+}
+
+void timer_schedule (struct wheel *w, struct timer *t, long long when)
+{
+    /*
+     * Rounded up, so that a timer never fires early.
+     */
+    const long long tick = (when + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+
+    if (timer_pending (t)) {
+        unlink_timer (w, t);
+    }
+    t->expires = tick > w->tick ? tick : w->tick;
+    link_timer (w, t);
+}
+
+void timer_cancel (struct wheel *w, struct timer *t)
+{
+    if (timer_pending (t)) {
+        unlink_timer (w, t);
+    }
+}
+
+int wheel_timeout (const struct wheel *w, long long now)
+{
+    if (!w->count) {
+        return -1;
+    }
+
+    /*
+     * The first busy slot from the next tick on, found a word of the
+     * bitmap at a time.
+     */
+    const unsigned from = (unsigned) (w->tick & SLOT_MASK);
+    long long ahead = WHEEL_SLOTS;
+
+    for (unsigned i = 0; i <= WHEEL_SLOTS / 64; i++) {
+        const unsigned word = (from / 64 + i) % (WHEEL_SLOTS / 64);
+        uint64_t bits = w->busy[word];
+
+        /*
+         * Slots before from in its word come round last.
+         */
+        if (!i) {
+            bits &= ~(uint64_t) 0 << (from % 64);
+        } else if (i == WHEEL_SLOTS / 64) {
+            bits &= ((uint64_t) 1 << (from % 64)) - 1;
+        }
+        if (bits) {
+            const unsigned slot = word * 64 + (unsigned) __builtin_ctzll (bits);
+
+            ahead = (long long) ((slot - from) & SLOT_MASK);
+            break;
+        }
+    }
+
+    const long long left = (w->tick + ahead) * WHEEL_TICK_MS - now;
+
+    return left > 0 ? (int) left : 0;
+}
+
+/**
+*	\brief	Fires the timers in slot that are due by tick.
+*/
+static void run_slot (struct wheel *w, unsigned slot, long long tick,
+                      wheel_fn *fn, void *arg)
+{
+    struct timer **pp = &w->slots[slot];
+
+    while (*pp) {
+        struct timer *const t = *pp;
+
+        /*
+         * Later revolutions' timers stay where they are.
+         */
+        if (t->expires > tick) {
+            pp = &t->next;
+            continue;
+        }
+        unlink_timer (w, t);
+        fn (t, arg);
+    }
+}
+
+void wheel_advance (struct wheel *w, long long now, wheel_fn *fn, void *arg)
+{
+    const long long tick = now / WHEEL_TICK_MS;
+
+    if (tick < w->tick) {
+        return;
+    }
+
+    /*
+     * After a long wait, one revolution visits every slot. The clock is
+     * moved on first, so that a timer rescheduled on the way goes into a
+     * later tick.
+     */
+    const long long first = tick - w->tick >= WHEEL_SLOTS
+        ? tick - WHEEL_SLOTS + 1 : w->tick;
+
+    w->tick = tick + 1;
+
+    for (long long t = first; t <= tick && w->count; t++) {
+        run_slot (w, (unsigned) (t & SLOT_MASK), tick, fn, arg);
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdint.h>
+
+/*
+*	A hashed timing wheel: WHEEL_SLOTS lists of timers, one per tick of
+*	WHEEL_TICK_MS, that a timer is hashed into by the tick it expires on.
+*	Scheduling and cancelling are O(1), and each tick visits one slot,
+*	however many timers there are. A timer further off than the wheel
+*	turns in one revolution sits in its slot until the revolution it is
+*	due in.
+*/
+#define WHEEL_SLOTS		1024    /* A power of 2. */
+#define WHEEL_TICK_MS	100
+
+struct timer {
+    struct timer *next;
+    struct timer **pprev;       /* NULL while the timer is not scheduled. */
+    long long expires;          /* In ticks. */
+};
+
+struct wheel {
+    struct timer *slots[WHEEL_SLOTS];
+    uint64_t busy[WHEEL_SLOTS / 64];    /* Which slots hold timers. */
+    long long tick;             /* The next tick to run. */
+    int count;                  /* Timers scheduled. */
+};
+
+/**
+*	\brief	Called for each timer that expires, which is no longer
+*			scheduled by then. It may schedule or cancel t, but no other
+*			timer.
+*/
+typedef void wheel_fn (struct timer *t, void *arg);
+
+/**
+*	\param	now - CLOCK_MONOTONIC, in milliseconds, as for every time here.
+*/
+void wheel_init (struct wheel *w, long long now);
+
+static inline int timer_pending (const struct timer *t)
+{
+    return t->pprev != 0;
+}
+
+/**
+*	\brief	Schedules t to expire at when, or on the next tick if that has
+*			passed, rescheduling it if it was scheduled already.
+*/
+void timer_schedule (struct wheel *w, struct timer *t, long long when);
+
+/**
+*	\brief	Unschedules t, if it is scheduled.
+*/
+void timer_cancel (struct wheel *w, struct timer *t);
+
+/**
+*	\return	How many milliseconds from now the next tick with timers in its
+*			slot is due, or -1 if there are no timers.
+*/
+int wheel_timeout (const struct wheel *w, long long now);
+
+/**
+*	\brief	Runs the ticks up to now, calling fn for each timer due.
+*/
+void wheel_advance (struct wheel *w, long long now, wheel_fn *fn, void *arg);
+
+#endif /* WHEEL_H */
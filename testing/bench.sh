@@ -0,0 +1,25 @@
+#!/bin/bash
+#
+# Starts the server, drives it with loadgen for a while, and stops it.
+# Arguments are passed to loadgen; SERVER_ARGS, if set, to the server.
+#
+# 	SERVER_ARGS="-t 4 -b uring" make bench BENCH_ARGS="-c 2000 -r 5000"
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# The server writes its log to the working directory.
+cd "$dir" || exit 1
+# shellcheck disable=SC2086
+"$root/bin/selectserver" -a "$dir/admin.sock" $SERVER_ARGS >/dev/null 2>&1 &
+pid=$!
+sleep 0.5
+
+"$root/bin/loadgen" --pid "$pid" --admin "$dir/admin.sock" "$@"
+status=$?
+
+# A background job ignores SIGINT, so it is stopped with SIGTERM.
+kill -TERM "$pid"
+wait "$pid"
+exit $status
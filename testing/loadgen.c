@@ -0,0 +1,901 @@
+/**
+*	@file	loadgen.c
+*
+*	@brief	A load generator and latency benchmark for the chat server.
+*
+*	One process, one epoll loop: it opens a number of connections, has some
+*	of them send lines at a steady overall rate, and times each line from
+*	when it was sent to when each other client receives it. Every line
+*	carries its sender and send time:
+*
+*	    "SENDER NANOSECONDS xxx...\n"
+*
+*	The server turns away a connection's predecessors from the same
+*	address, so to a loopback server, each connection is bound to an
+*	address of its own in 127.0.0.0/8.
+*
+*	With --compress, every connection speaks the binary protocol and asks
+*	for compression, the lines go out as FRAME_DATA frames, and what comes
+*	back compressed is inflated before it is timed. The bytes that saved
+*	are counted, and with --admin, set against the time the server spent
+*	compressing, from its metrics.
+*/
+
+#ifdef _POSIX_C_SOURCE
+#undef _POSIX_C_SOURCE
+#endif
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+
+#include <zlib.h>
+
+#include "compress.h"
+#include "frame.h"
+
+#define LOADGEN_NAME "loadgen"
+#define RBUF_LEN	(64 * 1024)
+#define LINE_MAX_LEN 8192
+#define MAX_EVENTS	256
+#define TICK_NS		1000000     /* How often senders are topped up. */
+
+/*
+*	Latencies are counted in log-linear buckets, as the server's metrics
+*	are: 16 to each power of 2 of nanoseconds, so a percentile is off by
+*	at most 1/16.
+*/
+#define HIST_SUB_SHIFT	4
+#define HIST_SUB		(1 << HIST_SUB_SHIFT)
+#define HIST_BUCKETS	(64 * HIST_SUB)
+
+struct conn {
+    int fd;
+    int connected;
+    size_t len;                 /* Of a partial line in buf. */
+    char *buf;
+};
+
+static struct {
+    const char *host;
+    const char *port;
+    int conns;
+    int senders;
+    double rate;                /* Lines per second, all senders together. */
+    double duration;            /* Seconds. */
+    double warmup;              /* Seconds not measured. */
+    int size;                   /* Bytes per line. */
+    long pid;                   /* The server's, for its CPU use. */
+    int spread;                 /* Bind each connection to its own address. */
+    int compress;               /* Speak frames, and ask for compression. */
+    const char *admin;          /* The server's admin socket, or NULL. */
+} opts = {
+    .host = "127.0.0.1",
+    .port = "9909",
+    .conns = 500,
+    .senders = 10,
+    .rate = 2000,
+    .duration = 10,
+    .warmup = 1,
+    .size = 64,
+    .spread = -1,
+};
+
+static struct {
+    unsigned long long sent;
+    unsigned long long delivered;
+    unsigned long long late;    /* Delivered after the run. */
+    unsigned long long bytes_in;
+    unsigned long long bytes_plain;     /* bytes_in, as if uncompressed. */
+    unsigned long long hist[HIST_BUCKETS];
+    unsigned long long max_ns;
+} stats;
+
+static long long now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void usage (FILE *stream)
+{
+    fprintf (stream, "Usage: %s [OPTION]...\n"
+             "  -H, --host=HOST     Server address (default: 127.0.0.1).\n"
+             "  -p, --port=PORT     Server port (default: 9909).\n"
+             "  -c, --conns=N       Connections to open (default: 500).\n"
+             "  -s, --senders=N     How many of them send (default: 10).\n"
+             "  -r, --rate=N        Lines per second, all senders together\n"
+             "                      (default: 2000).\n"
+             "  -d, --duration=S    Seconds to measure for (default: 10).\n"
+             "  -w, --warmup=S      Seconds to send for first, unmeasured\n"
+             "                      (default: 1).\n"
+             "  -z, --size=BYTES    Bytes per line, newline included\n"
+             "                      (default: 64).\n"
+             "  -P, --pid=PID       Report the CPU time the server, PID, used.\n"
+             "  -S, --spread=0|1    Bind each connection to its own loopback\n"
+             "                      address (default: if HOST is loopback).\n"
+             "  -Z, --compress      Speak the binary protocol, with compression.\n"
+             "  -a, --admin=PATH    Read the server's metrics from PATH, to report\n"
+             "                      what compressing cost it.\n"
+             "  -h, --help          Show this help and exit.\n",
+             LOADGEN_NAME);
+}
+
+static int bucket_of (unsigned long long ns)
+{
+    if (ns < HIST_SUB) {
+        return (int) ns;
+    }
+
+    const int e = 63 - __builtin_clzll (ns);
+
+    return (e - HIST_SUB_SHIFT + 1) * HIST_SUB
+        + (int) (ns >> (e - HIST_SUB_SHIFT)) - HIST_SUB;
+}
+
+/**
+*	\return	The lower bound of bucket i, in nanoseconds.
+*/
+static unsigned long long bucket_floor (int i)
+{
+    if (i < HIST_SUB) {
+        return (unsigned long long) i;
+    }
+
+    const int e = i / HIST_SUB + HIST_SUB_SHIFT - 1;
+
+    return (unsigned long long) (i % HIST_SUB + HIST_SUB)
+        << (e - HIST_SUB_SHIFT);
+}
+
+static unsigned long long percentile (double p)
+{
+    unsigned long long total = 0;
+
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        total += stats.hist[i];
+    }
+
+    const unsigned long long rank = (unsigned long long) (p * (double) total);
+    unsigned long long seen = 0;
+
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += stats.hist[i];
+
+        if (seen > rank) {
+            return bucket_floor (i);
+        }
+    }
+    return stats.max_ns;
+}
+
+/**
+*	\brief	Reads the CPU time pid has used, in seconds.
+*	\return	0 on success, or -1 on failure.
+*/
+static int proc_cpu (long pid, double *user, double *sys)
+{
+    char path[64];
+    char line[1024];
+
+    snprintf (path, sizeof path, "/proc/%ld/stat", pid);
+
+    FILE *const fp = fopen (path, "r");
+
+    if (!fp) {
+        return -1;
+    }
+    if (!fgets (line, sizeof line, fp)) {
+        fclose (fp);
+        return -1;
+    }
+    fclose (fp);
+
+    /*
+     * The command name may hold spaces; the fields after it may not.
+     */
+    const char *p = strrchr (line, ')');
+    unsigned long utime, stime;
+
+    if (!p || sscanf (p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                      "%lu %lu", &utime, &stime) != 2) {
+        return -1;
+    }
+
+    const double hz = (double) sysconf (_SC_CLK_TCK);
+
+    *user = (double) utime / hz;
+    *sys = (double) stime / hz;
+    return 0;
+}
+
+/**
+*	\brief	Reads the counter name from the server's metrics at path.
+*	\return	Its value, or 0 if it cannot be read.
+*/
+static unsigned long long scrape (const char *path, const char *name)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX };
+    static char text[1 << 16];
+    const int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    size_t len = 0;
+    ssize_t n;
+
+    snprintf (addr.sun_path, sizeof addr.sun_path, "%s", path);
+
+    if (fd == -1 || connect (fd, (struct sockaddr *) &addr, sizeof addr) == -1) {
+        if (fd != -1) {
+            close (fd);
+        }
+        return 0;
+    }
+    while (len < sizeof text - 1
+           && (n = read (fd, text + len, sizeof text - 1 - len)) > 0) {
+        len += (size_t) n;
+    }
+    close (fd);
+    text[len] = '\0';
+
+    const size_t name_len = strlen (name);
+
+    for (const char *p = text; p; p = strchr (p, '\n')) {
+        p += *p == '\n';
+
+        if (!strncmp (p, name, name_len) && p[name_len] == ' ') {
+            return strtoull (p + name_len + 1, 0, 10);
+        }
+    }
+    return 0;
+}
+
+static int is_loopback (const struct addrinfo *ai)
+{
+    return ai->ai_family == AF_INET
+        && (ntohl (((const struct sockaddr_in *) (const void *) ai->ai_addr)->
+                   sin_addr.s_addr) >> 24) == 127;
+}
+
+static void raise_fd_limit (int need)
+{
+    struct rlimit rl;
+
+    if (getrlimit (RLIMIT_NOFILE, &rl) == 0
+        && rl.rlim_cur < (rlim_t) need) {
+        rl.rlim_cur = rl.rlim_max < (rlim_t) need ? rl.rlim_max : (rlim_t) need;
+        setrlimit (RLIMIT_NOFILE, &rl);
+    }
+}
+
+/**
+*	\brief	Starts connecting conn number i to ai.
+*	\return	0 on success, or -1 on failure.
+*/
+static int open_conn (struct conn *c, int i, const struct addrinfo *ai,
+                      int epfd)
+{
+    c->fd = socket (ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    0);
+
+    if (c->fd == -1) {
+        perror ("socket()");
+        return -1;
+    }
+
+    const int one = 1;
+
+    setsockopt (c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+    if (opts.spread) {
+        /*
+         * 127.1.0.1 on, clear of the addresses people tend to use.
+         */
+        struct sockaddr_in src = {
+            .sin_family = AF_INET,
+            .sin_addr.s_addr = htonl ((127u << 24) + (1u << 16) + 1
+                                      + (unsigned) i),
+        };
+
+        if (bind (c->fd, (struct sockaddr *) &src, sizeof src) == -1) {
+            perror ("bind()");
+            return -1;
+        }
+    }
+    if (connect (c->fd, ai->ai_addr, ai->ai_addrlen) == -1
+        && errno != EINPROGRESS) {
+        perror ("connect()");
+        return -1;
+    }
+
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT,.data.u32 = (uint32_t) i };
+
+    if (epoll_ctl (epfd, EPOLL_CTL_ADD, c->fd, &ev) == -1) {
+        perror ("epoll_ctl()");
+        return -1;
+    }
+    if (!(c->buf = malloc (RBUF_LEN))) {
+        perror ("malloc()");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+*	\brief	Times one received line, if it is one of ours and was sent while
+*			measuring.
+*/
+static void take_line (const char *line, long long now, long long measure_from,
+                       long long measure_to)
+{
+    long long sent;
+
+    if (sscanf (line, "%*d %lld", &sent) != 1 || sent < measure_from) {
+        return;
+    }
+    if (sent >= measure_to) {
+        stats.late++;
+        return;
+    }
+
+    const unsigned long long ns = now > sent ? (unsigned long long) (now - sent)
+        : 0;
+
+    stats.hist[bucket_of (ns)]++;
+    stats.delivered++;
+
+    if (ns > stats.max_ns) {
+        stats.max_ns = ns;
+    }
+}
+
+/**
+*	\brief	Times each whole line in the len bytes at text, which are
+*			overwritten.
+*/
+static void take_lines (char *text, size_t len, long long now,
+                        long long measure_from, long long measure_to)
+{
+    char *const end = text + len;
+    char *nl;
+
+    while ((nl = memchr (text, '\n', (size_t) (end - text)))) {
+        *nl = '\0';
+        take_line (text, now, measure_from, measure_to);
+        text = nl + 1;
+    }
+}
+
+/**
+*	\brief	Takes each whole frame at the start of c's buffer, inflating it if
+*			need be, and times the lines in FRAME_DATA frames.
+*	\return	0 on success, or -1 if a frame cannot be read.
+*/
+static int take_frames (struct conn *c, long long now, long long measure_from,
+                        long long measure_to)
+{
+    static char plain[RBUF_LEN];
+    size_t off = 0;
+    struct frame f;
+
+    while (c->len - off >= FRAME_HDR_LEN) {
+        frame_decode ((const unsigned char *) c->buf + off, &f);
+
+        if (f.length > RBUF_LEN - FRAME_HDR_LEN) {
+            return -1;
+        }
+        if (c->len - off < FRAME_HDR_LEN + f.length) {
+            break;
+        }
+
+        char *payload = c->buf + off + FRAME_HDR_LEN;
+        uLongf len = f.length;
+
+        if (f.type == FRAME_DATA && f.flags & FRAME_F_DEFLATE) {
+            len = sizeof plain;
+
+            if (uncompress ((Bytef *) plain, &len, (const Bytef *) payload,
+                            f.length) != Z_OK) {
+                return -1;
+            }
+            payload = plain;
+        }
+        stats.bytes_plain += FRAME_HDR_LEN + len;
+
+        if (f.type == FRAME_DATA) {
+            take_lines (payload, len, now, measure_from, measure_to);
+        }
+        off += FRAME_HDR_LEN + f.length;
+    }
+    c->len -= off;
+    memmove (c->buf, c->buf + off, c->len);
+    return 0;
+}
+
+/**
+*	\brief	Reads what c has been sent, and times each whole line.
+*	\return	0 on success, or -1 if the server closed the connection.
+*/
+static int drain (struct conn *c, long long measure_from, long long measure_to)
+{
+    for (;;) {
+        const ssize_t n = read (c->fd, c->buf + c->len, RBUF_LEN - c->len);
+
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1 && errno == EAGAIN) {
+            return 0;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        stats.bytes_in += (unsigned long long) n;
+
+        const long long now = now_ns ();
+
+        if (opts.compress) {
+            c->len += (size_t) n;
+
+            if (take_frames (c, now, measure_from, measure_to) == -1) {
+                return -1;
+            }
+            continue;
+        }
+        stats.bytes_plain += (unsigned long long) n;
+
+        char *start = c->buf;
+        char *const end = c->buf + c->len + n;
+        char *nl;
+
+        while ((nl = memchr (start, '\n', (size_t) (end - start)))) {
+            *nl = '\0';
+            take_line (start, now, measure_from, measure_to);
+            start = nl + 1;
+        }
+        c->len = (size_t) (end - start);
+
+        /*
+         * A line longer than the buffer is not one of ours.
+         */
+        if (c->len == RBUF_LEN) {
+            c->len = 0;
+        }
+        memmove (c->buf, start, c->len);
+    }
+}
+
+/**
+*	\brief	Writes len bytes of prose to text, to compress about as well as
+*			a pasted message would.
+*/
+static void fill_text (char *text, int len)
+{
+    static const char *const words[] = {
+        "the", "server", "message", "room", "client", "queue", "of", "and",
+        "a", "to", "is", "sent", "every", "member", "reactor", "socket",
+        "when", "it", "buffer", "frame", "in", "that", "for", "event",
+        "loop", "time", "with", "data", "which", "each", "line", "on",
+    };
+    static unsigned long long seed = 88172645463325252ULL;
+
+    for (int i = 0; i < len;) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+
+        const char *w = words[seed % (sizeof words / sizeof *words)];
+
+        while (*w && i < len) {
+            text[i++] = *w++;
+        }
+        if (i < len) {
+            text[i++] = ' ';
+        }
+    }
+}
+
+/**
+*	\brief	Sends one line from sender, stamped with the time.
+*/
+static void send_line (struct conn *c, int sender)
+{
+    char buf[FRAME_HDR_LEN + LINE_MAX_LEN];
+    char *const line = buf + FRAME_HDR_LEN;
+    int len = snprintf (line, LINE_MAX_LEN, "%d %lld ", sender, now_ns ());
+
+    if (len < opts.size - 1) {
+        fill_text (line + len, opts.size - 1 - len);
+        len = opts.size - 1;
+    }
+    line[len++] = '\n';
+
+    /*
+     * A binary client's lines go to the lobby.
+     */
+    if (opts.compress) {
+        frame_encode ((unsigned char *) buf, &(struct frame) {
+                      .length = (uint32_t) len,.type = FRAME_DATA}
+        );
+    }
+
+    const char *const out = opts.compress ? buf : line;
+    const size_t out_len = (size_t) len + (opts.compress ? FRAME_HDR_LEN : 0);
+
+    /*
+     * The server reads as fast as we can send; if it does not, that is
+     * worth knowing, and the line is counted as sent anyway.
+     */
+    if (write (c->fd, out, out_len) == -1 && errno != EAGAIN) {
+        perror ("write()");
+    }
+    stats.sent++;
+}
+
+/**
+*	\brief	Switches c to the binary protocol, and asks for compression.
+*	\return	0 on success, or -1 on failure.
+*/
+static int ask_compress (struct conn *c)
+{
+    char buf[FRAME_MAGIC_LEN + FRAME_HDR_LEN + sizeof COMPRESS_CODEC];
+    const size_t len = sizeof COMPRESS_CODEC - 1;
+
+    memcpy (buf, FRAME_MAGIC, FRAME_MAGIC_LEN);
+    frame_encode ((unsigned char *) buf + FRAME_MAGIC_LEN, &(struct frame) {
+                  .length = (uint32_t) len,.type = FRAME_COMPRESS}
+    );
+    memcpy (buf + FRAME_MAGIC_LEN + FRAME_HDR_LEN, COMPRESS_CODEC, len);
+
+    const size_t total = FRAME_MAGIC_LEN + FRAME_HDR_LEN + len;
+
+    if (write (c->fd, buf, total) != (ssize_t) total) {
+        perror ("write()");
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_args (int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "host", required_argument, 0, 'H' },
+        { "port", required_argument, 0, 'p' },
+        { "conns", required_argument, 0, 'c' },
+        { "senders", required_argument, 0, 's' },
+        { "rate", required_argument, 0, 'r' },
+        { "duration", required_argument, 0, 'd' },
+        { "warmup", required_argument, 0, 'w' },
+        { "size", required_argument, 0, 'z' },
+        { "pid", required_argument, 0, 'P' },
+        { "spread", required_argument, 0, 'S' },
+        { "compress", no_argument, 0, 'Z' },
+        { "admin", required_argument, 0, 'a' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 },
+    };
+    int opt;
+
+    while ((opt = getopt_long (argc, argv, "H:p:c:s:r:d:w:z:P:S:Za:h",
+                               long_options, 0)) != -1) {
+        switch (opt) {
+            case 'H':
+                opts.host = optarg;
+                break;
+            case 'p':
+                opts.port = optarg;
+                break;
+            case 'c':
+                opts.conns = atoi (optarg);
+                break;
+            case 's':
+                opts.senders = atoi (optarg);
+                break;
+            case 'r':
+                opts.rate = atof (optarg);
+                break;
+            case 'd':
+                opts.duration = atof (optarg);
+                break;
+            case 'w':
+                opts.warmup = atof (optarg);
+                break;
+            case 'z':
+                opts.size = atoi (optarg);
+                break;
+            case 'P':
+                opts.pid = atol (optarg);
+                break;
+            case 'S':
+                opts.spread = atoi (optarg);
+                break;
+            case 'Z':
+                opts.compress = 1;
+                break;
+            case 'a':
+                opts.admin = optarg;
+                break;
+            case 'h':
+                usage (stdout);
+                return 1;
+            default:
+                usage (stderr);
+                return -1;
+        }
+    }
+    if (opts.conns < 2 || opts.senders < 1 || opts.senders > opts.conns
+        || opts.rate <= 0 || opts.duration <= 0 || opts.warmup < 0
+        || opts.size < 32 || opts.size > LINE_MAX_LEN) {
+        fprintf (stderr, "%s: invalid option; see --help.\n", LOADGEN_NAME);
+        return -1;
+    }
+    return 0;
+}
+
+int main (int argc, char *argv[])
+{
+    switch (parse_args (argc, argv)) {
+        case 1:
+            return EXIT_SUCCESS;
+        case -1:
+            return EXIT_FAILURE;
+    }
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC,.ai_socktype = SOCK_STREAM };
+    struct addrinfo *ai;
+    const int err = getaddrinfo (opts.host, opts.port, &hints, &ai);
+
+    if (err) {
+        fprintf (stderr, "%s: %s: %s\n", LOADGEN_NAME, opts.host,
+                 gai_strerror (err));
+        return EXIT_FAILURE;
+    }
+    if (opts.spread == -1) {
+        opts.spread = is_loopback (ai);
+    }
+    raise_fd_limit (opts.conns + 16);
+
+    const int epfd = epoll_create1 (EPOLL_CLOEXEC);
+    struct conn *const conns = calloc ((size_t) opts.conns, sizeof *conns);
+
+    if (epfd == -1 || !conns) {
+        perror ("setup");
+        return EXIT_FAILURE;
+    }
+
+    /*
+     * Connect everyone before anyone sends.
+     */
+    struct epoll_event events[MAX_EVENTS];
+    int connected = 0;
+
+    for (int i = 0; i < opts.conns; i++) {
+        if (open_conn (&conns[i], i, ai, epfd) == -1) {
+            return EXIT_FAILURE;
+        }
+    }
+    freeaddrinfo (ai);
+
+    for (const long long deadline = now_ns () + 10000000000LL;
+         connected < opts.conns && now_ns () < deadline;) {
+        const int n = epoll_wait (epfd, events, MAX_EVENTS, 100);
+
+        for (int i = 0; i < n; i++) {
+            struct conn *const c = &conns[events[i].data.u32];
+
+            if (c->connected) {
+                drain (c, 0, 0);
+                continue;
+            }
+
+            int so_error = 0;
+            socklen_t len = sizeof so_error;
+
+            getsockopt (c->fd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+
+            if (so_error) {
+                fprintf (stderr, "%s: connect(): %s\n", LOADGEN_NAME,
+                         strerror (so_error));
+                return EXIT_FAILURE;
+            }
+            c->connected = 1;
+            connected++;
+
+            if (opts.compress && ask_compress (c) == -1) {
+                return EXIT_FAILURE;
+            }
+
+            struct epoll_event ev = {.events = EPOLLIN,.data = events[i].data };
+
+            epoll_ctl (epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        }
+    }
+    if (connected < opts.conns) {
+        fprintf (stderr, "%s: only %d of %d connections were made.\n",
+                 LOADGEN_NAME, connected, opts.conns);
+        return EXIT_FAILURE;
+    }
+
+    /*
+     * Give the server a moment to admit the last of them.
+     */
+    nanosleep (&(struct timespec) {.tv_nsec = 200000000 }, 0);
+
+    const int tfd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    const struct itimerspec tick = {
+        .it_interval = {.tv_nsec = TICK_NS },
+        .it_value = {.tv_nsec = TICK_NS },
+    };
+    struct epoll_event tev = {.events = EPOLLIN,.data.u32 = UINT32_MAX };
+
+    if (tfd == -1 || timerfd_settime (tfd, 0, &tick, 0) == -1
+        || epoll_ctl (epfd, EPOLL_CTL_ADD, tfd, &tev) == -1) {
+        perror ("timerfd");
+        return EXIT_FAILURE;
+    }
+
+    const long long start = now_ns ();
+    const long long measure_from = start + (long long) (opts.warmup * 1e9);
+    const long long measure_to = measure_from + (long long) (opts.duration * 1e9);
+    const long long stop = measure_to + 1000000000LL;   /* To drain. */
+    unsigned long long sent_total = 0;
+    unsigned long long sent_before = 0;
+    double user0 = 0, sys0 = 0, user1 = 0, sys1 = 0;
+    unsigned long long wire0 = 0, plain0 = 0, wire = 0, plain = 0;
+    unsigned long long packed0 = 0, spent0 = 0, packed = 0, spent = 0;
+    struct rusage ru0, ru1;
+    int measuring = 0;
+    int next_sender = 0;
+
+    /*
+     * A pass that falls far behind may outlast the drain, but the
+     * measurement is always closed.
+     */
+    while (measuring < 2 || now_ns () < stop) {
+        const int n = epoll_wait (epfd, events, MAX_EVENTS, 100);
+        const long long now = now_ns ();
+
+        if (!measuring && now >= measure_from) {
+            measuring = 1;
+            sent_before = stats.sent;
+            getrusage (RUSAGE_SELF, &ru0);
+
+            if (opts.pid && proc_cpu (opts.pid, &user0, &sys0) == -1) {
+                opts.pid = 0;
+            }
+            wire0 = stats.bytes_in;
+            plain0 = stats.bytes_plain;
+
+            if (opts.admin) {
+                packed0 = scrape (opts.admin, "ss_messages_compressed_total");
+                spent0 = scrape (opts.admin, "ss_compress_nanoseconds_total");
+            }
+        }
+        if (measuring == 1 && now >= measure_to) {
+            measuring = 2;
+            sent_total = stats.sent - sent_before;
+            getrusage (RUSAGE_SELF, &ru1);
+
+            if (opts.pid) {
+                proc_cpu (opts.pid, &user1, &sys1);
+            }
+            wire = stats.bytes_in - wire0;
+            plain = stats.bytes_plain - plain0;
+
+            if (opts.admin) {
+                packed = scrape (opts.admin, "ss_messages_compressed_total")
+                    - packed0;
+                spent = scrape (opts.admin, "ss_compress_nanoseconds_total")
+                    - spent0;
+            }
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u32 == UINT32_MAX) {
+                uint64_t expirations;
+
+                if (read (tfd, &expirations, sizeof expirations) == -1) {
+                    continue;
+                }
+                if (now >= measure_to) {
+                    continue;
+                }
+
+                /*
+                 * Send however many lines the rate says are due by now.
+                 */
+                const unsigned long long due =
+                    (unsigned long long) ((double) (now - start) / 1e9
+                                          * opts.rate);
+
+                while (stats.sent < due) {
+                    send_line (&conns[next_sender], next_sender);
+                    next_sender = (next_sender + 1) % opts.senders;
+                }
+                continue;
+            }
+
+            struct conn *const c = &conns[events[i].data.u32];
+
+            if (drain (c, measure_from, measure_to) == -1) {
+                fprintf (stderr, "%s: the server closed a connection.\n",
+                         LOADGEN_NAME);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    const double secs = opts.duration;
+    const double expected = (double) sent_total * (opts.conns - 1);
+
+    printf ("connections  %d, of which %d send %d-byte lines\n", opts.conns,
+            opts.senders, opts.size);
+    printf ("sent         %llu lines, %.0f/s\n", sent_total,
+            (double) sent_total / secs);
+    printf ("delivered    %llu lines, %.0f/s (%.2f%% of %.0f expected)\n",
+            stats.delivered, (double) stats.delivered / secs,
+            expected ? 100.0 * (double) stats.delivered / expected : 0,
+            expected);
+    printf ("latency      p50 %.1f us, p99 %.1f us, p999 %.1f us, max %.1f us\n",
+            (double) percentile (0.5) / 1e3, (double) percentile (0.99) / 1e3,
+            (double) percentile (0.999) / 1e3, (double) stats.max_ns / 1e3);
+
+    if (opts.pid) {
+        printf ("server CPU   %.1f%% (user %.1f%%, system %.1f%%)\n",
+                100 * (user1 - user0 + sys1 - sys0) / secs,
+                100 * (user1 - user0) / secs, 100 * (sys1 - sys0) / secs);
+    }
+
+    /*
+     * What compressing cost the server, per byte it kept off the wire.
+     */
+    if (opts.compress) {
+        const unsigned long long saved = plain > wire ? plain - wire : 0;
+
+        printf ("received     %llu bytes for %llu uncompressed (%.1f%% saved)\n",
+                wire, plain, plain ? 100.0 * (double) saved / (double) plain
+                : 0);
+
+        if (opts.admin) {
+            printf ("compression  %llu messages, %.2f ms, %.3f ns per byte saved\n",
+                    packed, (double) spent / 1e6,
+                    saved ? (double) spent / (double) saved : 0);
+        }
+    }
+
+    const double self_cpu =
+        (double) (ru1.ru_utime.tv_sec - ru0.ru_utime.tv_sec
+                  + ru1.ru_stime.tv_sec - ru0.ru_stime.tv_sec)
+        + (double) (ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec
+                    + ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec) / 1e6;
+
+    printf ("loadgen CPU  %.1f%%%s\n", 100 * self_cpu / secs,
+            self_cpu / secs > 0.9 ? " (the generator may be the bottleneck)"
+            : "");
+
+    for (int i = 0; i < opts.conns; i++) {
+        close (conns[i].fd);
+        free (conns[i].buf);
+    }
+    free (conns);
+    close (tfd);
+    close (epfd);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,645 @@
+/**
+*	@file	microbench.c
+*
+*	@brief	Microbenchmarks for the server's hot paths, run in isolation over
+*			socketpairs and in-memory tables.
+*
+*	Each benchmark is run in batches until it has taken long enough to time,
+*	and reports the time, allocations and system calls per operation. Only
+*	the batches themselves are measured: draining the far end of a socket,
+*	say, is not.
+*
+*	Allocations and system calls are counted by linking with --wrap for
+*	the functions in WRAPPED below (see the Makefile), so they count calls
+*	the server's code makes, not those made inside libc.
+*/
+
+#ifdef _POSIX_C_SOURCE
+#undef _POSIX_C_SOURCE
+#endif
+
+#define _GNU_SOURCE             /* fopencookie() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "client_info.h"
+#include "config.h"
+#include "event.h"
+#include "frame.h"
+#include "log.h"
+#include "msgbuf.h"
+#include "network.h"
+#include "recvbuf.h"
+#include "room.h"
+
+#define MICROBENCH_NAME "microbench"
+#define LINE_LEN		64
+#define FANOUT			64      /* Members a message is sent to. */
+#define TABLE_SIZE		2048
+#define TABLE_FILL		512     /* Entries of the lookup table in use. */
+#define NS_SLACK		5.0     /* Never a regression, however short the op. */
+
+/*
+*	The server's globals, which main.c would define.
+*/
+int pfds[2] = { 0 };
+FILE *log_fp = 0;
+
+static int counting;
+static unsigned long long allocs;
+static unsigned long long syscalls;
+
+/*
+*	The wrapped functions, which count their calls while counting is set.
+*/
+#define WRAPPED(ret, name, params, args, counter) \
+    ret __real_##name params; \
+    ret __wrap_##name params; \
+    ret __wrap_##name params \
+    { \
+        if (counting) { \
+            counter++; \
+        } \
+        return __real_##name args; \
+    }
+
+WRAPPED (void *, malloc, (size_t n), (n), allocs)
+WRAPPED (void *, calloc, (size_t n, size_t size), (n, size), allocs)
+WRAPPED (void *, realloc, (void *p, size_t n), (p, n), allocs)
+WRAPPED (ssize_t, read, (int fd, void *buf, size_t n), (fd, buf, n), syscalls)
+WRAPPED (ssize_t, readv, (int fd, const struct iovec *iov, int n),
+         (fd, iov, n), syscalls)
+WRAPPED (ssize_t, write, (int fd, const void *buf, size_t n), (fd, buf, n),
+         syscalls)
+WRAPPED (ssize_t, send, (int fd, const void *buf, size_t n, int flags),
+         (fd, buf, n, flags), syscalls)
+WRAPPED (ssize_t, sendmsg, (int fd, const struct msghdr *msg, int flags),
+         (fd, msg, flags), syscalls)
+WRAPPED (ssize_t, recv, (int fd, void *buf, size_t n, int flags),
+         (fd, buf, n, flags), syscalls)
+WRAPPED (int, epoll_ctl, (int epfd, int op, int fd, struct epoll_event *ev),
+         (epfd, op, fd, ev), syscalls)
+WRAPPED (int, epoll_wait, (int epfd, struct epoll_event *ev, int n, int ms),
+         (epfd, ev, n, ms), syscalls)
+WRAPPED (void *, mmap, (void *addr, size_t n, int prot, int flags, int fd,
+                        off_t off), (addr, n, prot, flags, fd, off), syscalls)
+WRAPPED (int, munmap, (void *addr, size_t n), (addr, n), syscalls)
+
+/*
+*	A benchmark. run() does ops operations and is timed; prepare(), if
+*	any, sets up for the next batch and is not.
+*/
+struct bench {
+    const char *name;
+    int ops;
+    void (*setup) (void);
+    void (*prepare) (void);
+    void (*run) (void);
+    void (*teardown) (void);
+};
+
+struct result {
+    char name[64];
+    double ns;
+    double allocs;
+    double syscalls;
+};
+
+static char line[LINE_LEN];
+
+/*
+*	State the benchmarks share.
+*/
+static int pair[2];             /* The server's end, and the client's. */
+static struct slab rings;
+static struct recvbuf rbuf;
+static struct event_loop *loop;
+static struct client_table table;
+static int peers[FANOUT];       /* The clients' ends of the members. */
+static struct msgbuf *msg;
+static FILE *null_stream;
+static volatile int sink;       /* Keeps lookups from being optimised out. */
+
+static long long now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void die (const char *what)
+{
+    perror (what);
+    exit (EXIT_FAILURE);
+}
+
+/**
+*	\brief	Reads whatever is waiting on fd, which must be non-blocking.
+*/
+static void drain_fd (int fd)
+{
+    char buf[65536];
+
+    while (read (fd, buf, sizeof buf) > 0) ;
+}
+
+static void open_pair (void)
+{
+    if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair) == -1) {
+        die ("socketpair()");
+    }
+}
+
+static void close_pair (void)
+{
+    close (pair[0]);
+    close (pair[1]);
+}
+
+/*
+*	recvbuf_read() and recvbuf_take(): an op is one line received and taken,
+*	in reads of 16 lines.
+*/
+#define RECV_BATCH 16
+
+static void recv_setup (void)
+{
+    open_pair ();
+    slab_init (&rings, RECVBUF_LEN, 4);
+}
+
+static void recv_prepare (void)
+{
+    char batch[RECV_BATCH * LINE_LEN];
+
+    for (int i = 0; i < RECV_BATCH; i++) {
+        memcpy (batch + i * LINE_LEN, line, LINE_LEN);
+    }
+    if (write (pair[1], batch, sizeof batch) != (ssize_t) sizeof batch) {
+        die ("write()");
+    }
+}
+
+static void recv_run (void)
+{
+    struct msgbuf *m;
+
+    if (recvbuf_read (&rbuf, &rings, pair[0]) == -1) {
+        die ("recvbuf_read()");
+    }
+    while (recvbuf_take (&rbuf, ROOM_LOBBY, &m) == RECV_MESSAGE) {
+        msgbuf_put (m);
+    }
+}
+
+static void recv_teardown (void)
+{
+    recvbuf_free (&rbuf, &rings);
+    slab_destroy (&rings);
+    close_pair ();
+}
+
+/*
+*	send_internal(): an op is one line sent.
+*/
+#define SEND_BATCH 64
+
+static void send_run (void)
+{
+    for (int i = 0; i < SEND_BATCH; i++) {
+        size_t len = LINE_LEN;
+
+        if (send_internal (pair[0], line, &len) == -1) {
+            die ("send_internal()");
+        }
+    }
+}
+
+static void send_prepare (void)
+{
+    drain_fd (pair[1]);
+}
+
+/**
+*	\brief	Puts a client on fd in entry of table, from an address of its
+*			own.
+*/
+static struct client_info *add_client (int fd, int entry)
+{
+    struct client_info info = {
+        .address = {.family = AF_INET },
+        .events = EV_RECV,
+        .serial = (unsigned long long) entry + 1,
+    };
+
+    memcpy (info.address.bytes, &entry, sizeof entry);
+
+    if (fill_client_entry (fd, entry, &table, &info) == -1) {
+        die ("fill_client_entry()");
+    }
+    return table.p_slaves[entry];
+}
+
+/*
+*	send_response() and flush_pending(): an op is one message queued for,
+*	and sent to, FANOUT members of a room.
+*/
+#define FANOUT_BATCH 16
+
+static void fanout_setup (void)
+{
+    if (!(loop = event_loop_new ("epoll", TABLE_SIZE))
+        || init_clients (&table, TABLE_SIZE) == -1) {
+        die ("setup");
+    }
+    for (int i = 0; i < FANOUT; i++) {
+        int sv[2];
+
+        if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == -1) {
+            die ("socketpair()");
+        }
+
+        struct client_info *const c = add_client (sv[0], i);
+
+        if (room_join (&table, c, ROOM_LOBBY) == -1
+            || event_add (loop, sv[0], EV_RECV) == -1) {
+            die ("setup");
+        }
+        peers[i] = sv[1];
+    }
+    if (!(msg = msgbuf_alloc (FRAME_HDR_LEN + LINE_LEN))) {
+        die ("msgbuf_alloc()");
+    }
+    frame_encode ((unsigned char *) msg->data, &(struct frame) {
+                  .length = LINE_LEN,.type = FRAME_DATA,.room = ROOM_LOBBY}
+    );
+    memcpy (msg->data + FRAME_HDR_LEN, line, LINE_LEN);
+    msg->len = FRAME_HDR_LEN + LINE_LEN;
+}
+
+static void fanout_prepare (void)
+{
+    for (int i = 0; i < FANOUT; i++) {
+        drain_fd (peers[i]);
+    }
+}
+
+static void fanout_run (void)
+{
+    for (int i = 0; i < FANOUT_BATCH; i++) {
+        send_response (loop, msg, ROOM_LOBBY, -1, &table);
+        flush_pending (loop, &table);
+    }
+}
+
+static void fanout_teardown (void)
+{
+    for (int i = 0; i < FANOUT; i++) {
+        const int fd = table.p_slaves[i]->sock;
+
+        clear_client_entry (i, &table);
+        close (fd);
+        close (peers[i]);
+    }
+    msgbuf_put (msg);
+    free_clients (&table);
+    event_loop_free (loop);
+}
+
+/*
+*	log_msg(), to a stream that writes to /dev/null: an op is one record.
+*/
+#define LOG_BATCH 64
+
+static ssize_t null_write (void *cookie, const char *buf, size_t size)
+{
+    return write (*(int *) cookie, buf, size);
+}
+
+static void log_setup (void)
+{
+    static int null_fd;
+
+    if ((null_fd = open ("/dev/null", O_WRONLY | O_CLOEXEC)) == -1
+        || !(null_stream = fopencookie (&null_fd, "w",
+                                        (cookie_io_functions_t) {
+                                        .write = null_write}))) {
+        die ("setup");
+    }
+    /*
+     * As log_start() leaves the log.
+     */
+    setvbuf (null_stream, 0, _IOFBF, BUFSIZ);
+}
+
+static void log_run (void)
+{
+    for (int i = 0; i < LOG_BATCH; i++) {
+        log_msg (null_stream, "Received a new connection from 192.0.2.1.",
+                 LOG_FULLTIME);
+    }
+}
+
+static void log_teardown (void)
+{
+    fclose (null_stream);
+}
+
+/*
+*	Lookups in a table with TABLE_FILL of its TABLE_SIZE entries in use,
+*	every other one vacated: an op is one lookup.
+*/
+#define LOOKUP_BATCH 64
+
+static void lookup_setup (void)
+{
+    if (init_clients (&table, TABLE_SIZE) == -1) {
+        die ("init_clients()");
+    }
+
+    /*
+     * The descriptors are never used, so need not be open.
+     */
+    for (int i = 0; i < TABLE_FILL * 2; i++) {
+        add_client (i + 16, i);
+    }
+    for (int i = 0; i < TABLE_FILL * 2; i += 2) {
+        clear_client_entry (i, &table);
+    }
+}
+
+static void find_slot_run (void)
+{
+    for (int i = 0; i < LOOKUP_BATCH; i++) {
+        sink = find_empty_slot (&table);
+    }
+}
+
+static void find_fd_run (void)
+{
+    for (int i = 0; i < LOOKUP_BATCH; i++) {
+        sink = !!find_client_by_fd (&table, 16 + (i * 7 % (TABLE_FILL * 2)));
+    }
+}
+
+static void find_pred_run (void)
+{
+    for (int i = 0; i < LOOKUP_BATCH; i++) {
+        const struct client_info *const c =
+            table.p_slaves[1 + 2 * (i * 7 % TABLE_FILL)];
+
+        sink = !!find_predecessor (&table, c);
+    }
+}
+
+static void lookup_teardown (void)
+{
+    free_clients (&table);
+}
+
+static const struct bench benches[] = {
+    { "recvbuf_read+take", RECV_BATCH, recv_setup, recv_prepare, recv_run,
+      recv_teardown },
+    { "send_internal", SEND_BATCH, open_pair, send_prepare, send_run,
+      close_pair },
+    { "send_response+flush", FANOUT_BATCH, fanout_setup, fanout_prepare,
+      fanout_run, fanout_teardown },
+    { "log_msg", LOG_BATCH, log_setup, 0, log_run, log_teardown },
+    { "find_empty_slot", LOOKUP_BATCH, lookup_setup, 0, find_slot_run,
+      lookup_teardown },
+    { "find_client_by_fd", LOOKUP_BATCH, lookup_setup, 0, find_fd_run,
+      lookup_teardown },
+    { "find_predecessor", LOOKUP_BATCH, lookup_setup, 0, find_pred_run,
+      lookup_teardown },
+};
+
+static void measure (const struct bench *b, double min_secs, struct result *r)
+{
+    long long elapsed = 0;
+    unsigned long long batches = 0;
+
+    b->setup ();
+
+    /*
+     * One batch unmeasured, to warm the caches and pools.
+     */
+    if (b->prepare) {
+        b->prepare ();
+    }
+    b->run ();
+    allocs = syscalls = 0;
+
+    while (elapsed < (long long) (min_secs * 1e9)) {
+        if (b->prepare) {
+            b->prepare ();
+        }
+        counting = 1;
+
+        const long long start = now_ns ();
+
+        b->run ();
+        elapsed += now_ns () - start;
+        counting = 0;
+        batches++;
+    }
+    b->teardown ();
+
+    const double ops = (double) batches * b->ops;
+
+    snprintf (r->name, sizeof r->name, "%s", b->name);
+    r->ns = (double) elapsed / ops;
+    r->allocs = (double) allocs / ops;
+    r->syscalls = (double) syscalls / ops;
+}
+
+/**
+*	\brief	Compares r with the baseline for it in base, of n results.
+*	\return	0 if it is within tolerance, or has no baseline, or -1 if it has
+*			regressed.
+*/
+static int check (const struct result *r, const struct result *base, int n,
+                  double tolerance)
+{
+    for (int i = 0; i < n; i++) {
+        if (strcmp (base[i].name, r->name)) {
+            continue;
+        }
+
+        int regressed = 0;
+
+        /*
+         * Times vary from run to run, the shortest by a few nanoseconds
+         * whatever their length; counts should not, so any rise in them
+         * beyond rounding is a regression.
+         */
+        if (r->ns > base[i].ns * (1 + tolerance / 100) + NS_SLACK) {
+            fprintf (stderr, "%s: %s: %.1f ns/op, up from %.1f\n",
+                     MICROBENCH_NAME, r->name, r->ns, base[i].ns);
+            regressed = 1;
+        }
+        if (r->allocs > base[i].allocs + 0.01) {
+            fprintf (stderr, "%s: %s: %.2f allocs/op, up from %.2f\n",
+                     MICROBENCH_NAME, r->name, r->allocs, base[i].allocs);
+            regressed = 1;
+        }
+        if (r->syscalls > base[i].syscalls + 0.01) {
+            fprintf (stderr, "%s: %s: %.2f syscalls/op, up from %.2f\n",
+                     MICROBENCH_NAME, r->name, r->syscalls, base[i].syscalls);
+            regressed = 1;
+        }
+        return regressed ? -1 : 0;
+    }
+    return 0;
+}
+
+/**
+*	\brief	Reads up to max results from path, as written by -s.
+*	\return	The number read, or -1 on failure.
+*/
+static int load_baseline (const char *path, struct result *base, int max)
+{
+    FILE *const fp = fopen (path, "r");
+    int n = 0;
+
+    if (!fp) {
+        perror (path);
+        return -1;
+    }
+    while (n < max && fscanf (fp, "%63s %lf %lf %lf", base[n].name,
+                              &base[n].ns, &base[n].allocs,
+                              &base[n].syscalls) == 4) {
+        n++;
+    }
+    fclose (fp);
+    return n;
+}
+
+static void usage (FILE *stream)
+{
+    fprintf (stream, "Usage: %s [OPTION]... [BENCHMARK]...\n"
+             "Runs the named benchmarks, or all of them.\n\n"
+             "  -m, --min-time=S    Seconds to run each benchmark for\n"
+             "                      (default: 0.2).\n"
+             "  -s, --save=FILE     Save the results to FILE, as a baseline.\n"
+             "  -c, --check=FILE    Fail if any result is worse than FILE's.\n"
+             "  -t, --tolerance=PCT How much slower than the baseline is not\n"
+             "                      a regression (default: 25).\n"
+             "  -l, --list          List the benchmarks and exit.\n"
+             "  -h, --help          Show this help and exit.\n",
+             MICROBENCH_NAME);
+}
+
+int main (int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "min-time", required_argument, 0, 'm' },
+        { "save", required_argument, 0, 's' },
+        { "check", required_argument, 0, 'c' },
+        { "tolerance", required_argument, 0, 't' },
+        { "list", no_argument, 0, 'l' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 },
+    };
+    enum { N_BENCHES = sizeof benches / sizeof benches[0] };
+    const char *save = 0;
+    const char *baseline = 0;
+    double min_secs = 0.2;
+    double tolerance = 25;
+    int opt;
+
+    while ((opt = getopt_long (argc, argv, "m:s:c:t:lh", long_options, 0))
+           != -1) {
+        switch (opt) {
+            case 'm':
+                min_secs = atof (optarg);
+                break;
+            case 's':
+                save = optarg;
+                break;
+            case 'c':
+                baseline = optarg;
+                break;
+            case 't':
+                tolerance = atof (optarg);
+                break;
+            case 'l':
+                for (int i = 0; i < N_BENCHES; i++) {
+                    puts (benches[i].name);
+                }
+                return EXIT_SUCCESS;
+            case 'h':
+                usage (stdout);
+                return EXIT_SUCCESS;
+            default:
+                usage (stderr);
+                return EXIT_FAILURE;
+        }
+    }
+
+    struct result base[N_BENCHES * 2];
+    int n_base = 0;
+
+    if (baseline
+        && (n_base = load_baseline (baseline, base,
+                                    (int) (sizeof base / sizeof base[0])))
+        == -1) {
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < LINE_LEN - 1; i++) {
+        line[i] = (char) ('a' + i % 26);
+    }
+    line[LINE_LEN - 1] = '\n';
+
+    FILE *const out = save ? fopen (save, "w") : 0;
+
+    if (save && !out) {
+        perror (save);
+        return EXIT_FAILURE;
+    }
+    printf ("%-22s %10s %10s %12s\n", "benchmark", "ns/op", "allocs/op",
+            "syscalls/op");
+
+    int status = EXIT_SUCCESS;
+
+    for (int i = 0; i < N_BENCHES; i++) {
+        int wanted = optind == argc;
+
+        for (int j = optind; j < argc; j++) {
+            wanted |= !strcmp (argv[j], benches[i].name);
+        }
+        if (!wanted) {
+            continue;
+        }
+
+        struct result r;
+
+        measure (&benches[i], min_secs, &r);
+        printf ("%-22s %10.1f %10.2f %12.2f\n", r.name, r.ns, r.allocs,
+                r.syscalls);
+
+        if (out) {
+            fprintf (out, "%s %.1f %.2f %.2f\n", r.name, r.ns, r.allocs,
+                     r.syscalls);
+        }
+        if (check (&r, base, n_base, tolerance) == -1) {
+            status = EXIT_FAILURE;
+        }
+    }
+    if (out && fclose (out) == EOF) {
+        perror (save);
+        return EXIT_FAILURE;
+    }
+    return status;
+}
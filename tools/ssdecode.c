@@ -0,0 +1,380 @@
+/**
+*	@file	ssdecode.c
+*
+*	@brief	Renders the server's binary event log as text or JSON.
+*
+*	Records from several segment files, such as those of different threads,
+*	are merged in order of time.
+*/
+
+#ifdef _XOPEN_SOURCE
+#undef _XOPEN_SOURCE
+#endif
+
+#define _XOPEN_SOURCE 700       /* strptime() */
+
+#include "evlog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define DECODER_NAME "ssdecode"
+
+/*
+*	A segment being read, and where in it.
+*/
+struct cursor {
+    const char *name;
+    const char *map;
+    size_t size;
+    size_t pos;
+    struct evlog_segment hdr;
+    int64_t wall_ns;            /* Of the record at pos. */
+};
+
+static struct {
+    int json;
+    unsigned char events[SS_N_CODES];   /* Which to show, if any are set. */
+    int filtered;
+    int64_t since;
+    int64_t until;
+} opts = {
+    .since = INT64_MIN,
+    .until = INT64_MAX,
+};
+
+static void usage (FILE *stream)
+{
+    fprintf (stream, "Usage: %s [OPTION]... FILE...\n"
+             "Renders event log segments, merged in order of time.\n"
+             "  -j, --json          One JSON object per line, rather than text.\n"
+             "  -e, --event=NAME    Only show NAME events; may be repeated.\n"
+             "  -s, --since=TIME    Only show events from TIME on.\n"
+             "  -u, --until=TIME    Only show events before TIME.\n"
+             "  -h, --help          Show this help and exit.\n"
+             "TIME is seconds since the epoch, or local time as\n"
+             "YYYY-MM-DDTHH:MM:SS. Events are:", DECODER_NAME);
+
+    for (int i = 0; i < SS_N_CODES; i++) {
+        fprintf (stream, " %s", log_names[i]);
+    }
+    fputs (".\n", stream);
+}
+
+/**
+*	\brief	Parses seconds since the epoch, or a local time.
+*	\return	0 on success, or -1 on failure.
+*/
+static int parse_time (const char *s, int64_t *ns)
+{
+    char *end;
+
+    errno = 0;
+    const long long secs = strtoll (s, &end, 10);
+
+    if (!errno && end != s && !*end) {
+        *ns = secs * 1000000000;
+        return 0;
+    }
+
+    struct tm tm = { .tm_isdst = -1 };
+
+    end = strptime (s, "%Y-%m-%dT%H:%M:%S", &tm);
+
+    if (!end || *end) {
+        return -1;
+    }
+
+    const time_t t = mktime (&tm);
+
+    if (t == -1) {
+        return -1;
+    }
+    *ns = (int64_t) t * 1000000000;
+    return 0;
+}
+
+static int parse_event (const char *s)
+{
+    for (int i = 0; i < SS_N_CODES; i++) {
+        if (!strcmp (s, log_names[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+*	\brief	Maps a segment, and checks its header.
+*	\return	0 on success, or -1 on failure.
+*/
+static int open_cursor (struct cursor *c, const char *name)
+{
+    const int fd = open (name, O_RDONLY);
+    struct stat st;
+
+    c->name = name;
+
+    if (fd == -1 || fstat (fd, &st) == -1) {
+        perror (name);
+
+        if (fd != -1) {
+            close (fd);
+        }
+        return -1;
+    }
+    c->size = (size_t) st.st_size;
+
+    if (c->size < sizeof c->hdr) {
+        fprintf (stderr, "%s: %s: too short for a segment.\n",
+                 DECODER_NAME, name);
+        close (fd);
+        return -1;
+    }
+
+    void *const map = mmap (0, c->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close (fd);
+
+    if (map == MAP_FAILED) {
+        perror (name);
+        return -1;
+    }
+    c->map = map;
+    memcpy (&c->hdr, c->map, sizeof c->hdr);
+
+    if (memcmp (c->hdr.magic, EVLOG_MAGIC, sizeof c->hdr.magic)
+        || c->hdr.version != EVLOG_VERSION || c->hdr.order != 0x0102) {
+        fprintf (stderr, "%s: %s: not a segment this machine can read.\n",
+                 DECODER_NAME, name);
+        munmap (map, c->size);
+        c->map = 0;
+        return -1;
+    }
+    c->pos = sizeof c->hdr;
+    return 0;
+}
+
+/**
+*	\brief	Checks that there is a whole record at c's position, and works
+*			out when it was logged.
+*	\return	A pointer to it, or NULL if the segment has ended.
+*/
+static const char *peek (struct cursor *c)
+{
+    struct evlog_record rec;
+
+    if (c->pos + sizeof rec > c->size) {
+        return 0;
+    }
+    memcpy (&rec, c->map + c->pos, sizeof rec);
+
+    if (rec.len < sizeof rec || rec.len % EVLOG_ALIGN
+        || rec.len > c->size - c->pos || rec.code >= SS_N_CODES) {
+        return 0;
+    }
+    c->wall_ns = c->hdr.wall_ns + (rec.mono_ns - c->hdr.mono_ns);
+    return c->map + c->pos;
+}
+
+static void put_json_string (const char *s, size_t len)
+{
+    putchar ('"');
+
+    for (size_t i = 0; i < len; i++) {
+        const unsigned char ch = (unsigned char) s[i];
+
+        if (ch == '"' || ch == '\\') {
+            printf ("\\%c", ch);
+        } else if (ch < 0x20) {
+            printf ("\\u%04x", ch);
+        } else {
+            putchar (ch);
+        }
+    }
+    putchar ('"');
+}
+
+static void print_record (const struct cursor *c, const char *rec)
+{
+    struct evlog_record hdr;
+    struct evlog_arg args[8];
+
+    memcpy (&hdr, rec, sizeof hdr);
+
+    const int n = evlog_decode (rec, args, 8);
+
+    if (n == -1) {
+        fprintf (stderr, "%s: %s: bad record at offset %zu.\n", DECODER_NAME,
+                 c->name, c->pos);
+        return;
+    }
+
+    char text[4096];
+    char stamp[64];
+    struct tm tm;
+    const time_t secs = (time_t) (c->wall_ns / 1000000000);
+    const long usecs = (long) (c->wall_ns % 1000000000 / 1000);
+
+    evlog_render (text, sizeof text, hdr.code, args, n);
+    localtime_r (&secs, &tm);
+    strftime (stamp, sizeof stamp, "%Y-%m-%dT%H:%M:%S", &tm);
+
+    if (!opts.json) {
+        printf ("%s.%06ld, \"%s\"\n", stamp, usecs, text);
+        return;
+    }
+    printf ("{\"time\":\"%s.%06ld\",\"ns\":%lld,\"thread\":%u,\"event\":",
+            stamp, usecs, (long long) c->wall_ns, c->hdr.thread);
+    put_json_string (log_names[hdr.code], strlen (log_names[hdr.code]));
+    fputs (",\"args\":[", stdout);
+
+    int first = 1;
+
+    for (int i = 0; i < n; i++) {
+        if (args[i].type == 'p') {
+            continue;
+        }
+        if (!first) {
+            putchar (',');
+        }
+        first = 0;
+
+        switch (args[i].type) {
+            case 's':
+            case 'a':
+                put_json_string (args[i].s, args[i].len);
+                break;
+            case 'd':
+                printf ("%lld", args[i].i);
+                break;
+            default:
+                printf ("%llu", args[i].u);
+                break;
+        }
+    }
+    fputs ("],\"text\":", stdout);
+    put_json_string (text, strlen (text));
+    fputs ("}\n", stdout);
+}
+
+static int wanted (const struct cursor *c, const char *rec)
+{
+    struct evlog_record hdr;
+
+    memcpy (&hdr, rec, sizeof hdr);
+    return (!opts.filtered || opts.events[hdr.code])
+        && c->wall_ns >= opts.since && c->wall_ns < opts.until;
+}
+
+int main (int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "json", no_argument, 0, 'j' },
+        { "event", required_argument, 0, 'e' },
+        { "since", required_argument, 0, 's' },
+        { "until", required_argument, 0, 'u' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 },
+    };
+    int opt;
+
+    while ((opt = getopt_long (argc, argv, "je:s:u:h", long_options, 0)) != -1) {
+        switch (opt) {
+            case 'j':
+                opts.json = 1;
+                break;
+            case 'e':{
+                    const int code = parse_event (optarg);
+
+                    if (code == -1) {
+                        fprintf (stderr, "%s: unknown event: %s\n",
+                                 DECODER_NAME, optarg);
+                        return EXIT_FAILURE;
+                    }
+                    opts.events[code] = 1;
+                    opts.filtered = 1;
+                    break;
+                }
+            case 's':
+            case 'u':
+                if (parse_time (optarg, opt == 's' ? &opts.since
+                                : &opts.until) == -1) {
+                    fprintf (stderr, "%s: invalid time: %s\n", DECODER_NAME,
+                             optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'h':
+                usage (stdout);
+                return EXIT_SUCCESS;
+            default:
+                usage (stderr);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind == argc) {
+        usage (stderr);
+        return EXIT_FAILURE;
+    }
+
+    const int n = argc - optind;
+    struct cursor *const cursors = calloc ((size_t) n, sizeof *cursors);
+    int status = EXIT_SUCCESS;
+
+    if (!cursors) {
+        perror ("calloc()");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < n; i++) {
+        if (open_cursor (&cursors[i], argv[optind + i]) == -1) {
+            status = EXIT_FAILURE;
+        }
+    }
+
+    /*
+     * Merge: repeatedly take the earliest record any segment has next.
+     * There are rarely more than a few segments open, so a scan will do.
+     */
+    for (;;) {
+        struct cursor *first = 0;
+        const char *rec = 0;
+
+        for (int i = 0; i < n; i++) {
+            const char *const r = cursors[i].map ? peek (&cursors[i]) : 0;
+
+            if (r && (!first || cursors[i].wall_ns < first->wall_ns)) {
+                first = &cursors[i];
+                rec = r;
+            }
+        }
+        if (!first) {
+            break;
+        }
+        if (wanted (first, rec)) {
+            print_record (first, rec);
+        }
+
+        struct evlog_record hdr;
+
+        memcpy (&hdr, rec, sizeof hdr);
+        first->pos += hdr.len;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (cursors[i].map) {
+            munmap ((void *) cursors[i].map, cursors[i].size);
+        }
+    }
+    free (cursors);
+    return status;
+}